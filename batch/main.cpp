@@ -0,0 +1,376 @@
+#include "importer.hpp"
+#include "model.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+#include "timer.hpp"
+
+#include <SFML/Graphics/Image.hpp>
+#include <glm/trigonometric.hpp>
+#include <glm/vec3.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Headless batch renderer: draws a range of frames of a turntable animation and writes them as
+// image files or streams them to the standard output. Frames are rendered in parallel, each
+// worker thread with its own renderer, all sharing the read-only model
+
+enum class OutputFormat {
+  // binary PPM (P6), RGB
+  ppm,
+  png,
+  // width * height RGBA pixels, top row first, no header
+  raw,
+};
+
+struct Options {
+  std::size_t width{ 1280 };
+  std::size_t height{ 720 };
+  std::size_t thread_count{ std::thread::hardware_concurrency() };
+  // Frames rendered at the same time, 0 for one per thread. The threads are split between them
+  std::size_t worker_count{};
+  std::string model_path{ "../models/car/car.obj" };
+  // Frames first_frame to first_frame + frame_count - 1. A frame only depends on its number,
+  // so a long animation can be split in ranges rendered on different machines
+  std::size_t first_frame{};
+  std::size_t frame_count{ 360 };
+  // Rotation of the model around the y axis, in degrees: start_angle + frame * turn
+  float start_angle{};
+  float turn{ 1.0F };
+  glm::vec3 position{ 0.0F, -1.0F, -2.0F };
+  float scale{ 0.01F };
+  Camera camera{};
+  ShadingMode shading_mode{ ShadingMode::forward };
+  RasterBackend raster_backend{ RasterBackend::half_space };
+  bool msaa{};
+  bool compress_textures{};
+  // in pixels. The level of detail of a frame depends on the one drawn before it by the same
+  // renderer, so frames only come out the same whatever the worker count at 0, the full detail
+  float lod_error{};
+  OutputFormat format{ OutputFormat::ppm };
+  // Frames are written to output_prefix followed by their 6 digit number and the format
+  // extension. "-" streams them, in order, to the standard output (ppm or raw only)
+  std::string output_prefix{ "frame_" };
+};
+
+// RGBA bytes of the pixels, top row first. Colors are ABGR words, so they are already RGBA
+// bytes on little endian machines
+void get_rgba(const std::vector<std::uint32_t>& colors, std::vector<std::uint8_t>& bytes)
+{
+  bytes.resize(colors.size() * 4);
+  std::memcpy(bytes.data(), colors.data(), bytes.size());
+  if constexpr (std::endian::native == std::endian::big) {
+    auto* words = reinterpret_cast<std::uint32_t*>(bytes.data());
+    std::ranges::transform(words, words + colors.size(), words, [](std::uint32_t color) { return std::byteswap(color); });
+  }
+}
+
+// Encodes the frame into bytes, in a format streamed as is (ppm or raw)
+void encode_frame(const std::vector<std::uint32_t>& colors, const Options& options, std::vector<std::uint8_t>& bytes)
+{
+  if (options.format == OutputFormat::raw) {
+    get_rgba(colors, bytes);
+    return;
+  }
+  auto header = "P6\n" + std::to_string(options.width) + ' ' + std::to_string(options.height) + "\n255\n";
+  bytes.resize(header.size() + colors.size() * 3);
+  std::memcpy(bytes.data(), header.data(), header.size());
+  auto* rgb = bytes.data() + header.size();
+  for (auto color : colors) {
+    *rgb++ = static_cast<std::uint8_t>(color);
+    *rgb++ = static_cast<std::uint8_t>(color >> 8);
+    *rgb++ = static_cast<std::uint8_t>(color >> 16);
+  }
+}
+
+auto get_frame_path(const Options& options, std::size_t frame) -> std::string
+{
+  auto number = std::to_string(frame);
+  if (number.size() < 6) number.insert(0, 6 - number.size(), '0');
+  switch (options.format) {
+    case OutputFormat::ppm: return options.output_prefix + number + ".ppm";
+    case OutputFormat::png: return options.output_prefix + number + ".png";
+    case OutputFormat::raw: return options.output_prefix + number + ".raw";
+  }
+  return {};
+}
+
+auto write_frame_file(const std::vector<std::uint32_t>& colors, const Options& options, std::size_t frame, std::vector<std::uint8_t>& bytes) -> bool
+{
+  auto path = get_frame_path(options, frame);
+  if (options.format == OutputFormat::png) {
+    get_rgba(colors, bytes);
+    auto image = sf::Image{};
+    image.create(static_cast<unsigned>(options.width), static_cast<unsigned>(options.height), bytes.data());
+    return image.saveToFile(path);
+  }
+  encode_frame(colors, options, bytes);
+  auto stream = std::ofstream{ path, std::ios::binary };
+  stream.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  return static_cast<bool>(stream);
+}
+
+// Frames streamed to the standard output must come out in order, but are finished in any order.
+// A finished frame waits in one of slot_count slots until the frames before it are written,
+// and a worker waits before starting a frame whose slot is still taken
+class FrameQueue final {
+public:
+  FrameQueue(std::size_t first_frame, std::size_t slot_count)
+    : m_slots(slot_count),
+      m_ready(slot_count),
+      m_next_written{ first_frame }
+  {
+  }
+
+  // Waits until frame can be queued. False when the queue was stopped
+  auto wait_for_slot(std::size_t frame) -> bool
+  {
+    auto lock = std::unique_lock{ m_mutex };
+    m_slot_freed.wait(lock, [&] { return m_stopped || frame < m_next_written + m_slots.size(); });
+    return !m_stopped;
+  }
+
+  // Swaps bytes with the slot of frame, which was waited for
+  void push(std::size_t frame, std::vector<std::uint8_t>& bytes)
+  {
+    auto slot = frame % m_slots.size();
+    std::swap(m_slots[slot], bytes);
+    {
+      auto lock = std::lock_guard{ m_mutex };
+      m_ready[slot] = true;
+    }
+    m_frame_ready.notify_one();
+  }
+
+  // Writes frames, in order, until last_frame. False when the stream failed
+  auto write_until(std::size_t last_frame, std::FILE* stream) -> bool
+  {
+    for (; m_next_written <= last_frame;) {
+      auto slot = m_next_written % m_slots.size();
+      {
+        auto lock = std::unique_lock{ m_mutex };
+        m_frame_ready.wait(lock, [&] { return m_ready[slot]; });
+      }
+      const auto& bytes = m_slots[slot];
+      if (std::fwrite(bytes.data(), 1, bytes.size(), stream) != bytes.size()) {
+        stop();
+        return false;
+      }
+      {
+        auto lock = std::lock_guard{ m_mutex };
+        m_ready[slot] = false;
+        ++m_next_written;
+      }
+      m_slot_freed.notify_all();
+    }
+    return std::fflush(stream) == 0;
+  }
+
+  void stop()
+  {
+    {
+      auto lock = std::lock_guard{ m_mutex };
+      m_stopped = true;
+    }
+    m_slot_freed.notify_all();
+  }
+
+private:
+  std::vector<std::vector<std::uint8_t>> m_slots{};
+  // m_ready, m_next_written and m_stopped are guarded by m_mutex
+  std::vector<bool> m_ready{};
+  std::size_t m_next_written{};
+  bool m_stopped{};
+  std::mutex m_mutex{};
+  std::condition_variable m_frame_ready{};
+  std::condition_variable m_slot_freed{};
+};
+
+auto parse_size(std::string_view text, std::size_t& value) -> bool
+{
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc{} && end == text.data() + text.size();
+}
+
+auto parse_float(std::string_view text, float& value) -> bool
+{
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc{} && end == text.data() + text.size();
+}
+
+// "x,y,z"
+auto parse_vec3(std::string_view text, glm::vec3& value) -> bool
+{
+  for (auto axis = 0; axis < 3; ++axis) {
+    auto end = axis < 2 ? text.find(',') : text.size();
+    if (end == std::string_view::npos || !parse_float(text.substr(0, end), value[axis])) return false;
+    text.remove_prefix(std::min(end + 1, text.size()));
+  }
+  return true;
+}
+
+auto parse_options(int argc, char** argv) -> std::optional<Options>
+{
+  auto options = Options{};
+  auto arguments = std::vector<std::string_view>(argv + 1, argv + argc);
+  for (auto i = 0UZ; i < arguments.size(); ++i) {
+    auto name = arguments[i];
+    if (i + 1 >= arguments.size()) {
+      std::cerr << "Missing the value of " << name << '\n';
+      return {};
+    }
+    auto value = arguments[++i];
+    auto valid = true;
+    if (name == "--width") valid = parse_size(value, options.width) && options.width > 0;
+    else if (name == "--height") valid = parse_size(value, options.height) && options.height > 0;
+    else if (name == "--threads") valid = parse_size(value, options.thread_count);
+    else if (name == "--workers") valid = parse_size(value, options.worker_count);
+    else if (name == "--model") options.model_path = value;
+    else if (name == "--first") valid = parse_size(value, options.first_frame);
+    else if (name == "--frames") valid = parse_size(value, options.frame_count) && options.frame_count > 0;
+    else if (name == "--start-angle") valid = parse_float(value, options.start_angle);
+    else if (name == "--turn") valid = parse_float(value, options.turn);
+    else if (name == "--position") valid = parse_vec3(value, options.position);
+    else if (name == "--scale") valid = parse_float(value, options.scale);
+    else if (name == "--eye") valid = parse_vec3(value, options.camera.position);
+    else if (name == "--target") valid = parse_vec3(value, options.camera.target);
+    else if (name == "--fov") valid = parse_float(value, options.camera.vertical_fov) && options.camera.vertical_fov > 0.0F && options.camera.vertical_fov < 180.0F;
+    else if (name == "--shading") {
+      if (value == "forward") options.shading_mode = ShadingMode::forward;
+      else if (value == "visibility") options.shading_mode = ShadingMode::visibility;
+      else valid = false;
+    }
+    else if (name == "--rasterizer") {
+      if (value == "half-space") options.raster_backend = RasterBackend::half_space;
+      else if (value == "scanline") options.raster_backend = RasterBackend::scanline;
+      else valid = false;
+    }
+    else if (name == "--msaa") {
+      if (value == "on") options.msaa = true;
+      else if (value == "off") options.msaa = false;
+      else valid = false;
+    }
+    else if (name == "--texture-compression") {
+      if (value == "on") options.compress_textures = true;
+      else if (value == "off") options.compress_textures = false;
+      else valid = false;
+    }
+    else if (name == "--lod-error") valid = parse_float(value, options.lod_error) && options.lod_error >= 0.0F;
+    else if (name == "--format") {
+      if (value == "ppm") options.format = OutputFormat::ppm;
+      else if (value == "png") options.format = OutputFormat::png;
+      else if (value == "raw") options.format = OutputFormat::raw;
+      else valid = false;
+    }
+    else if (name == "--output") {
+      options.output_prefix = value;
+      valid = !value.empty();
+    }
+    else {
+      std::cerr << "Unknown option " << name << '\n'
+                << "Options: --width N --height N --threads N --workers N --model obj_path --first N --frames N"
+                << " --start-angle degrees --turn degrees --position x,y,z --scale S --eye x,y,z --target x,y,z --fov degrees"
+                << " --shading forward|visibility --rasterizer half-space|scanline --msaa on|off --texture-compression on|off"
+                << " --lod-error pixels --format ppm|png|raw --output prefix|-\n";
+      return {};
+    }
+    if (!valid) {
+      std::cerr << "Invalid value " << value << " of " << name << '\n';
+      return {};
+    }
+  }
+  if (options.output_prefix == "-" && options.format == OutputFormat::png) {
+    std::cerr << "Only ppm and raw frames can be streamed to the standard output\n";
+    return {};
+  }
+  return options;
+}
+
+auto main(int argc, char** argv) -> int
+{
+  auto options = parse_options(argc, argv);
+  if (!options) return 1;
+
+  auto thread_count = std::max(options->thread_count, 1UZ);
+  auto car = import_model(options->model_path, ImportOptions{ thread_count, true, options->compress_textures });
+  if (!car) return 1;
+  auto model = std::make_shared<const Model>(std::move(*car));
+
+  // Whole frames in parallel scale better than the tiles of a frame, which wait for each other
+  // between the pipeline stages. Extra threads, if any, go to the renderers
+  auto worker_count = std::min(options->worker_count == 0 ? thread_count : options->worker_count, options->frame_count);
+  auto renderer_thread_count = std::max(thread_count / worker_count, 1UZ);
+  auto last_frame = options->first_frame + options->frame_count - 1;
+  auto streamed = options->output_prefix == "-";
+#if defined(_WIN32)
+  if (streamed) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  auto queue = FrameQueue{ options->first_frame, 2 * worker_count };
+  auto next_frame = std::atomic<std::size_t>{ options->first_frame };
+  auto failed = std::atomic<bool>{};
+
+  auto work = [&] {
+    auto renderer = Renderer{ options->width, options->height, renderer_thread_count };
+    renderer.set_shading_mode(options->shading_mode);
+    renderer.set_raster_backend(options->raster_backend);
+    renderer.set_msaa(options->msaa);
+    renderer.set_lod_error(options->lod_error);
+    auto scene = Scene{};
+    scene.instances.push_back(Instance{ model, Transform{ options->position, glm::vec3{ 0.0F }, glm::vec3{ options->scale } } });
+    scene.camera = options->camera;
+    auto bytes = std::vector<std::uint8_t>{};
+    for (auto frame = next_frame++; frame <= last_frame && !failed; frame = next_frame++) {
+      if (streamed && !queue.wait_for_slot(frame)) return;
+      auto angle = options->start_angle + static_cast<float>(frame) * options->turn;
+      scene.instances[0].transform.rotation.y = glm::radians(angle);
+      renderer.clear();
+      renderer.render(scene);
+      if (streamed) {
+        encode_frame(renderer.colors(), *options, bytes);
+        queue.push(frame, bytes);
+      }
+      else if (!write_frame_file(renderer.colors(), *options, frame, bytes)) {
+        std::cerr << "Could not write the file " << get_frame_path(*options, frame) << '\n';
+        failed = true;
+      }
+    }
+  };
+
+  auto timer = Timer{};
+  auto workers = std::vector<std::jthread>{};
+  for (auto worker = 0UZ; worker < worker_count; ++worker) workers.emplace_back(work);
+  if (streamed && !queue.write_until(last_frame, stdout)) {
+    std::cerr << "Could not write to the standard output\n";
+    failed = true;
+  }
+  workers.clear();
+  if (failed) return 1;
+
+  auto seconds = timer.elapsed() / 1000.0;
+  std::cerr << options->frame_count << " frames in " << seconds << " s, "
+            << static_cast<double>(options->frame_count) / seconds << " frames/s with "
+            << worker_count << " workers of " << renderer_thread_count << " threads\n";
+  return 0;
+}
@@ -0,0 +1,468 @@
+#include "importer.hpp"
+#include "meshlet.hpp"
+#include "model.hpp"
+#include "profiler.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+#include "texture.hpp"
+#include "timer.hpp"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Headless benchmark: renders fixed scenarios offscreen and reports their frame times.
+// Every run of a scenario draws exactly the same frames, so results can be compared between builds
+
+struct Options {
+  std::size_t width{ 1280 };
+  std::size_t height{ 720 };
+  std::size_t thread_count{ std::thread::hardware_concurrency() };
+  std::size_t frame_count{ 200 };
+  std::size_t warmup_count{ 10 };
+  std::string model_path{ "../models/car/car.obj" };
+  ShadingMode shading_mode{ ShadingMode::forward };
+  RasterBackend raster_backend{ RasterBackend::half_space };
+  bool msaa{};
+  bool compress_textures{};
+  // in pixels, 0 always draws the full detail meshes
+  float lod_error{ 1.0F };
+  // in milliseconds, 0 always draws at the full resolution
+  float frame_budget{};
+  // empty runs every scenario
+  std::string scenario{};
+  // "-" writes to the standard output
+  std::string json_path{};
+  // Chrome trace of the run, only recorded when built with profiling
+  std::string trace_path{};
+};
+
+struct Result {
+  std::string name{};
+  std::vector<double> frame_times{};
+  // triangles submitted and rasterized, summed over the measured frames
+  std::size_t submitted{};
+  std::size_t rasterized{};
+  // render scale of the measured frames, summed over them. Imports leave it at 0
+  double render_scale{};
+  // pixels written, overdraw included, summed over the measured frames
+  std::size_t pixels{};
+  // pixels whose texture was sampled
+  std::size_t shaded_pixels{};
+};
+
+// Sets up frame number frame of the scenario
+using Animation = std::function<void(Scene& scene, std::size_t frame)>;
+
+struct Scenario {
+  std::string name{};
+  std::string description{};
+  Scene scene{};
+  Animation animate{};
+};
+
+auto checkerboard_texture() -> Texture
+{
+  constexpr auto size = 256UZ;
+  auto colors = std::vector<std::uint32_t>(size * size);
+  for (auto y = 0UZ; y < size; ++y) {
+    for (auto x = 0UZ; x < size; ++x) {
+      colors[y * size + x] = ((x / 16 + y / 16) % 2 == 0) ? 0xFFE0E0E0 : 0xFF306090;
+    }
+  }
+  return Texture{ colors, size, size };
+}
+
+// Grid of quads_x by quads_y quads on the plane z = 0, centered at the origin
+auto grid_mesh(const std::shared_ptr<const Texture>& texture, glm::vec2 size, std::size_t quads_x, std::size_t quads_y, float z = 0.0F) -> Mesh
+{
+  auto vertices = std::vector<Vertex>{};
+  auto indices = std::vector<std::uint32_t>{};
+  auto max_bounds = glm::vec2{ texture->width() - 1, texture->height() - 1 };
+  for (auto y = 0UZ; y <= quads_y; ++y) {
+    for (auto x = 0UZ; x <= quads_x; ++x) {
+      auto uv = glm::vec2{ static_cast<float>(x) / static_cast<float>(quads_x), static_cast<float>(y) / static_cast<float>(quads_y) };
+      vertices.push_back(Vertex{ glm::vec3{ (uv - 0.5F) * size, z }, uv * max_bounds });
+    }
+  }
+  for (auto y = 0UZ; y < quads_y; ++y) {
+    for (auto x = 0UZ; x < quads_x; ++x) {
+      auto corner = static_cast<std::uint32_t>(y * (quads_x + 1) + x);
+      auto row = static_cast<std::uint32_t>(quads_x + 1);
+      indices.insert(indices.end(), { corner, corner + 1, corner + row + 1, corner, corner + row + 1, corner + row });
+    }
+  }
+  return make_mesh(texture, std::move(vertices), std::move(indices));
+}
+
+auto single_instance(std::shared_ptr<const Model> model, const Transform& transform) -> Scene
+{
+  auto scene = Scene{};
+  scene.instances.push_back(Instance{ std::move(model), transform });
+  return scene;
+}
+
+auto make_scenarios(const std::shared_ptr<const Model>& car, const Options& options) -> std::vector<Scenario>
+{
+  auto scenarios = std::vector<Scenario>{};
+  // one turn over the measured frames
+  auto turn = [frame_count = options.frame_count](std::size_t frame) {
+    return 2.0F * std::numbers::pi_v<float> * static_cast<float>(frame) / static_cast<float>(std::max(frame_count, 1UZ));
+  };
+
+  scenarios.push_back(Scenario{
+    "car",
+    "the car in front of the camera, turning around",
+    single_instance(car, Transform{ glm::vec3{ 0.0F, -1.0F, -2.0F }, glm::vec3{ 0.0F }, glm::vec3{ 0.01F } }),
+    [turn](Scene& scene, std::size_t frame) { scene.instances[0].transform.rotation.y = turn(frame); } });
+
+  scenarios.push_back(Scenario{
+    "closeup",
+    "the car filling the screen, few large textured triangles",
+    single_instance(car, Transform{ glm::vec3{ 0.0F, 0.5F, 5.0F }, glm::vec3{ 0.0F }, glm::vec3{ 0.01F } }),
+    [turn](Scene& scene, std::size_t frame) { scene.instances[0].transform.rotation.y = turn(frame); } });
+
+  // Every car shares the geometry and textures of the first one
+  constexpr auto lot_columns = 20UZ;
+  constexpr auto lot_rows = 10UZ;
+  auto parking_lot = Scene{};
+  for (auto row = 0UZ; row < lot_rows; ++row) {
+    for (auto column = 0UZ; column < lot_columns; ++column) {
+      auto position = glm::vec3{ 5.0F * (static_cast<float>(column) - 9.5F), -2.5F, -6.0F - 8.0F * static_cast<float>(row) };
+      parking_lot.instances.push_back(Instance{ car, Transform{ position, glm::vec3{ 0.0F }, glm::vec3{ 0.01F } } });
+    }
+  }
+  scenarios.push_back(Scenario{
+    "parking_lot",
+    "200 instances of the car in a grid, each one turning around",
+    std::move(parking_lot),
+    [turn](Scene& scene, std::size_t frame) {
+      for (auto i = 0UZ; i < scene.instances.size(); ++i) {
+        scene.instances[i].transform.rotation.y = turn(frame) + 0.7F * static_cast<float>(i);
+      }
+    } });
+
+  // About one pixel per triangle at 1280x720
+  auto texture = std::make_shared<const Texture>(options.compress_textures ? checkerboard_texture().compress() : checkerboard_texture());
+  auto small_triangles = Model{};
+  small_triangles.meshes.push_back(grid_mesh(texture, glm::vec2{ 16.0F, 9.0F }, 640, 360));
+  scenarios.push_back(Scenario{
+    "small_triangles",
+    "a screen sized grid of 460800 triangles of about one pixel",
+    single_instance(std::make_shared<const Model>(std::move(small_triangles)), Transform{ glm::vec3{ 0.0F, 1.5F, 0.0F } }),
+    [turn](Scene& scene, std::size_t frame) { scene.instances[0].transform.rotation.z = 0.05F * std::sin(turn(frame)); } });
+
+  // Layers drawn back to front, so every one of them passes the depth test
+  constexpr auto layer_count = 16UZ;
+  auto overdraw = Model{};
+  for (auto layer = 0UZ; layer < layer_count; ++layer) {
+    overdraw.meshes.push_back(grid_mesh(texture, glm::vec2{ 24.0F, 14.0F }, 4, 4, 0.1F * static_cast<float>(layer)));
+  }
+  scenarios.push_back(Scenario{
+    "overdraw",
+    "16 full screen layers drawn back to front",
+    single_instance(std::make_shared<const Model>(std::move(overdraw)), Transform{ glm::vec3{ 0.0F, 1.5F, 0.0F } }),
+    [turn](Scene& scene, std::size_t frame) { scene.instances[0].transform.rotation.z = 0.05F * std::sin(turn(frame)); } });
+
+  // Tilted strips, each quad split into two triangles along its long diagonal
+  auto thin_triangles = Model{};
+  thin_triangles.meshes.push_back(grid_mesh(texture, glm::vec2{ 24.0F, 14.0F }, 1, 256));
+  scenarios.push_back(Scenario{
+    "thin_triangles",
+    "512 long thin triangles across the screen, tilted so their bounding boxes are mostly empty",
+    single_instance(std::make_shared<const Model>(std::move(thin_triangles)), Transform{ glm::vec3{ 0.0F, 1.5F, 0.0F } }),
+    [turn](Scene& scene, std::size_t frame) { scene.instances[0].transform.rotation.z = 0.6F + 0.05F * std::sin(turn(frame)); } });
+  return scenarios;
+}
+
+auto run_scenario(Renderer& renderer, Scenario& scenario, const Options& options) -> Result
+{
+  auto result = Result{ scenario.name };
+  // every scenario starts again from the full resolution
+  renderer.set_frame_time_budget(options.frame_budget);
+  for (auto frame = 0UZ; frame < options.warmup_count + options.frame_count; ++frame) {
+    scenario.animate(scenario.scene, frame);
+    auto scale = renderer.render_scale();
+    auto timer = Timer{};
+    renderer.clear();
+    renderer.render(scenario.scene);
+    auto elapsed = timer.elapsed();
+    PROFILE_FRAME();
+    if (frame < options.warmup_count) continue;
+
+    result.frame_times.push_back(elapsed);
+    result.render_scale += scale;
+    result.submitted += renderer.stats().submitted;
+    result.rasterized += renderer.stats().rasterized;
+    result.pixels += renderer.stats().pixels_written;
+    result.shaded_pixels += renderer.stats().pixels_shaded;
+  }
+#if defined(PROFILING)
+  std::cerr << Profiler::summary();
+#endif
+  return result;
+}
+
+// Imports the model from its source files, skipping the model cache
+auto run_import(const Options& options) -> std::optional<Result>
+{
+  auto result = Result{ "import" };
+  auto import_options = ImportOptions{ options.thread_count, false, options.compress_textures };
+  for (auto run = 0UZ; run < std::max(options.frame_count / 20, 3UZ); ++run) {
+    auto timer = Timer{};
+    auto model = import_model(options.model_path, import_options);
+    result.frame_times.push_back(timer.elapsed());
+    if (!model) return {};
+    for (const auto& mesh : model->meshes) result.submitted += mesh.face_count();
+  }
+  return result;
+}
+
+struct Summary {
+  double min{};
+  double median{};
+  double p99{};
+  double triangles_per_second{};
+  double pixels_per_second{};
+};
+
+auto summarize(const Result& result) -> Summary
+{
+  auto times = result.frame_times;
+  std::ranges::sort(times);
+  auto total = 0.0;
+  for (auto time : times) total += time;
+  auto seconds = total / 1000.0;
+  auto p99_index = static_cast<std::size_t>(std::ceil(0.99 * static_cast<double>(times.size()))) - 1;
+  return Summary{
+    times.front(),
+    times[times.size() / 2],
+    times[std::min(p99_index, times.size() - 1)],
+    static_cast<double>(result.submitted) / seconds,
+    static_cast<double>(result.pixels) / seconds
+  };
+}
+
+auto to_string(ShadingMode mode) -> std::string_view
+{
+  switch (mode) {
+    case ShadingMode::forward: return "forward";
+    case ShadingMode::visibility: return "visibility";
+  }
+  return "unknown";
+}
+
+auto to_string(RasterBackend backend) -> std::string_view
+{
+  switch (backend) {
+    case RasterBackend::half_space: return "half-space";
+    case RasterBackend::scanline: return "scanline";
+  }
+  return "unknown";
+}
+
+auto to_string(SimdLevel level) -> std::string_view
+{
+  switch (level) {
+    case SimdLevel::scalar: return "scalar";
+    case SimdLevel::sse41: return "sse4.1";
+    case SimdLevel::avx2: return "avx2";
+  }
+  return "unknown";
+}
+
+void write_json(std::ostream& stream, const Options& options, SimdLevel simd_level, const std::vector<Result>& results)
+{
+  stream << std::fixed << std::setprecision(4);
+  stream << "{\n"
+         << "  \"width\": " << options.width << ",\n"
+         << "  \"height\": " << options.height << ",\n"
+         << "  \"threads\": " << options.thread_count << ",\n"
+         << "  \"simd\": \"" << to_string(simd_level) << "\",\n"
+         << "  \"shading\": \"" << to_string(options.shading_mode) << "\",\n"
+         << "  \"rasterizer\": \"" << to_string(options.raster_backend) << "\",\n"
+         << "  \"msaa\": " << (options.msaa ? "true" : "false") << ",\n"
+         << "  \"texture_compression\": " << (options.compress_textures ? "true" : "false") << ",\n"
+         << "  \"lod_error\": " << options.lod_error << ",\n"
+         << "  \"frame_budget_ms\": " << options.frame_budget << ",\n"
+         << "  \"scenarios\": [";
+  for (auto i = 0UZ; i < results.size(); ++i) {
+    const auto& result = results[i];
+    auto summary = summarize(result);
+    auto count = static_cast<double>(result.frame_times.size());
+    stream << (i == 0 ? "\n" : ",\n")
+           << "    {\n"
+           << "      \"name\": \"" << result.name << "\",\n"
+           << "      \"frames\": " << result.frame_times.size() << ",\n"
+           << "      \"min_ms\": " << summary.min << ",\n"
+           << "      \"median_ms\": " << summary.median << ",\n"
+           << "      \"p99_ms\": " << summary.p99 << ",\n"
+           << "      \"triangles_per_frame\": " << static_cast<double>(result.submitted) / count << ",\n"
+           << "      \"rasterized_per_frame\": " << static_cast<double>(result.rasterized) / count << ",\n"
+           << "      \"pixels_per_frame\": " << static_cast<double>(result.pixels) / count << ",\n"
+           << "      \"shaded_pixels_per_frame\": " << static_cast<double>(result.shaded_pixels) / count << ",\n"
+           << "      \"mean_render_scale\": " << result.render_scale / count << ",\n"
+           << "      \"triangles_per_second\": " << summary.triangles_per_second << ",\n"
+           << "      \"pixels_per_second\": " << summary.pixels_per_second << "\n"
+           << "    }";
+  }
+  stream << "\n  ]\n}\n";
+}
+
+void print_table(std::ostream& stream, const std::vector<Result>& results)
+{
+  stream << std::left << std::setw(16) << "scenario" << std::right
+         << std::setw(10) << "min ms" << std::setw(10) << "median ms" << std::setw(10) << "p99 ms"
+         << std::setw(12) << "Mtris/s" << std::setw(12) << "Mpixels/s" << '\n';
+  stream << std::fixed << std::setprecision(3);
+  for (const auto& result : results) {
+    auto summary = summarize(result);
+    stream << std::left << std::setw(16) << result.name << std::right
+           << std::setw(10) << summary.min << std::setw(10) << summary.median << std::setw(10) << summary.p99
+           << std::setw(12) << summary.triangles_per_second / 1e6 << std::setw(12) << summary.pixels_per_second / 1e6 << '\n';
+  }
+}
+
+auto parse_size(std::string_view text, std::size_t& value) -> bool
+{
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc{} && end == text.data() + text.size();
+}
+
+auto parse_float(std::string_view text, float& value) -> bool
+{
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc{} && end == text.data() + text.size();
+}
+
+auto parse_options(int argc, char** argv) -> std::optional<Options>
+{
+  auto options = Options{};
+  auto arguments = std::vector<std::string_view>(argv + 1, argv + argc);
+  for (auto i = 0UZ; i < arguments.size(); ++i) {
+    auto name = arguments[i];
+    if (i + 1 >= arguments.size()) {
+      std::cerr << "Missing the value of " << name << '\n';
+      return {};
+    }
+    auto value = arguments[++i];
+    auto valid = true;
+    if (name == "--width") valid = parse_size(value, options.width) && options.width > 0;
+    else if (name == "--height") valid = parse_size(value, options.height) && options.height > 0;
+    else if (name == "--threads") valid = parse_size(value, options.thread_count);
+    else if (name == "--frames") valid = parse_size(value, options.frame_count) && options.frame_count > 0;
+    else if (name == "--warmup") valid = parse_size(value, options.warmup_count);
+    else if (name == "--model") options.model_path = value;
+    else if (name == "--shading") {
+      if (value == "forward") options.shading_mode = ShadingMode::forward;
+      else if (value == "visibility") options.shading_mode = ShadingMode::visibility;
+      else valid = false;
+    }
+    else if (name == "--rasterizer") {
+      if (value == "half-space") options.raster_backend = RasterBackend::half_space;
+      else if (value == "scanline") options.raster_backend = RasterBackend::scanline;
+      else valid = false;
+    }
+    else if (name == "--msaa") {
+      if (value == "on") options.msaa = true;
+      else if (value == "off") options.msaa = false;
+      else valid = false;
+    }
+    else if (name == "--texture-compression") {
+      if (value == "on") options.compress_textures = true;
+      else if (value == "off") options.compress_textures = false;
+      else valid = false;
+    }
+    else if (name == "--lod-error") valid = parse_float(value, options.lod_error) && options.lod_error >= 0.0F;
+    else if (name == "--frame-budget") valid = parse_float(value, options.frame_budget) && options.frame_budget >= 0.0F;
+    else if (name == "--scenario") options.scenario = value;
+    else if (name == "--json") options.json_path = value;
+    else if (name == "--trace") options.trace_path = value;
+    else {
+      std::cerr << "Unknown option " << name << '\n'
+                << "Options: --width N --height N --threads N --frames N --warmup N"
+                << " --model obj_path --shading forward|visibility --rasterizer half-space|scanline --msaa on|off --texture-compression on|off --lod-error pixels --frame-budget ms --scenario name --json path --trace path\n";
+      return {};
+    }
+    if (!valid) {
+      std::cerr << "Invalid value " << value << " of " << name << '\n';
+      return {};
+    }
+  }
+  return options;
+}
+
+auto main(int argc, char** argv) -> int
+{
+  auto options = parse_options(argc, argv);
+  if (!options) return 1;
+
+  auto car = import_model(options->model_path, ImportOptions{ options->thread_count, true, options->compress_textures });
+  if (!car) return 1;
+
+  auto renderer = Renderer{ options->width, options->height, options->thread_count };
+  renderer.set_shading_mode(options->shading_mode);
+  renderer.set_raster_backend(options->raster_backend);
+  renderer.set_msaa(options->msaa);
+  renderer.set_lod_error(options->lod_error);
+  auto results = std::vector<Result>{};
+  auto scenarios = make_scenarios(std::make_shared<const Model>(std::move(*car)), *options);
+  for (auto& scenario : scenarios) {
+    if (!options->scenario.empty() && options->scenario != scenario.name) continue;
+    std::cerr << "Running " << scenario.name << ": " << scenario.description << '\n';
+    results.push_back(run_scenario(renderer, scenario, *options));
+  }
+  if (options->scenario.empty() || options->scenario == "import") {
+    std::cerr << "Running import: " << options->model_path << " without the model cache\n";
+    auto result = run_import(*options);
+    if (!result) return 1;
+    results.push_back(std::move(*result));
+  }
+  if (results.empty()) {
+    std::cerr << "Unknown scenario " << options->scenario << '\n';
+    return 1;
+  }
+
+#if defined(PROFILING)
+  if (!options->trace_path.empty() && !Profiler::write_trace(options->trace_path)) {
+    std::cerr << "Could not write the file " << options->trace_path << '\n';
+    return 1;
+  }
+#else
+  if (!options->trace_path.empty()) {
+    std::cerr << "Ignoring --trace, profiling is disabled (CMake option ENABLE_PROFILING)\n";
+  }
+#endif
+
+  // with the JSON on stdout, the table goes to stderr so stdout stays valid JSON
+  print_table(options->json_path == "-" ? std::cerr : std::cout, results);
+  if (options->json_path == "-") {
+    write_json(std::cout, *options, renderer.simd_level(), results);
+  }
+  else if (!options->json_path.empty()) {
+    auto stream = std::ofstream{ options->json_path };
+    write_json(stream, *options, renderer.simd_level(), results);
+    if (!stream) {
+      std::cerr << "Could not write the file " << options->json_path << '\n';
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef _3D_FROM_SCRATCH_ALLOCATION_COUNTER_HPP
+#define _3D_FROM_SCRATCH_ALLOCATION_COUNTER_HPP
+
+#include <atomic>
+#include <cstddef>
+
+// Debug count of the calls to the global operator new, to check that code meant to run without
+// heap allocations really does. Each thread adds its allocations to the counter it was given,
+// if any, so threads working for different callers are counted apart.
+// It compiles to nothing unless the COUNT_ALLOCATIONS definition is set (CMake option
+// ENABLE_ALLOCATION_COUNTER), which replaces the global operator new and delete
+class AllocationCounter final {
+public:
+  using Counter = std::atomic<std::size_t>;
+
+#if defined(COUNT_ALLOCATIONS)
+  // Counter of the calling thread, nullptr when it doesn't count
+  static auto current() -> Counter*;
+  static void set_current(Counter* counter);
+#else
+  static auto current() -> Counter* { return nullptr; }
+  static void set_current(Counter*) {}
+#endif
+};
+
+// Counts the allocations of the calling thread, and of the threads it hands its counter to,
+// while it lives. A nested scope adds its count to the enclosing one when it ends
+class AllocationScope final {
+public:
+  AllocationScope()
+    : m_previous{ AllocationCounter::current() }
+  {
+    AllocationCounter::set_current(&m_count);
+  }
+
+  ~AllocationScope()
+  {
+    AllocationCounter::set_current(m_previous);
+    if (m_previous != nullptr) m_previous->fetch_add(count(), std::memory_order_relaxed);
+  }
+
+  AllocationScope(const AllocationScope&) = delete;
+  auto operator=(const AllocationScope&) -> AllocationScope& = delete;
+
+  // Allocations counted since the scope began
+  auto count() const -> std::size_t { return m_count.load(std::memory_order_relaxed); }
+
+private:
+  AllocationCounter::Counter* m_previous{};
+  AllocationCounter::Counter m_count{};
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _3D_FROM_SCRATCH_BUFFER_HPP
+#define _3D_FROM_SCRATCH_BUFFER_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Immutable array whose copies share the same elements. The elements live either in a vector
+// the buffer took over, or inside another object kept alive by the buffer (like a memory mapped file)
+template <typename T>
+class Buffer final {
+public:
+  Buffer() = default;
+
+  Buffer(std::vector<T> elements)
+  {
+    auto owner = std::make_shared<const std::vector<T>>(std::move(elements));
+    m_data = owner->data();
+    m_size = owner->size();
+    m_owner = std::move(owner);
+  }
+
+  // View of size elements at data, which stay valid while owner is alive
+  Buffer(std::shared_ptr<const void> owner, const T* data, std::size_t size)
+    : m_owner{ std::move(owner) }, m_data{ data }, m_size{ size }
+  {
+  }
+
+  // copies share the elements
+  Buffer(const Buffer&) = default;
+  auto operator=(const Buffer&) -> Buffer& = default;
+  // moved from buffers are left empty
+  Buffer(Buffer&& other) noexcept
+    : m_owner{ std::move(other.m_owner) }, m_data{ std::exchange(other.m_data, nullptr) }, m_size{ std::exchange(other.m_size, 0) }
+  {
+  }
+
+  auto operator=(Buffer&& other) noexcept -> Buffer&
+  {
+    m_owner = std::move(other.m_owner);
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    return *this;
+  }
+
+  ~Buffer() = default;
+
+  auto operator[](std::size_t index) const -> const T&
+  {
+    assert(index < m_size);
+    return m_data[index];
+  }
+
+  auto data() const -> const T* { return m_data; }
+  auto size() const -> std::size_t { return m_size; }
+  auto empty() const -> bool { return m_size == 0; }
+  auto begin() const -> const T* { return m_data; }
+  auto end() const -> const T* { return m_data + m_size; }
+
+private:
+  std::shared_ptr<const void> m_owner{};
+  const T* m_data{};
+  std::size_t m_size{};
+};
+
+#endif
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 
-#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 
 auto is_vertice_inside_frustum(const glm::vec4& v) -> bool;
 auto is_vertice_outside_frustum(const glm::vec4& v) -> bool;
@@ -19,11 +21,24 @@ enum FrustumPlane {
   top,
   plane_count
 };
-auto dot_product(const glm::vec4& v, FrustumPlane fplane) -> float;
+// The side planes (left, bottom, right and top) are pushed away from the center by guard_band,
+// 1 being the exact frustum
+auto dot_product(const glm::vec4& v, FrustumPlane fplane, float guard_band = 1.0F) -> float;
+
+// One bit (1 << plane) for each frustum plane the vertice is outside of
+using Outcode = std::uint8_t;
+auto get_outcode(const glm::vec4& v, float guard_band = 1.0F) -> Outcode;
+
 struct ClipVertex {
   glm::vec4 position{};
   glm::vec2 texture_coord{};
 };
-auto clip_triangle(const ClipVertex& vert_a, const ClipVertex& vert_b, const ClipVertex& vert_c) -> std::vector<ClipVertex>;
 
-#endif
\ No newline at end of file
+// Convex polygon output by the clipper. Every plane adds at most one vertex to it
+struct ClipPolygon {
+  std::array<ClipVertex, 3 + plane_count> vertices{};
+  std::size_t size{};
+};
+auto clip_triangle(const ClipVertex& vert_a, const ClipVertex& vert_b, const ClipVertex& vert_c, Outcode planes, float guard_band = 1.0F) -> ClipPolygon;
+
+#endif
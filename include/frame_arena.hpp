@@ -0,0 +1,114 @@
+#ifndef _3D_FROM_SCRATCH_FRAME_ARENA_HPP
+#define _3D_FROM_SCRATCH_FRAME_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Linear allocator for the temporary data of a frame. Allocations bump an offset into a block
+// and are never freed one by one: reset() frees them all at once by rewinding the offset.
+// A frame needing more than the block gets extra blocks from the heap, and the next reset()
+// trades them all for a single block holding that much, so once the frames stop growing
+// the arena stops allocating and reset() stays O(1).
+// It is a std::pmr::memory_resource, so std::pmr containers can live in it. Not thread safe
+class FrameArena final : public std::pmr::memory_resource {
+public:
+  explicit FrameArena(std::size_t initial_size = 64 * 1024);
+
+  FrameArena(const FrameArena&) = delete;
+  auto operator=(const FrameArena&) -> FrameArena& = delete;
+
+  // Everything allocated since the last reset must be unused from now on
+  void reset();
+  // Bytes allocated since the last reset, alignment padding included
+  auto used() const -> std::size_t { return m_used; }
+  auto capacity() const -> std::size_t;
+  // Heap allocations the arena made for its blocks since it was created
+  auto growth_count() const -> std::size_t { return m_growth_count; }
+
+private:
+  struct Block {
+    std::unique_ptr<std::byte[]> memory{};
+    std::size_t size{};
+  };
+
+  auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override;
+  void do_deallocate(void*, std::size_t, std::size_t) override {}
+  auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override { return this == &other; }
+  void add_block(std::size_t size);
+
+  // The first block is the one kept by reset(), the last one is being filled
+  std::vector<Block> m_blocks{};
+  std::size_t m_offset{};
+  std::size_t m_used{};
+  std::size_t m_growth_count{};
+};
+
+// Objects of type T, all of the same size, carved from an arena a slab of slab_size at a time.
+// Destroyed objects are reused by the next create(). reset() forgets every object, and must be
+// called along with the reset of the arena
+template <typename T, std::size_t slab_size = 64>
+class FramePool final {
+public:
+  static_assert(std::is_trivially_destructible_v<T>, "reset() doesn't run destructors");
+
+  explicit FramePool(FrameArena& arena)
+    : m_arena{ &arena }
+  {
+  }
+
+  FramePool(const FramePool&) = delete;
+  auto operator=(const FramePool&) -> FramePool& = delete;
+  FramePool(FramePool&&) noexcept = default;
+  auto operator=(FramePool&&) noexcept -> FramePool& = default;
+
+  template <typename... Args>
+  auto create(Args&&... args) -> T*
+  {
+    auto* node = m_free;
+    if (node != nullptr) {
+      m_free = node->next;
+    }
+    else {
+      if (m_slab_used == slab_size || m_slab == nullptr) {
+        m_slab = static_cast<Node*>(m_arena->allocate(sizeof(Node) * slab_size, alignof(Node)));
+        m_slab_used = 0;
+      }
+      node = &m_slab[m_slab_used++];
+    }
+    return ::new (static_cast<void*>(node->storage)) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T* object)
+  {
+    std::destroy_at(object);
+    auto* node = ::new (static_cast<void*>(object)) Node;
+    node->next = m_free;
+    m_free = node;
+  }
+
+  void reset()
+  {
+    m_slab = nullptr;
+    m_slab_used = 0;
+    m_free = nullptr;
+  }
+
+private:
+  // An object, or the link to the next free one once destroyed
+  union Node {
+    alignas(T) std::byte storage[sizeof(T)];
+    Node* next;
+  };
+
+  FrameArena* m_arena{};
+  Node* m_slab{};
+  std::size_t m_slab_used{};
+  Node* m_free{};
+};
+
+#endif
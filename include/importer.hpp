@@ -3,9 +3,21 @@
 
 #include "model.hpp"
 
+#include <cstddef>
 #include <optional>
 #include <string>
+#include <thread>
 
-auto import_model(const std::string& obj_path) -> std::optional<Model>;
+struct ImportOptions {
+  // Large files are parsed in chunks by up to thread_count threads
+  std::size_t thread_count{ std::thread::hardware_concurrency() };
+  // Load the model from its binary cache (see model_cache.hpp) when it is up to date,
+  // otherwise import it and write the cache
+  bool use_cache{ true };
+  // Block compress the textures (see TextureFormat), for 4 to 8 times less texture memory
+  bool compress_textures{ false };
+};
+
+auto import_model(const std::string& obj_path, const ImportOptions& options = {}) -> std::optional<Model>;
 
 #endif
\ No newline at end of file
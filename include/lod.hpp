@@ -0,0 +1,23 @@
+#ifndef _3D_FROM_SCRATCH_LOD_HPP
+#define _3D_FROM_SCRATCH_LOD_HPP
+
+#include "model.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Each level of detail aims at this fraction of the triangles of the previous one
+constexpr auto g_lod_triangle_ratio = 0.25F;
+constexpr auto g_lod_max_levels = 6UZ;
+
+// Sets the bounding sphere of the model from the vertices of its meshes
+void compute_model_bounds(Model& model);
+
+// Fills model.lods by simplifying its meshes again and again with the quadric error metric,
+// until a level stops shrinking. Edges are collapsed into one of their vertices, so the levels
+// reuse the vertices, texture coordinates included, of the full detail meshes. UV seams and
+// mesh borders only collapse along themselves, and positions shared by several meshes never move
+void build_model_lods(Model& model);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef _3D_FROM_SCRATCH_MAPPED_FILE_HPP
+#define _3D_FROM_SCRATCH_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only contents of a whole file. It is memory mapped when the platform allows it,
+// otherwise (or for empty files) it is read into a buffer
+class MappedFile final {
+public:
+  static auto open(const std::string& path) -> std::optional<MappedFile>;
+
+  MappedFile(MappedFile&& other) noexcept;
+  auto operator=(MappedFile&& other) noexcept -> MappedFile&;
+  MappedFile(const MappedFile&) = delete;
+  auto operator=(const MappedFile&) -> MappedFile& = delete;
+  ~MappedFile();
+
+  auto view() const -> std::string_view { return { m_data, m_size }; }
+
+private:
+  MappedFile() = default;
+  void unmap();
+
+  const char* m_data{};
+  std::size_t m_size{};
+  bool m_mapped{};
+  std::vector<char> m_buffer{};
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _3D_FROM_SCRATCH_MESHLET_HPP
+#define _3D_FROM_SCRATCH_MESHLET_HPP
+
+#include "model.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+constexpr auto g_meshlet_max_vertices = 64UZ;
+constexpr auto g_meshlet_max_triangles = 124UZ;
+
+// Splits an indexed triangle list into meshlets, growing each one through neighbor triangles.
+// Vertices shared between meshlets are duplicated, so each meshlet owns a contiguous range;
+// vertices and indices are rewritten in meshlet order
+auto build_meshlets(std::vector<Vertex>& vertices, std::vector<std::uint32_t>& indices) -> std::vector<Meshlet>;
+
+// Mesh whose meshlets are built from the triangle list
+auto make_mesh(std::shared_ptr<const Texture> texture, std::vector<Vertex> vertices, std::vector<std::uint32_t> indices) -> Mesh;
+
+// True when no face of the meshlet can be front facing from camera_position (in model space).
+// mirrored tells whether the model matrix has a negative determinant, which flips the faces
+auto is_meshlet_backfacing(const Meshlet& meshlet, const glm::vec3& camera_position, bool mirrored) -> bool;
+
+#endif
\ No newline at end of file
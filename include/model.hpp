@@ -1,12 +1,15 @@
 #ifndef _3D_FROM_SCRATCH_MODEL_HPP
 #define _3D_FROM_SCRATCH_MODEL_HPP
 
+#include "buffer.hpp"
 #include "texture.hpp"
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
-#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 struct Vertex {
@@ -14,17 +17,59 @@ struct Vertex {
   glm::vec2 texture_coord{};
 };
 
+// Cluster of nearby triangles of a mesh, culled as a whole by the renderer (see meshlet.hpp).
+// It owns a range of the mesh vertices and a range of its indices, which only refer to those vertices
+struct Meshlet {
+  std::uint32_t first_vertex{};
+  std::uint32_t vertex_count{};
+  std::uint32_t first_index{};
+  std::uint32_t index_count{};
+  // Bounding sphere, in model space
+  glm::vec3 center{};
+  float radius{};
+  // Every face normal is within the cone around cone_axis whose half angle has cosine
+  // cone_cutoff. A cutoff of zero or less (a half angle of 90 degrees or more) is never culled
+  glm::vec3 cone_axis{};
+  float cone_cutoff{};
+};
+
+// Indexed triangle list: every three indices form a counter-clockwise face.
+// Meshlets, when present, cover every face
 struct Mesh {
-  using Face = std::array<Vertex, 3>;
-  Texture texture;
-  std::vector<Face> faces{};
+  // Shared with every mesh using the same diffuse map
+  std::shared_ptr<const Texture> texture{};
+  Buffer<Vertex> vertices{};
+  Buffer<std::uint32_t> indices{};
+  Buffer<Meshlet> meshlets{};
+  // The vertex positions again, split in streams the renderer transforms several vertices
+  // at a time from: every x, then every y, then every z (see make_mesh)
+  Buffer<float> position_streams{};
+
+  auto face_count() const -> std::size_t { return indices.size() / 3; }
 };
 
+// Simplified version of every mesh of a model (see lod.hpp)
+struct ModelLod {
+  std::vector<Mesh> meshes{};
+  // How far the simplified surface may stray from the model one, in model units
+  float error{};
+};
+
+// Geometry of an imported model. It is placed in a scene by its instances (see scene.hpp),
+// which share it instead of copying it
 struct Model {
   std::vector<Mesh> meshes{};
-  glm::vec3 position{ 0.0F };
-  glm::vec3 rotation{ 0.0F };
-  glm::vec3 scale{ 1.0F };
+  // Levels of detail coarser than meshes, from the finest to the coarsest. Each level holds
+  // one mesh per mesh of the model, with the same texture. Empty when the model has not been simplified
+  std::vector<ModelLod> lods{};
+  // Bounding sphere of the meshes, in model units
+  glm::vec3 center{};
+  float radius{};
+
+  // Levels are numbered from 0, the full detail meshes, to lods.size()
+  auto level_count() const -> std::size_t { return lods.size() + 1; }
+  auto level_meshes(std::size_t level) const -> const std::vector<Mesh>& { return level == 0 ? meshes : lods[level - 1].meshes; }
+  auto level_error(std::size_t level) const -> float { return level == 0 ? 0.0F : lods[level - 1].error; }
 };
 
 #endif
\ No newline at end of file
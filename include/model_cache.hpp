@@ -0,0 +1,23 @@
+#ifndef _3D_FROM_SCRATCH_MODEL_CACHE_HPP
+#define _3D_FROM_SCRATCH_MODEL_CACHE_HPP
+
+#include "model.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// Binary copy of an imported model: its vertices, indices and mipmapped texels, laid out
+// the way the renderer reads them. Loading maps the file and points the meshes and
+// textures straight into it, so nothing is parsed or copied
+
+auto get_model_cache_path(const std::string& obj_path) -> std::string;
+
+// Empty when there is no cache, when it was written by another version or platform, or when
+// one of the files it was made from changed size or modification time since then
+auto load_model_cache(const std::string& cache_path) -> std::optional<Model>;
+
+// dependencies are the files the model was imported from, checked again on load
+auto save_model_cache(const std::string& cache_path, const std::vector<std::string>& dependencies, const Model& model) -> bool;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef _3D_FROM_SCRATCH_PRESENTER_HPP
+#define _3D_FROM_SCRATCH_PRESENTER_HPP
+
+#include <SFML/Graphics.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Displays rendered frames on its own thread, which takes over the OpenGL context of the window.
+// Frames are uploaded to a texture created once, so presenting allocates nothing.
+// The window must outlive the presenter, and its events are still polled by the thread that created it
+class Presenter final {
+public:
+  // At most max_frames_in_flight frames are queued or being displayed at once, so the renderer
+  // can rotate through max_frames_in_flight + 1 color buffers without overwriting one of them
+  Presenter(sf::RenderWindow& window, std::size_t width, std::size_t height, std::size_t max_frames_in_flight);
+  ~Presenter();
+
+  Presenter(const Presenter&) = delete;
+  auto operator=(const Presenter&) -> Presenter& = delete;
+
+  // Queues width * height colors for display, blocking while max_frames_in_flight frames are
+  // queued or being displayed. They must not change until the frame is displayed
+  void present(const std::uint32_t* colors);
+  // Displays the queued frames and gives the OpenGL context back to the calling thread.
+  // Nothing can be presented afterwards
+  void stop();
+  // Time taken to upload and display the last frame, in milliseconds
+  auto present_time() const -> double;
+
+private:
+  void present_loop();
+
+  sf::RenderWindow& m_window;
+  sf::Texture m_texture{};
+  sf::Sprite m_sprite{};
+  std::size_t m_max_frames_in_flight{};
+  mutable std::mutex m_mutex{};
+  std::condition_variable m_queued{};
+  std::condition_variable m_displayed{};
+  // ring of the frames in flight, the first one being displayed
+  std::vector<const std::uint32_t*> m_frames{};
+  std::size_t m_first_frame{};
+  std::size_t m_frame_count{};
+  double m_present_time{};
+  bool m_stop{};
+  std::thread m_thread{};
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef _3D_FROM_SCRATCH_PROFILER_HPP
+#define _3D_FROM_SCRATCH_PROFILER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Frame profiler. Zones time the scope they are declared in, counters hold one value per frame.
+// Both are recorded per thread, summed into a summary when a frame ends, and kept as events
+// that write_trace saves in the Chrome trace_event format (chrome://tracing or Perfetto).
+// The macros compile to nothing unless the PROFILING definition is set (CMake option ENABLE_PROFILING).
+// Names must be string literals, or strings that outlive the profiler
+class Profiler final {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static void add_zone(const char* name, Clock::time_point begin, Clock::time_point end);
+  static void add_counter(const char* name, double value);
+  // Closes the current frame, making it the one summary() describes
+  static void end_frame();
+  // One line per zone (total time of the last frame over every thread and its call count),
+  // then one line per counter
+  static auto summary() -> std::string;
+  static auto write_trace(const std::string& path) -> bool;
+};
+
+class ProfileZone final {
+public:
+  explicit ProfileZone(const char* name)
+    : m_name{ name }
+  {
+  }
+
+  ~ProfileZone() { Profiler::add_zone(m_name, m_begin, Profiler::Clock::now()); }
+
+  ProfileZone(const ProfileZone&) = delete;
+  auto operator=(const ProfileZone&) -> ProfileZone& = delete;
+
+private:
+  const char* m_name{};
+  Profiler::Clock::time_point m_begin{ Profiler::Clock::now() };
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#if defined(PROFILING)
+#define PROFILE_ZONE(name) const auto PROFILE_CONCAT(profile_zone_, __LINE__) = ProfileZone{ name }
+#define PROFILE_COUNTER(name, value) Profiler::add_counter(name, static_cast<double>(value))
+#define PROFILE_FRAME() Profiler::end_frame()
+#else
+#define PROFILE_ZONE(name) static_cast<void>(0)
+#define PROFILE_COUNTER(name, value) static_cast<void>(0)
+#define PROFILE_FRAME() static_cast<void>(0)
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,234 @@
+#ifndef _3D_FROM_SCRATCH_RASTER_HPP
+#define _3D_FROM_SCRATCH_RASTER_HPP
+
+#include "texture.hpp"
+
+#include <glm/vec2.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Edge values are 32 bit fixed point numbers. Small triangles get g_max_fractional_bits, larger
+// ones give up precision so their edge values can't overflow
+constexpr auto g_max_fractional_bits = 18;
+using Fixed = std::int32_t;
+
+inline auto to_fixed(float num, int fractional_bits) -> Fixed
+{
+  return static_cast<Fixed>(num * static_cast<float>(1 << fractional_bits) + 0.5F);
+}
+
+// Options of the rasterizer that change how a pixel is shaded. The kernels are instantiated for
+// every pipeline state, which they test with if constexpr, so their pixel loops never branch on
+// an option. A new option is a new member, counted in g_pipeline_state_count and
+// get_pipeline_index, with a new if constexpr in the kernels
+struct PipelineState {
+  SamplerMode sampler{};
+  // format of the texture sampled
+  TextureFormat format{};
+};
+
+constexpr auto g_sampler_mode_count = 3UZ;
+constexpr auto g_texture_format_count = 3UZ;
+constexpr auto g_pipeline_state_count = g_sampler_mode_count * g_texture_format_count;
+
+constexpr auto get_pipeline_index(PipelineState state) -> std::size_t
+{
+  return static_cast<std::size_t>(state.sampler) * g_texture_format_count + static_cast<std::size_t>(state.format);
+}
+
+constexpr auto get_pipeline_state(std::size_t index) -> PipelineState
+{
+  return PipelineState{ static_cast<SamplerMode>(index / g_texture_format_count), static_cast<TextureFormat>(index % g_texture_format_count) };
+}
+
+// A kernel instantiated for every pipeline state, indexed by get_pipeline_index
+template <typename Kernel>
+using PipelineKernels = std::array<Kernel, g_pipeline_state_count>;
+
+// Table of the instantiations of a kernel template, built at compile time. instantiate is a lambda
+// template taking the pipeline state as its template parameter and returning the instantiation for it
+template <typename Kernel, typename Instantiate>
+constexpr auto make_pipeline_kernels(Instantiate instantiate) -> PipelineKernels<Kernel>
+{
+  return [&]<std::size_t... index>(std::index_sequence<index...>) {
+    return PipelineKernels<Kernel>{ instantiate.template operator()<get_pipeline_state(index)>()... };
+  }(std::make_index_sequence<g_pipeline_state_count>{});
+}
+
+// Everything the rasterizer needs from a triangle, computed once before binning.
+// Edge values are taken at the center of the pixel (xmin, ymin)
+struct TriangleSetup {
+  const Texture* texture{};
+  // get_pipeline_index of the pipeline state the triangle is drawn with
+  std::size_t pipeline{};
+  std::size_t mip_level{};
+  // Weight of the next mip level for trilinear sampling, from 0 to 256
+  std::uint32_t mip_blend{};
+  int xmin{};
+  int xmax{};
+  int ymin{};
+  int ymax{};
+  Fixed wa{};
+  Fixed wb{};
+  Fixed wc{};
+  Fixed wa_xinc{};
+  Fixed wb_xinc{};
+  Fixed wc_xinc{};
+  Fixed wa_yinc{};
+  Fixed wb_yinc{};
+  Fixed wc_yinc{};
+  // Nearest depth any pixel of the triangle can get
+  float min_z{};
+  // Turns an edge value into a barycentric weight: 1 / area, with the fixed point scale folded in
+  float inv_area{};
+  // Depth (normalized z) is affine in screen space. Texture coordinates are interpolated
+  // divided by w and then multiplied back by the interpolated w
+  float z_a{};
+  float z_b{};
+  float z_c{};
+  float inv_w_a{};
+  float inv_w_b{};
+  float inv_w_c{};
+  glm::vec2 tcoord_a{};
+  glm::vec2 tcoord_b{};
+  glm::vec2 tcoord_c{};
+};
+
+// Color of the triangle texture at texture coordinate (x, y), for a triangle of the pipeline state
+template <PipelineState state>
+auto sample_texture(const TriangleSetup& triangle, float x, float y) -> std::uint32_t
+{
+  return triangle.texture->sample<state.sampler, state.format>(x, y, triangle.mip_level, triangle.mip_blend);
+}
+
+// Pixels first to last of a row, both included. Empty when first > last
+struct RowSpan {
+  int first{};
+  int last{};
+};
+
+// Where the edges of a triangle cut a row of count pixels. An edge value grows or shrinks linearly
+// along the row, so the pixels passing the edge test (w >= 0) are those from the bound of the edge
+// on, or those before it when the value shrinks
+using EdgeBounds = std::array<int, 3>;
+
+// Bounds of the row starting with the edge values wa, wb and wc, with an integer division per edge
+auto find_edge_bounds(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count) -> EdgeBounds;
+// Moves bounds, found for another row of the triangle, to the row starting with the edge values
+// wa, wb and wc, and returns the pixels of that row passing all three edge tests. A bound moves
+// about yinc / xinc pixels from a row to the next, so stepping it costs less than dividing again
+auto step_row_span(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, EdgeBounds& bounds) -> RowSpan;
+
+// Multisampling: positions of the samples of a pixel, in sixteenths of a pixel from its center.
+// They lie on a rotated grid, so nearly horizontal and nearly vertical edges both cross 4 of them
+constexpr auto g_msaa_sample_count = 4UZ;
+constexpr auto g_msaa_sample_offsets = std::array<glm::ivec2, g_msaa_sample_count>{ { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } } };
+// Farthest a sample lies from the pixel center along x or y, in pixels
+constexpr auto g_msaa_max_sample_offset = 6.0F / 16.0F;
+
+// Edge value of every sample minus the one of its pixel center, for the edge stepped by
+// xinc and yinc per pixel, rounded down
+inline auto get_sample_edge_offsets(Fixed xinc, Fixed yinc) -> std::array<Fixed, g_msaa_sample_count>
+{
+  auto offsets = std::array<Fixed, g_msaa_sample_count>{};
+  for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+    const auto& offset = g_msaa_sample_offsets[sample];
+    offsets[sample] = static_cast<Fixed>((std::int64_t{ offset.x } * xinc + std::int64_t{ offset.y } * yinc) >> 4);
+  }
+  return offsets;
+}
+
+// Color averaging the samples of a pixel, found sample_stride apart, channel by channel and
+// rounded to the nearest
+inline auto resolve_samples(const std::uint32_t* samples, std::size_t sample_stride) -> std::uint32_t
+{
+  // two channels at a time, each one summed in its own 16 bits
+  auto red_blue = 0U;
+  auto alpha_green = 0U;
+  for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+    red_blue += samples[sample * sample_stride] & 0x00FF00FFU;
+    alpha_green += (samples[sample * sample_stride] >> 8) & 0x00FF00FFU;
+  }
+  red_blue = ((red_blue + 0x00020002U) >> 2) & 0x00FF00FFU;
+  alpha_green = ((alpha_green + 0x00020002U) >> 2) & 0x00FF00FFU;
+  return red_blue | (alpha_green << 8);
+}
+
+// Instruction sets the row rasterizer can use, from the slowest to the fastest
+enum class SimdLevel {
+  scalar,
+  sse41,
+  avx2,
+};
+
+// Best level supported by the running CPU
+auto detect_simd_level() -> SimdLevel;
+
+// Rasterizes count pixels of a row. wa, wb and wc are the edge values of the first pixel,
+// depth and colors point to the buffer entries of the first pixel.
+// It returns how many pixels were written. Every level produces exactly the same pixels
+using RowRasterizer = int (*)(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* colors);
+
+// The kernel of a triangle is the entry of its pipeline
+auto get_row_rasterizers(SimdLevel level) -> const PipelineKernels<RowRasterizer>&;
+
+auto get_row_rasterizers_scalar() -> const PipelineKernels<RowRasterizer>&;
+auto get_row_rasterizers_sse41() -> const PipelineKernels<RowRasterizer>&;
+auto get_row_rasterizers_avx2() -> const PipelineKernels<RowRasterizer>&;
+
+// Same depth test as RowRasterizer, but the pixels that pass it get the triangle id instead of a color
+using VisibilityRowRasterizer = int (*)(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id);
+
+auto get_visibility_row_rasterizer(SimdLevel level) -> VisibilityRowRasterizer;
+
+auto rasterize_visibility_row_scalar(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int;
+auto rasterize_visibility_row_sse41(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int;
+auto rasterize_visibility_row_avx2(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int;
+
+// Writes the color of count pixels of a row, all known to be covered by the triangle and visible.
+// Colors are exactly the ones RowRasterizer writes
+using RowShader = void (*)(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, std::uint32_t* colors);
+
+auto get_row_shaders(SimdLevel level) -> const PipelineKernels<RowShader>&;
+
+auto get_row_shaders_scalar() -> const PipelineKernels<RowShader>&;
+auto get_row_shaders_sse41() -> const PipelineKernels<RowShader>&;
+auto get_row_shaders_avx2() -> const PipelineKernels<RowShader>&;
+
+// RowRasterizer with g_msaa_sample_count samples per pixel. Sample s of the pixel x is found at
+// s * sample_stride + x in sample_depth and sample_colors, so each sample of a row is contiguous.
+// Coverage and depth are tested sample by sample, but a pixel is shaded once, at its center, and
+// its color goes to every sample that passed. depth gets the farthest sample depth of each pixel
+// written, for the hierarchical depth test.
+// It returns how many pixels got at least one sample. Every level produces exactly the same samples
+using MsaaRowRasterizer = int (*)(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, float* sample_depth, std::uint32_t* sample_colors, std::size_t sample_stride);
+
+auto get_msaa_row_rasterizers(SimdLevel level) -> const PipelineKernels<MsaaRowRasterizer>&;
+
+auto get_msaa_row_rasterizers_scalar() -> const PipelineKernels<MsaaRowRasterizer>&;
+auto get_msaa_row_rasterizers_sse41() -> const PipelineKernels<MsaaRowRasterizer>&;
+auto get_msaa_row_rasterizers_avx2() -> const PipelineKernels<MsaaRowRasterizer>&;
+
+// Bilinear upscaling of a row. Output pixel x blends the source columns columns[x] and
+// next_columns[x] by weights[x] (0 to 256) of the second one, in the rows top and bottom,
+// then blends the two rows by weight_y of the bottom one. Every level writes exactly the same colors
+using RowUpscaler = void (*)(
+  const std::uint32_t* top,
+  const std::uint32_t* bottom,
+  std::uint32_t weight_y,
+  const std::int32_t* columns,
+  const std::int32_t* next_columns,
+  const std::int32_t* weights,
+  std::size_t count,
+  std::uint32_t* output);
+
+auto get_row_upscaler(SimdLevel level) -> RowUpscaler;
+
+void upscale_row_scalar(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output);
+void upscale_row_sse41(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output);
+void upscale_row_avx2(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output);
+
+#endif
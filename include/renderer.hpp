@@ -2,51 +2,344 @@
 #define _3D_FROM_SCRATCH_RENDERER_HPP
 
 #include "clipper.hpp"
+#include "frame_arena.hpp"
+#include "profiler.hpp"
+#include "raster.hpp"
+#include "resolution_scaler.hpp"
 #include "scene.hpp"
 #include "texture.hpp"
+#include "thread_pool.hpp"
+#include "vertex_transform.hpp"
 
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <numeric>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
 
-class Renderer final {
-public:
-  Renderer(std::size_t render_width, std::size_t render_height)
-    : m_render_width{ render_width },
-      m_render_height{ render_height },
-      m_colors(render_width * render_height),
-      m_depth(render_width * render_height)
+// Triangle counts of each pipeline stage, accumulated since the last clear
+struct RenderStats {
+  // Triangles of the meshlets culled as a whole, which are never submitted
+  std::size_t meshlet_culled{};
+  std::size_t submitted{};
+  std::size_t frustum_culled{};
+  std::size_t backface_culled{};
+  // Triangles that crossed the near plane or the guard band. Each one may turn into several
+  std::size_t clipped{};
+  // Triangles covering no pixel center, after clipping
+  std::size_t empty_culled{};
+  std::size_t rasterized{};
+  // Pixels that passed the depth test, overdraw included
+  std::size_t pixels_written{};
+  // Pixels whose texture was sampled. Equal to pixels_written unless shading is deferred
+  std::size_t pixels_shaded{};
+  // Blocks of a triangle skipped by the hierarchical depth test, summed over the triangles
+  std::size_t depth_culled_blocks{};
+
+  auto operator+=(const RenderStats& other) -> RenderStats&
   {
+    meshlet_culled += other.meshlet_culled;
+    submitted += other.submitted;
+    frustum_culled += other.frustum_culled;
+    backface_culled += other.backface_culled;
+    clipped += other.clipped;
+    empty_culled += other.empty_culled;
+    rasterized += other.rasterized;
+    pixels_written += other.pixels_written;
+    pixels_shaded += other.pixels_shaded;
+    depth_culled_blocks += other.depth_culled_blocks;
+    return *this;
   }
+};
+
+// When textures are sampled
+enum class ShadingMode {
+  // as soon as a pixel passes the depth test, so overdrawn pixels are shaded several times
+  forward,
+  // the rasterizer only writes depth and a triangle id per pixel (a visibility buffer), then
+  // each tile shades its visible pixels once
+  visibility,
+};
+
+// How the rasterizer finds the pixels of a triangle. Both cover exactly the same pixels
+enum class RasterBackend {
+  // every pixel of the bounding box is tested against the three edges
+  half_space,
+  // each row only walks the span between the edges, found from the edge values at its start,
+  // so the empty corners of long thin triangles are never tested
+  scanline,
+};
+
+class Renderer final {
+public:
+  // The screen is split in square tiles of tile_size pixels, each one rasterized by a single thread
+  static constexpr auto tile_size = 64;
+  // Granularity of the hierarchical depth test. Tiles are made of whole blocks
+  static constexpr auto block_size = 8;
+  static_assert(tile_size % block_size == 0);
+  // The side clipping planes are pushed out to guard_band times the half screen size, so only
+  // triangles reaching that far get clipped against them. The rasterizer bounding box does the rest
+  static constexpr auto guard_band = 2.0F;
+  static constexpr auto background_color = std::uint32_t{ 0xFF000000 };
+  // An instance only moves to a coarser level of detail once its error falls below
+  // (1 - lod_hysteresis) * lod_error, so it doesn't switch back and forth around the limit
+  static constexpr auto lod_hysteresis = 0.25F;
 
+  // Frames are drawn into one of color_buffer_count color buffers, taken in turn by swap_buffers,
+  // so a finished frame can be read while the next ones are drawn
+  Renderer(
+    std::size_t render_width,
+    std::size_t render_height,
+    std::size_t thread_count = std::thread::hardware_concurrency(),
+    std::size_t color_buffer_count = 1);
+
+  // Starts a new frame without writing a pixel. A tile is cleared when it is first drawn into,
+  // and render() fills the tiles left untouched with the background color, skipping those
+  // whose color buffer already holds it. The temporary data of the last frame is freed at once
   void clear()
   {
-    static auto s_background = std::vector<std::uint32_t>(m_render_width * m_render_height, 0xFF000000);
-    m_colors = s_background;
-    static auto s_depth = std::vector<float>(m_render_width * m_render_height, std::numeric_limits<float>::max());
-    m_depth = s_depth;
+    PROFILE_ZONE("clear");
+    ++m_generation;
+    m_stats = RenderStats{};
+    reset_frame_memory();
   }
 
   void plot(std::size_t x, std::size_t y, std::uint32_t color)
   {
     assert(x < m_render_width && y < m_render_height);
+    begin_tile((y / tile_size) * m_tile_count_x + x / tile_size);
     m_colors[y * m_render_width + x] = color;
+    // so resolving the tile keeps the pixel
+    for (auto sample = 0UZ; uses_msaa() && sample < g_msaa_sample_count; ++sample) {
+      m_sample_colors[get_first_sample(x, y) + sample * m_render_width] = color;
+    }
   }
 
+  // Once the frame memory stopped growing, a frame makes no heap allocation. Builds counting
+  // allocations (see allocation_counter.hpp) assert it, unless NDEBUG or PROFILING is set
   void render(const Scene& scene);
   void render_triangle(const ClipVertex& ca, const ClipVertex& cb, const ClipVertex& cc, const Texture& texture);
   auto get_screen_position(const glm::vec4& v) const -> glm::vec2;
   auto render_width() const -> std::size_t { return m_render_width; }
   auto render_height() const -> std::size_t { return m_render_height; }
+  // Color buffer the next frame is drawn into, holding the last frame until swap_buffers.
+  // It is complete once render() returns
   auto colors() const -> const std::vector<std::uint32_t>& { return m_colors; }
+  // Moves to the next color buffer. The colors of the previous frames stay untouched at the
+  // same address until the renderer comes back to their buffer, color_buffer_count swaps later
+  void swap_buffers()
+  {
+    if (m_spare_colors.empty()) return;
+    std::swap(m_colors, m_spare_colors[m_next_spare_colors]);
+    std::swap(m_background_tiles, m_spare_background_tiles[m_next_spare_colors]);
+    m_next_spare_colors = (m_next_spare_colors + 1) % m_spare_colors.size();
+  }
+  auto color_buffer_count() const -> std::size_t { return m_spare_colors.size() + 1; }
+  // Instruction set used by the rasterizer, limited to what the CPU supports
+  void set_simd_level(SimdLevel level);
+  auto simd_level() const -> SimdLevel { return m_simd_level; }
+  auto stats() const -> const RenderStats& { return m_stats; }
+  void set_sampler_mode(SamplerMode mode) { m_sampler_mode = mode; }
+  auto sampler_mode() const -> SamplerMode { return m_sampler_mode; }
+  void set_shading_mode(ShadingMode mode);
+  auto shading_mode() const -> ShadingMode { return m_shading_mode; }
+  void set_raster_backend(RasterBackend backend) { m_raster_backend = backend; }
+  auto raster_backend() const -> RasterBackend { return m_raster_backend; }
+  // Multisample anti-aliasing, off by default: edges and depth are tested at g_msaa_sample_count
+  // samples per pixel, but each pixel is still shaded once. Tiles are averaged into colors()
+  // once drawn. Only forward shading uses it, the visibility buffer keeps one triangle per pixel
+  void set_msaa(bool enabled);
+  auto msaa() const -> bool { return m_msaa; }
+  // Frustum and back-face culling of whole meshlets, on by default. Turning it off
+  // only changes how much work is done, never the pixels
+  void set_meshlet_culling(bool enabled) { m_meshlet_culling = enabled; }
+  auto meshlet_culling() const -> bool { return m_meshlet_culling; }
+  // Instances draw the coarsest level of detail of their model whose error, seen at the nearest
+  // point of their bounding sphere, stays under lod_error pixels. Zero always draws the full detail
+  void set_lod_error(float pixels) { m_lod_error = pixels; }
+  auto lod_error() const -> float { return m_lod_error; }
+  // Frames are drawn at a fraction of the render size that keeps render() under milliseconds,
+  // then upscaled bilinearly into colors(). Zero, the default, always draws at the full size
+  void set_frame_time_budget(double milliseconds);
+  auto frame_time_budget() const -> double { return m_resolution_scaler ? m_resolution_scaler->budget() : 0.0; }
+  // Fraction of the render size the next frame is drawn at
+  auto render_scale() const -> float { return m_resolution_scaler ? m_resolution_scaler->scale() : 1.0F; }
 
 private:
+  // A mesh drawn by one instance in the current frame
+  struct DrawBatch {
+    const Mesh* mesh{};
+    // model to clip space
+    glm::mat4 transform{};
+  };
+
+  // Culling data of an instance, in its model space
+  struct InstanceView {
+    glm::mat4 transform{};
+    std::array<glm::vec4, plane_count> frustum_planes{};
+    glm::vec3 camera_position{};
+    // the model matrix has a negative determinant, which flips the faces
+    bool mirrored{};
+  };
+
+  // Vertices and faces of a batch drawn in the current frame: a meshlet that passed
+  // culling, or a whole mesh without meshlets. Its vertices are transformed into
+  // the clip positions of the frame starting at clip_offset
+  struct DrawRange {
+    std::size_t batch{};
+    std::size_t first_vertex{};
+    std::size_t vertex_count{};
+    std::size_t first_face{};
+    std::size_t face_count{};
+    std::size_t clip_offset{};
+  };
+
+  // A vertex with what the vertex stage computed from its clip space position
+  struct ProjectedVertex {
+    ClipVertex vertex{};
+    glm::vec2 screen_position{};
+    Outcode outcode{};
+    Outcode guard_band_outcode{};
+  };
+
+  // Indices of the triangles of a chunk binned to a tile, a block of them at a time
+  static constexpr auto bin_block_size = 60UZ;
+  struct BinBlock {
+    std::array<std::uint32_t, bin_block_size> indices{};
+    std::uint32_t count{};
+    BinBlock* next{};
+  };
+  struct Bin {
+    BinBlock* first{};
+    BinBlock* last{};
+  };
+
+  // Inclusive pixel rectangle
+  struct Rect {
+    int xmin{};
+    int xmax{};
+    int ymin{};
+    int ymax{};
+  };
+
+  void draw(const Scene& scene);
+  void draw_scaled(const Scene& scene);
+  void reset_frame_memory();
+  // Heap allocations made to grow the memory the frames use
+  auto get_memory_growth() const -> std::size_t;
+  void set_viewport(std::size_t width, std::size_t height);
+  void upscale(std::size_t width, std::size_t height);
+  auto select_level(const Model& model, const glm::mat4& model_view_matrix, float focal_length, std::size_t level) const -> std::size_t;
+  template <typename Emit>
+  void process_triangle(const ProjectedVertex& pa, const ProjectedVertex& pb, const ProjectedVertex& pc, const Texture& texture, RenderStats& stats, Emit&& emit) const;
+  auto setup_triangle(const ProjectedVertex& pa, const ProjectedVertex& pb, const ProjectedVertex& pc, const Texture& texture) const -> std::optional<TriangleSetup>;
+  auto project_vertex(const ClipVertex& v) const -> ProjectedVertex;
+  auto uses_msaa() const -> bool { return m_msaa && m_shading_mode == ShadingMode::forward; }
+  // Index of the first sample of the pixel (x, y) in m_sample_depth and m_sample_colors
+  auto get_first_sample(std::size_t x, std::size_t y) const -> std::size_t { return y * g_msaa_sample_count * m_render_width + x; }
+  void rasterize_triangle(const TriangleSetup& triangle, const Rect& rect, std::uint32_t id, RenderStats& stats);
+  void bin_triangle(std::size_t chunk, const TriangleSetup& triangle);
+  void rasterize_tile(std::size_t tile, RenderStats& stats);
+  void resolve_tile(const Rect& rect, RenderStats& stats);
+  void resolve_msaa(const Rect& rect);
+  auto tile_rect(std::size_t tile) const -> Rect;
+  void begin_tile(std::size_t tile);
+  void fill_background(std::size_t tile);
+  auto block_max_depth(std::size_t block) -> float;
+  auto tile_max_depth(std::size_t tile) -> float;
+
   std::size_t m_render_width{};
   std::size_t m_render_height{};
+  // Pixels drawn by the current frame, from the top left corner of the buffers. Buffers keep
+  // the render size, and with it their row stride
+  std::size_t m_viewport_width{};
+  std::size_t m_viewport_height{};
   std::vector<std::uint32_t> m_colors{};
+  // Flags the tiles of m_colors holding nothing but the background color
+  std::vector<std::uint8_t> m_background_tiles{};
+  // The other color buffers and their flags, swapped with m_colors in turn
+  std::vector<std::vector<std::uint32_t>> m_spare_colors{};
+  std::vector<std::vector<std::uint8_t>> m_spare_background_tiles{};
+  std::size_t m_next_spare_colors{};
+  // Color buffer the scaled frames are drawn into, the size it was last drawn at, and for each
+  // column of colors() the two columns it blends and the weight of the second one
+  std::optional<ResolutionScaler> m_resolution_scaler{};
+  std::vector<std::uint32_t> m_scaled_colors{};
+  std::vector<std::uint8_t> m_scaled_background_tiles{};
+  std::size_t m_scaled_width{};
+  std::size_t m_scaled_height{};
+  std::vector<std::int32_t> m_upscale_columns{};
+  std::vector<std::int32_t> m_upscale_next_columns{};
+  std::vector<std::int32_t> m_upscale_weights{};
+  // Frame number, bumped by clear(), and the frame each tile was last cleared in
+  std::uint64_t m_generation{};
+  std::vector<std::uint64_t> m_tile_generation{};
   std::vector<float> m_depth{};
+  // Samples of every pixel when multisampling. Pixel row y gets g_msaa_sample_count rows of
+  // samples from y * g_msaa_sample_count on, the row s holding sample s of every pixel.
+  // m_depth then holds the farthest depth of the samples of each pixel
+  std::vector<float> m_sample_depth{};
+  std::vector<std::uint32_t> m_sample_colors{};
+  // Level of detail drawn by each scene instance, by index, kept from one frame to the next
+  std::vector<std::size_t> m_instance_levels{};
+  // Times m_instance_levels grew
+  std::size_t m_instance_levels_growth{};
+  // Temporary data of the current frame, freed by clear(): the front-end data of draw() in
+  // m_frame_arena, and the triangles and bins of each front-end chunk in its own arena, as
+  // the chunks are set up in parallel
+  FrameArena m_frame_arena{};
+  std::unique_ptr<FrameArena[]> m_chunk_arenas{};
+  std::vector<FramePool<BinBlock>> m_bin_block_pools{};
+  bool m_meshlet_culling{ true };
+  bool m_msaa{};
+  float m_lod_error{ 1.0F };
+  SimdLevel m_simd_level{};
+  // Kernels of m_simd_level, each triangle picking the one of its pipeline
+  PipelineKernels<RowRasterizer> m_row_rasterizers{};
+  VisibilityRowRasterizer m_rasterize_visibility_row{};
+  PipelineKernels<RowShader> m_row_shaders{};
+  PipelineKernels<MsaaRowRasterizer> m_msaa_row_rasterizers{};
+  RowUpscaler m_upscale_row{};
+  VertexTransformer m_transform_vertices{};
+  SamplerMode m_sampler_mode{ SamplerMode::bilinear };
+  ShadingMode m_shading_mode{ ShadingMode::forward };
+  RasterBackend m_raster_backend{ RasterBackend::half_space };
+  // Visibility buffer: id of the triangle covering each pixel, 0 for none. A triangle id is
+  // one plus its index in the concatenation of the chunk triangle lists, which starts the list
+  // of each chunk at its entry in m_chunk_first_ids
+  std::vector<std::uint32_t> m_triangle_ids{};
+  std::vector<std::uint32_t> m_chunk_first_ids{};
+  std::size_t m_tile_count_x{};
+  std::size_t m_tile_count_y{};
+  // Hierarchical depth: farthest depth of every block and of every tile. Blocks count the pixels
+  // written since their value was computed, tiles flag when one of their blocks changed.
+  // Counters and flags are bytes, so threads never share one
+  std::size_t m_block_count_x{};
+  std::size_t m_block_count_y{};
+  std::vector<float> m_block_max_depth{};
+  std::vector<std::uint8_t> m_block_writes{};
+  std::vector<float> m_tile_max_depth{};
+  std::vector<std::uint8_t> m_tile_dirty{};
+  // One triangle list per front-end chunk, and one bin per (chunk, tile) holding indices into it.
+  // Tiles walk the chunks in order, so triangles are drawn in submission order
+  std::vector<std::pmr::vector<TriangleSetup>> m_chunk_triangles{};
+  std::vector<Bin> m_bins{};
+  std::vector<RenderStats> m_chunk_stats{};
+  std::vector<RenderStats> m_tile_stats{};
+  RenderStats m_stats{};
+  ThreadPool m_thread_pool;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,33 @@
+#ifndef _3D_FROM_SCRATCH_RESOLUTION_SCALER_HPP
+#define _3D_FROM_SCRATCH_RESOLUTION_SCALER_HPP
+
+// Picks the resolution of the next frame so that frames take about budget milliseconds.
+// The scale is a fraction of the full width and height. Frame time is modeled as cost * scale^2,
+// the cost at full resolution being averaged over the last frames, so one slow frame doesn't
+// make the resolution jump. The scale drops faster than it grows back, and is left alone while
+// the model puts it within a few percent of where it is, so it settles instead of oscillating
+class ResolutionScaler final {
+public:
+  static constexpr auto min_scale = 0.25F;
+  // weight of the last frame in the average cost
+  static constexpr auto smoothing = 0.2;
+  // largest change of the scale from a frame to the next, as a fraction of it
+  static constexpr auto max_decrease = 0.15F;
+  static constexpr auto max_increase = 0.05F;
+  static constexpr auto dead_zone = 0.02F;
+
+  explicit ResolutionScaler(double budget);
+
+  // Takes the time the last frame took at scale(), and updates scale() for the next one
+  void update(double frame_time);
+  auto scale() const -> float { return m_scale; }
+  auto budget() const -> double { return m_budget; }
+
+private:
+  double m_budget{};
+  // average frame time at full resolution, 0 until the first frame
+  double m_cost{};
+  float m_scale{ 1.0F };
+};
+
+#endif
\ No newline at end of file
@@ -3,8 +3,38 @@
 
 #include "model.hpp"
 
+#include <glm/vec3.hpp>
+
+#include <memory>
+#include <vector>
+
+// Applied to the model as a scale, then rotations around z, y and x (in radians), then a translation
+struct Transform {
+  glm::vec3 position{ 0.0F };
+  glm::vec3 rotation{ 0.0F };
+  glm::vec3 scale{ 1.0F };
+};
+
+// A model placed in the scene. Instances of a model share its meshes and textures
+struct Instance {
+  std::shared_ptr<const Model> model{};
+  Transform transform{};
+};
+
+// Looks from position towards target, with a perspective projection
+struct Camera {
+  glm::vec3 position{ 0.0F, 1.5F, 8.0F };
+  glm::vec3 target{ 0.0F, 1.5F, 0.0F };
+  glm::vec3 up{ 0.0F, 1.0F, 0.0F };
+  // in degrees
+  float vertical_fov{ 60.0F };
+  float near_plane{ 0.1F };
+  float far_plane{ 100.0F };
+};
+
 struct Scene {
-  const Model& model;
+  std::vector<Instance> instances{};
+  Camera camera{};
 };
 
 #endif
\ No newline at end of file
@@ -1,44 +1,254 @@
 #ifndef _3D_FROM_SCRATCH_TEXTURE_HPP
 #define _3D_FROM_SCRATCH_TEXTURE_HPP
 
+#include "buffer.hpp"
+
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <span>
 #include <stdexcept>
 #include <vector>
 
+// How the rasterizer samples textures. The mip level is picked once per triangle
+enum class SamplerMode {
+  // nearest texel of the nearest mip level
+  nearest,
+  // 2x2 texels of the nearest mip level
+  bilinear,
+  // 2x2 texels of the two nearest mip levels, blended by the fractional level
+  trilinear,
+};
+
+// How the texels of a texture are stored. The block compressed formats encode every 4x4 tile
+// of a level in a block, which is decoded texel by texel when sampling
+enum class TextureFormat {
+  // 32 bit ABGR texels
+  rgba8,
+  // 4 bits per texel: two RGB565 colors and a 2 bit index per texel picking one of them or
+  // one of the two colors between them. Alpha is always opaque
+  bc1,
+  // 8 bits per texel: a bc1 block for the colors, preceded by two alphas and a 3 bit index per
+  // texel picking one of them or one of the six alphas between them
+  bc3,
+};
+
+// Blends two colors channel by channel, weight going from 0 (all a) to 256 (all b).
+// Two channels are blended at once in each 32 bit product
+inline auto lerp_color(std::uint32_t a, std::uint32_t b, std::uint32_t weight) -> std::uint32_t
+{
+  auto red_blue = ((a & 0x00FF00FFU) * (256 - weight) + (b & 0x00FF00FFU) * weight) >> 8;
+  auto alpha_green = (((a >> 8) & 0x00FF00FFU) * (256 - weight) + ((b >> 8) & 0x00FF00FFU) * weight) >> 8;
+  return (red_blue & 0x00FF00FFU) | ((alpha_green & 0x00FF00FFU) << 8);
+}
+
+// RGB565 color expanded to an opaque ABGR color
+inline auto expand_rgb565(std::uint32_t color) -> std::uint32_t
+{
+  auto red = (color >> 11) & 0x1FU;
+  auto green = (color >> 5) & 0x3FU;
+  auto blue = color & 0x1FU;
+  return 0xFF000000U | (((blue << 3) | (blue >> 2)) << 16) | (((green << 2) | (green >> 4)) << 8) | (red << 3) | (red >> 2);
+}
+
+// Weight of the second color of a bc1 block for each index: the two colors, then the colors
+// a third and two thirds of the way from the first one to the second one
+constexpr auto g_bc1_index_weights = std::array<std::uint32_t, 4>{ 0, 256, 85, 171 };
+
+// Color of texel (0 to 15, row by row) of a bc1 block: the two colors in the low and high
+// halves of its first word, then the indices from the lowest bits of the second one
+inline auto decode_bc1_texel(const std::uint32_t* block, std::size_t texel) -> std::uint32_t
+{
+  auto weight = g_bc1_index_weights[(block[1] >> (texel * 2)) & 3U];
+  return lerp_color(expand_rgb565(block[0] & 0xFFFFU), expand_rgb565(block[0] >> 16), weight);
+}
+
+// Color of texel of a bc3 block: the two alphas in the lowest bytes of its first two words,
+// followed by the alpha indices, then a bc1 block
+inline auto decode_bc3_texel(const std::uint32_t* block, std::size_t texel) -> std::uint32_t
+{
+  auto bits = block[0] | (std::uint64_t{ block[1] } << 32);
+  auto alpha0 = static_cast<std::uint32_t>(bits & 0xFFU);
+  auto alpha1 = static_cast<std::uint32_t>((bits >> 8) & 0xFFU);
+  auto index = static_cast<std::uint32_t>((bits >> (16 + texel * 3)) & 7U);
+  auto alpha = index == 0 ? alpha0 : index == 1 ? alpha1 : ((8 - index) * alpha0 + (index - 1) * alpha1) / 7;
+  return (decode_bc1_texel(block + 2, texel) & 0x00FFFFFFU) | (alpha << 24);
+}
+
+// Texture with its whole mip chain. Each level is stored in 4x4 texel tiles, so the texels
+// a triangle reads from nearby rows share cache lines, and a tile is a block of the compressed formats.
+// Sampling coordinates are in texels of level 0, with texel centers at whole numbers
 class Texture final {
 public:
-  Texture(const std::vector<std::uint32_t>& colors, std::size_t width, std::size_t height)
-    : m_colors{ colors }, m_width{ width }, m_height{ height }
+  static constexpr auto tile_size = 4UZ;
+  static_assert(tile_size == 4, "the compressed formats encode a tile per block");
+  // Sampling coordinates are clamped to 0 and to this many texels, larger than any level,
+  // before turning them into texel indices, so any float, infinities and NaN included,
+  // gives an index of the level. It is exact in a float and fits in an int
+  static constexpr auto max_coord = 16777216.0F;
+
+  struct MipLevel {
+    std::size_t width{};
+    std::size_t height{};
+    std::size_t tile_count_x{};
+    // first texel of the level in texels()
+    std::size_t offset{};
+    // level texels per level 0 texel
+    float scale{};
+  };
+
+  // colors are row major
+  Texture(std::span<const std::uint32_t> colors, std::size_t width, std::size_t height);
+  // 32 bit words a tile takes in the format
+  static auto tile_word_count(TextureFormat format) -> std::size_t
+  {
+    switch (format) {
+      case TextureFormat::rgba8: return tile_size * tile_size;
+      case TextureFormat::bc1: return 2;
+      default: return 4;
+    }
+  }
+
+  // Texture from texels already laid out like texel_buffer() of a texture of the same size and format
+  static auto from_texels(Buffer<std::uint32_t> texels, std::size_t width, std::size_t height, TextureFormat format = TextureFormat::rgba8) -> Texture;
+
+  // Copy of an rgba8 texture compressed level by level, in bc1 when every texel is opaque
+  // and in bc3 otherwise
+  auto compress() const -> Texture;
+
+  // Texel of the level, clamped to its edges
+  auto at(std::size_t x, std::size_t y, std::size_t level = 0) const -> std::uint32_t
   {
-    if (m_colors.size() != m_width * m_height) {
-      throw std::invalid_argument{ "Texture colors length must be equal to width times height" };
+    switch (m_format) {
+      case TextureFormat::rgba8: return at<TextureFormat::rgba8>(x, y, level);
+      case TextureFormat::bc1: return at<TextureFormat::bc1>(x, y, level);
+      default: return at<TextureFormat::bc3>(x, y, level);
     }
   }
 
-  auto at(std::size_t x, std::size_t y) -> std::uint32_t&
+  auto sample_nearest(float x, float y, std::size_t level) const -> std::uint32_t
   {
-    x = std::clamp(x, 0UZ, m_width - 1);
-    y = std::clamp(y, 0UZ, m_height - 1);
-    return m_colors[y * m_width + x];
+    auto scale = m_levels[level].scale;
+    return at(to_index((x + 0.5F) * scale), to_index((y + 0.5F) * scale), level);
   }
 
-  auto at(std::size_t x, std::size_t y) const -> std::uint32_t
+  auto sample_bilinear(float x, float y, std::size_t level) const -> std::uint32_t
   {
-    x = std::clamp(x, 0UZ, m_width - 1);
-    y = std::clamp(y, 0UZ, m_height - 1);
-    return m_colors[y * m_width + x];
+    switch (m_format) {
+      case TextureFormat::rgba8: return sample_bilinear<TextureFormat::rgba8>(x, y, level);
+      case TextureFormat::bc1: return sample_bilinear<TextureFormat::bc1>(x, y, level);
+      default: return sample_bilinear<TextureFormat::bc3>(x, y, level);
+    }
   }
 
-  auto width() const -> std::size_t { return m_width; }
-  auto height() const -> std::size_t { return m_height; }
+  // blend goes from 0 (all of level) to 256 (all of the next level)
+  auto sample_trilinear(float x, float y, std::size_t level, std::uint32_t blend) const -> std::uint32_t
+  {
+    auto color = sample_bilinear(x, y, level);
+    if (blend == 0 || level + 1 >= m_levels.size()) return color;
+    return lerp_color(color, sample_bilinear(x, y, level + 1), blend);
+  }
+
+  // Sampling with the sampler and the format known at compile time, for the kernels of a
+  // pipeline state. format must be the format of the texture, and trilinear sampling always
+  // blends level with the next one, which must exist
+  template <SamplerMode sampler, TextureFormat format>
+  auto sample(float x, float y, std::size_t level, std::uint32_t blend) const -> std::uint32_t
+  {
+    assert(format == m_format);
+    if constexpr (sampler == SamplerMode::nearest) {
+      auto scale = m_levels[level].scale;
+      return at<format>(to_index((x + 0.5F) * scale), to_index((y + 0.5F) * scale), level);
+    }
+    else if constexpr (sampler == SamplerMode::bilinear) {
+      return sample_bilinear<format>(x, y, level);
+    }
+    else {
+      assert(level + 1 < m_levels.size());
+      return lerp_color(sample_bilinear<format>(x, y, level), sample_bilinear<format>(x, y, level + 1), blend);
+    }
+  }
+
+  auto width() const -> std::size_t { return m_levels.front().width; }
+  auto height() const -> std::size_t { return m_levels.front().height; }
+  auto format() const -> TextureFormat { return m_format; }
+  auto level_count() const -> std::size_t { return m_levels.size(); }
+  // Layout of the levels, for samplers that address texels themselves
+  auto level(std::size_t index) const -> const MipLevel& { return m_levels[index]; }
+  // Texels of rgba8 textures, blocks of the compressed ones
+  auto texels() const -> const std::uint32_t* { return m_colors.data(); }
+  auto texel_buffer() const -> const Buffer<std::uint32_t>& { return m_colors; }
 
 private:
-  std::vector<std::uint32_t> m_colors{};
-  std::size_t m_width{};
-  std::size_t m_height{};
+  // Lays out the mip chain of a width x height texture, leaving the texels to be filled
+  Texture(std::size_t width, std::size_t height);
+
+  // Texel at index of the mip chain, as an rgba8 texture lays them out
+  template <TextureFormat format>
+  auto fetch(std::size_t index) const -> std::uint32_t
+  {
+    if constexpr (format == TextureFormat::rgba8) return m_colors[index];
+    else if constexpr (format == TextureFormat::bc1) return decode_bc1_texel(&m_colors[index / 16 * 2], index % 16);
+    else return decode_bc3_texel(&m_colors[index / 16 * 4], index % 16);
+  }
+
+  template <TextureFormat format>
+  auto at(std::size_t x, std::size_t y, std::size_t level) const -> std::uint32_t
+  {
+    const auto& mip = m_levels[level];
+    return fetch<format>(mip.offset + row_offset(mip, std::min(y, mip.height - 1)) + column_offset(std::min(x, mip.width - 1)));
+  }
+
+  template <TextureFormat format>
+  auto sample_bilinear(float x, float y, std::size_t level) const -> std::uint32_t
+  {
+    auto scale = m_levels[level].scale;
+    auto level_x = clamp_coord((x + 0.5F) * scale - 0.5F);
+    auto level_y = clamp_coord((y + 0.5F) * scale - 0.5F);
+    auto x0 = static_cast<std::size_t>(level_x);
+    auto y0 = static_cast<std::size_t>(level_y);
+    auto weight_x = static_cast<std::uint32_t>((level_x - static_cast<float>(x0)) * 256.0F);
+    auto weight_y = static_cast<std::uint32_t>((level_y - static_cast<float>(y0)) * 256.0F);
+
+    // the 2x2 texels share their row and column offsets
+    const auto& mip = m_levels[level];
+    auto column0 = column_offset(std::min(x0, mip.width - 1));
+    auto column1 = column_offset(std::min(x0 + 1, mip.width - 1));
+    auto row0 = mip.offset + row_offset(mip, std::min(y0, mip.height - 1));
+    auto row1 = mip.offset + row_offset(mip, std::min(y0 + 1, mip.height - 1));
+    auto top = lerp_color(fetch<format>(row0 + column0), fetch<format>(row0 + column1), weight_x);
+    auto bottom = lerp_color(fetch<format>(row1 + column0), fetch<format>(row1 + column1), weight_x);
+    return lerp_color(top, bottom, weight_y);
+  }
+
+  // The index of texel (x, y) inside its level is row_offset(y) + column_offset(x)
+  static auto row_offset(const MipLevel& mip, std::size_t y) -> std::size_t
+  {
+    return (y / tile_size) * mip.tile_count_x * tile_size * tile_size + (y % tile_size) * tile_size;
+  }
+
+  static auto column_offset(std::size_t x) -> std::size_t
+  {
+    return (x / tile_size) * tile_size * tile_size + x % tile_size;
+  }
+
+  // NaN fails both comparisons, and becomes 0
+  static auto clamp_coord(float coord) -> float
+  {
+    return std::min(std::max(0.0F, coord), max_coord);
+  }
+
+  static auto to_index(float coord) -> std::size_t
+  {
+    return static_cast<std::size_t>(clamp_coord(coord));
+  }
+
+  std::vector<MipLevel> m_levels{};
+  std::size_t m_texel_count{};
+  TextureFormat m_format{ TextureFormat::rgba8 };
+  Buffer<std::uint32_t> m_colors{};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef _3D_FROM_SCRATCH_THREAD_POOL_HPP
+#define _3D_FROM_SCRATCH_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads that run index-based jobs.
+// The thread calling parallel_for also takes part in the work, so a pool
+// built with thread_count == 1 has no workers and runs everything inline.
+class ThreadPool final {
+public:
+  explicit ThreadPool(std::size_t thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Calls task(index) for every index in [0, count) and blocks until all calls returned.
+  // Indices are handed out dynamically, so uneven jobs still balance across threads.
+  // It must not be called from inside a task.
+  template <typename Task>
+  void parallel_for(std::size_t count, Task&& task)
+  {
+    using Callable = std::remove_reference_t<Task>;
+    run(
+      count,
+      [](void* context, std::size_t index) { (*static_cast<Callable*>(context))(index); },
+      const_cast<void*>(static_cast<const void*>(std::addressof(task))));
+  }
+
+  auto thread_count() const -> std::size_t { return m_workers.size() + 1; }
+
+private:
+  using Job = void (*)(void* context, std::size_t index);
+
+  void run(std::size_t count, Job job, void* context);
+  void execute();
+  void worker_loop();
+
+  std::vector<std::thread> m_workers{};
+  std::mutex m_mutex{};
+  std::condition_variable m_wake{};
+  std::condition_variable m_done{};
+  Job m_job{};
+  void* m_context{};
+  std::size_t m_count{};
+  std::atomic<std::size_t> m_next{};
+  std::size_t m_pending_workers{};
+  std::uint64_t m_generation{};
+  // the workers count their allocations (see allocation_counter.hpp) in the counter of the
+  // caller of run, if it has one
+  std::atomic<std::size_t>* m_allocation_counter{};
+  bool m_stop{};
+};
+
+#endif
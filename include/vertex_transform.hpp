@@ -0,0 +1,43 @@
+#ifndef _3D_FROM_SCRATCH_VERTEX_TRANSFORM_HPP
+#define _3D_FROM_SCRATCH_VERTEX_TRANSFORM_HPP
+
+#include "clipper.hpp"
+#include "raster.hpp"
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include <cstddef>
+
+// Where the vertex stage writes, one entry per vertex in each array
+struct TransformedVertices {
+  glm::vec4* clip_positions{};
+  // In pixels, from 0 to screen_max. Only meaningful for vertices in front of the camera
+  glm::vec2* screen_positions{};
+  Outcode* outcodes{};
+  // outcodes against the side planes pushed out by the guard band
+  Outcode* guard_band_outcodes{};
+};
+
+// Transforms count vertices to clip space with transform, reading their model space positions
+// from the streams x, y and z (see Mesh::position_streams), and writes their screen positions
+// and outcodes in the same pass. The float math follows glm and get_outcode operation by
+// operation, so every level writes exactly the same values
+using VertexTransformer = void (*)(
+  const glm::mat4& transform,
+  const float* x,
+  const float* y,
+  const float* z,
+  std::size_t count,
+  glm::vec2 screen_max,
+  float guard_band,
+  const TransformedVertices& output);
+
+auto get_vertex_transformer(SimdLevel level) -> VertexTransformer;
+
+void transform_vertices_scalar(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output);
+void transform_vertices_sse41(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output);
+void transform_vertices_avx2(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "allocation_counter.hpp"
+
+#if defined(COUNT_ALLOCATIONS)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+thread_local AllocationCounter::Counter* t_allocation_counter{};
+
+auto AllocationCounter::current() -> Counter*
+{
+  return t_allocation_counter;
+}
+
+void AllocationCounter::set_current(Counter* counter)
+{
+  t_allocation_counter = counter;
+}
+
+void count_allocation()
+{
+  if (t_allocation_counter != nullptr) t_allocation_counter->fetch_add(1, std::memory_order_relaxed);
+}
+
+// The array and nothrow forms of operator new and delete call these
+void* operator new(std::size_t size)
+{
+  count_allocation();
+  if (auto* memory = std::malloc(size == 0 ? 1 : size)) return memory;
+  throw std::bad_alloc{};
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  count_allocation();
+  auto align = static_cast<std::size_t>(alignment);
+  // aligned_alloc wants a multiple of the alignment
+  size = (std::max(size, 1UZ) + align - 1) / align * align;
+#if defined(_MSC_VER)
+  auto* memory = _aligned_malloc(size, align);
+#else
+  auto* memory = std::aligned_alloc(align, size);
+#endif
+  if (memory != nullptr) return memory;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+#if defined(_MSC_VER)
+  _aligned_free(memory);
+#else
+  std::free(memory);
+#endif
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept
+{
+  operator delete(memory, alignment);
+}
+
+#endif
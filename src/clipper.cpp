@@ -2,6 +2,9 @@
 
 #include <glm/glm.hpp>
 
+#include <cassert>
+#include <utility>
+
 // Param: vertice in clip space
 auto is_vertice_inside_frustum(const glm::vec4& v) -> bool
 {
@@ -34,7 +37,7 @@ auto is_triangle_inside_frustum(const glm::vec4& vert_a, const glm::vec4& vert_b
 }
 
 // Param: vertice in clip space
-auto dot_product(const glm::vec4& v, FrustumPlane fplane) -> float
+auto dot_product(const glm::vec4& v, FrustumPlane fplane, float guard_band) -> float
 {
   switch (fplane) {
     case near:
@@ -42,56 +45,62 @@ auto dot_product(const glm::vec4& v, FrustumPlane fplane) -> float
     case far:
       return -v.z + v.w;
     case left:
-      return v.x + v.w;
+      return v.x + guard_band * v.w;
     case right:
-      return -v.x + v.w;
+      return -v.x + guard_band * v.w;
     case bottom:
-      return v.y + v.w;
+      return v.y + guard_band * v.w;
     case top:
-      return -v.y + v.w;
+      return -v.y + guard_band * v.w;
     default:
       assert(false && "Invalid enum frustum plane");
       return 1.0F;
   }
 }
 
-// it needs to be an outer bound clipper, because current rasterizer
-// is clipping against screen boundaries
-// I'll need to know the precision of fixed point variables used in the rasterizer
-auto clip_triangle(const ClipVertex& vert_a, const ClipVertex& vert_b, const ClipVertex& vert_c) -> std::vector<ClipVertex>
+// Param: vertice in clip space
+auto get_outcode(const glm::vec4& v, float guard_band) -> Outcode
 {
-  auto input = std::vector<ClipVertex>{ vert_a, vert_b, vert_c };
-  auto output = std::vector<ClipVertex>{};
-  output.reserve(5);
+  auto outcode = Outcode{};
   for (auto fplane = 0; fplane < plane_count; ++fplane) {
-    auto in_size = input.size();
+    if (dot_product(v, static_cast<FrustumPlane>(fplane), guard_band) < 0.0F) {
+      outcode |= static_cast<Outcode>(1 << fplane);
+    }
+  }
+  return outcode;
+}
+
+// Sutherland-Hodgman against the planes set in the planes bitmask. The side planes are pushed
+// out by guard_band, so only triangles far from the screen need them and the rasterizer
+// keeps clipping the rest against the screen boundaries.
+// The result may have less than 3 vertices when nothing is left inside
+auto clip_triangle(const ClipVertex& vert_a, const ClipVertex& vert_b, const ClipVertex& vert_c, Outcode planes, float guard_band) -> ClipPolygon
+{
+  auto input = ClipPolygon{ { vert_a, vert_b, vert_c }, 3 };
+  auto output = ClipPolygon{};
+  for (auto fplane = 0; fplane < plane_count; ++fplane) {
+    if ((planes & (1 << fplane)) == 0) continue;
+    auto in_size = input.size;
+    if (in_size == 0) break;
     auto last_index = in_size - 1;
-    auto last_d = dot_product(input[last_index].position, static_cast<FrustumPlane>(fplane));
+    auto last_d = dot_product(input.vertices[last_index].position, static_cast<FrustumPlane>(fplane), guard_band);
+    output.size = 0;
     for (auto index = 0UZ; index < in_size; ++index) {
-      auto d = dot_product(input[index].position, static_cast<FrustumPlane>(fplane));
+      auto d = dot_product(input.vertices[index].position, static_cast<FrustumPlane>(fplane), guard_band);
       if (last_d >= 0.0f) {
-        output.push_back(input[last_index]);
-        if (d < 0.0f) {
-          auto t = last_d / (last_d - d);
-          assert(t >= 0.0F && t <= 1.0F);
-          output.push_back(ClipVertex{
-            glm::mix(input[last_index].position, input[index].position, t),
-            glm::mix(input[last_index].texture_coord, input[index].texture_coord, t) });
-        }
+        output.vertices[output.size++] = input.vertices[last_index];
       }
-      else if (d >= 0.0f) {
+      if ((last_d >= 0.0f) != (d >= 0.0f)) {
         auto t = last_d / (last_d - d);
         assert(t >= 0.0F && t <= 1.0F);
-        output.push_back(ClipVertex{
-          glm::mix(input[last_index].position, input[index].position, t),
-          glm::mix(input[last_index].texture_coord, input[index].texture_coord, t) });
+        output.vertices[output.size++] = ClipVertex{
+          glm::mix(input.vertices[last_index].position, input.vertices[index].position, t),
+          glm::mix(input.vertices[last_index].texture_coord, input.vertices[index].texture_coord, t) };
       }
       last_index = index;
       last_d = d;
     }
     std::swap(input, output);
-    output.clear();
   }
-  assert(input.size() >= 3);
   return input;
-}
\ No newline at end of file
+}
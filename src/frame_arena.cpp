@@ -0,0 +1,55 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+FrameArena::FrameArena(std::size_t initial_size)
+{
+  add_block(std::max(initial_size, 1UZ));
+  // the first block isn't growth
+  m_growth_count = 0;
+}
+
+void FrameArena::reset()
+{
+  if (m_blocks.size() > 1) {
+    auto size = capacity();
+    m_blocks.clear();
+    add_block(size);
+  }
+  m_offset = 0;
+  m_used = 0;
+}
+
+auto FrameArena::capacity() const -> std::size_t
+{
+  auto size = 0UZ;
+  for (const auto& block : m_blocks) size += block.size;
+  return size;
+}
+
+auto FrameArena::do_allocate(std::size_t bytes, std::size_t alignment) -> void*
+{
+  auto fit = [&] {
+    const auto& block = m_blocks.back();
+    auto address = reinterpret_cast<std::uintptr_t>(block.memory.get()) + m_offset;
+    auto padding = (alignment - address % alignment) % alignment;
+    if (padding + bytes > block.size - m_offset) return false;
+    m_offset += padding + bytes;
+    m_used += padding + bytes;
+    return true;
+  };
+  if (!fit()) {
+    // blocks at least double, so a frame of any size takes a few of them
+    add_block(std::max(bytes + alignment, 2 * m_blocks.back().size));
+    fit();
+  }
+  return m_blocks.back().memory.get() + m_offset - bytes;
+}
+
+void FrameArena::add_block(std::size_t size)
+{
+  m_blocks.push_back(Block{ std::make_unique_for_overwrite<std::byte[]>(size), size });
+  m_offset = 0;
+  ++m_growth_count;
+}
@@ -4,41 +4,51 @@
 #include <glm/glm.hpp>
 
 #include <algorithm>
+#include <bit>
+#include <charconv>
 #include <cstdint>
-#include <fstream>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
 #include <optional>
-#include <sstream>
+#include <string_view>
+#include <system_error>
 #include <utility>
 #include <vector>
 
-#include "timer.hpp"
+#include "lod.hpp"
+#include "mapped_file.hpp"
+#include "meshlet.hpp"
+#include "model_cache.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
 
-auto to_abgr(const sf::Color& color) -> std::uint32_t
-{
-  return (static_cast<std::uint32_t>(color.a) << 24)
-         | (static_cast<std::uint32_t>(color.b) << 16)
-         | (static_cast<std::uint32_t>(color.g) << 8)
-         | static_cast<std::uint32_t>(color.r);
-}
-
-auto import_texture(const std::string& texture_path) -> std::optional<Texture>
+// SFML images are rows of RGBA bytes, top row first. Read as little endian words they are
+// already ABGR, so rows are copied whole, bottom row first to flip the image
+auto import_texture(const std::string& texture_path, bool compress) -> std::optional<Texture>
 {
+  PROFILE_ZONE("import_texture");
   auto image = sf::Image{};
   if (!image.loadFromFile(texture_path)) {
     std::cerr << "Could not load the texture " << texture_path << '\n';
     return {};
   }
-  image.flipVertically();
-  auto size = image.getSize();
-  auto colors = std::vector<std::uint32_t>(size.x * size.y);
-  for (auto pixel = 0U; pixel < size.x * size.y; ++pixel) {
-    auto color = image.getPixel(pixel % size.x, pixel / size.x);
-    colors.at(pixel) = to_abgr(color);
+  auto width = static_cast<std::size_t>(image.getSize().x);
+  auto height = static_cast<std::size_t>(image.getSize().y);
+  const auto* pixels = image.getPixelsPtr();
+  auto colors = std::vector<std::uint32_t>(width * height);
+  for (auto y = 0UZ; y < height; ++y) {
+    auto* row = &colors[y * width];
+    std::memcpy(row, pixels + (height - 1 - y) * width * 4, width * sizeof(std::uint32_t));
+    if constexpr (std::endian::native == std::endian::big) {
+      std::ranges::transform(row, row + width, row, [](std::uint32_t color) { return std::byteswap(color); });
+    }
   }
-  return Texture{ std::move(colors), size.x, size.y };
+  auto texture = Texture{ colors, width, height };
+  if (compress) return texture.compress();
+  return texture;
 }
 
 // return the directory with a trailing '/'
@@ -48,184 +58,448 @@ auto get_directory(const std::string& file_path) -> std::string
   return (index == std::string::npos) ? "./" : file_path.substr(0, index + 1);
 }
 
-using Material = Texture;
+// Calls function(line) for every line of text, without its line break, until it returns false
+template <typename Function>
+auto for_each_line(std::string_view text, Function&& function) -> bool
+{
+  while (!text.empty()) {
+    const auto* line_end = static_cast<const char*>(std::memchr(text.data(), '\n', text.size()));
+    auto length = line_end ? static_cast<std::size_t>(line_end - text.data()) : text.size();
+    auto line = text.substr(0, length);
+    if (line.ends_with('\r')) line.remove_suffix(1);
+    if (!function(line)) return false;
+    text.remove_prefix(std::min(length + 1, text.size()));
+  }
+  return true;
+}
+
+auto is_space(char character) -> bool
+{
+  return character == ' ' || character == '\t';
+}
+
+// The first word of a line, and what follows the space after it
+auto split_head(std::string_view line) -> std::pair<std::string_view, std::string_view>
+{
+  auto separator = static_cast<std::size_t>(std::ranges::find_if(line, is_space) - line.begin());
+  if (separator == line.size()) return { line, {} };
+  return { line.substr(0, separator), line.substr(separator + 1) };
+}
+
+void skip_spaces(std::string_view& text)
+{
+  while (!text.empty() && is_space(text.front())) text.remove_prefix(1);
+}
+
+// Numbers are parsed in place, consuming them from the front of text
+template <typename T>
+auto parse_number(std::string_view& text, T& value) -> bool
+{
+  skip_spaces(text);
+  if (text.starts_with('+')) text.remove_prefix(1);
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc{}) return false;
+  text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+  return true;
+}
+
+using Material = std::shared_ptr<const Texture>;
 using MaterialLib = std::map<std::string, Material>;
-auto import_mtllib(const std::string& mtllib_path) -> std::optional<MaterialLib>
+// Textures already decoded, by path. Materials sharing a diffuse map share its texture
+using TextureLib = std::map<std::string, std::shared_ptr<const Texture>>;
+
+// The diffuse maps not in texture_lib yet are decoded by up to options.thread_count threads.
+// Every file read is added to dependencies
+auto import_mtllib(const std::string& mtllib_path, const ImportOptions& options, TextureLib& texture_lib, std::vector<std::string>& dependencies) -> std::optional<MaterialLib>
 {
-  auto mtl = std::ifstream{ mtllib_path };
+  auto mtl = MappedFile::open(mtllib_path);
   if (!mtl) {
     std::cerr << "Could not open the file " << mtllib_path << '\n';
     return {};
   }
-  auto output = MaterialLib{};
-  while (mtl) {
-    auto line = std::string{};
-    std::getline(mtl, line);
-    if (line.starts_with('#') || line.length() == 0) continue;
-    auto line_stream = std::stringstream{ line };
-    auto head = std::string{};
-    std::getline(line_stream, head, ' ');
+  dependencies.push_back(mtllib_path);
+  // material name and diffuse map path, in file order
+  auto material_maps = std::vector<std::pair<std::string, std::string>>{};
+  // material declared by the last newmtl, until its diffuse map is found
+  auto pending_material = std::optional<std::string>{};
+  auto success = for_each_line(mtl->view(), [&](std::string_view line) {
+    if (line.starts_with('#') || line.length() == 0) return true;
+    auto [head, rest] = split_head(line);
 
     if (head == "newmtl") {
-      auto material_name = std::string{};
-      std::getline(line_stream, material_name);
-      if (!line_stream) {
-        std::cerr << "Could not parse the material name on line: " << line << '\n';
-        return {};
+      if (pending_material) {
+        std::cerr << "Could not find the diffuse map for material " << *pending_material << '\n';
+        return false;
       }
-
-      auto found_texture = false;
-      while (std::getline(mtl, line)) {
-        if (line.starts_with('#') || line.length() == 0) continue;
-        line_stream.str(line);
-        line_stream.clear();
-        std::getline(line_stream, head, ' ');
-        if (head == "newmtl") {
-          std::cerr << "Could not find the diffuse map for material " << material_name << '\n';
-          return {};
-        }
-        else if (head == "map_Kd") {
-          auto texture_name = std::string{};
-          std::getline(line_stream, texture_name);
-          if (!line_stream) {
-            std::cerr << "Could not parse the diffuse map name on line: " << line << '\n';
-            return {};
-          }
-          auto texture = import_texture(get_directory(mtllib_path) + texture_name);
-          if (!texture) return {};
-          output.insert(std::pair{ std::move(material_name), std::move(*texture) });
-          found_texture = true;
-          break;
-        }
+      if (rest.empty()) {
+        std::cerr << "Could not parse the material name on line: " << line << '\n';
+        return false;
       }
-      if (!found_texture) {
-        std::cerr << "Could not find the diffuse map for material " << material_name << '\n';
-        return {};
+      pending_material = std::string{ rest };
+    }
+    else if (head == "map_Kd" && pending_material) {
+      if (rest.empty()) {
+        std::cerr << "Could not parse the diffuse map name on line: " << line << '\n';
+        return false;
       }
+      material_maps.emplace_back(std::move(*pending_material), get_directory(mtllib_path) + std::string{ rest });
+      pending_material.reset();
     }
+    return true;
+  });
+  if (!success) return {};
+  if (pending_material) {
+    std::cerr << "Could not find the diffuse map for material " << *pending_material << '\n';
+    return {};
   }
-  if (output.empty()) {
+  if (material_maps.empty()) {
     std::cerr << "No materials defined on the mtl file " << mtllib_path << '\n';
     return {};
   }
+
+  // Each diffuse map is decoded once, on its own thread
+  auto texture_paths = std::vector<std::string>{};
+  for (const auto& [material, texture_path] : material_maps) {
+    if (!texture_lib.contains(texture_path) && std::ranges::find(texture_paths, texture_path) == texture_paths.end()) {
+      texture_paths.push_back(texture_path);
+    }
+  }
+  auto textures = std::vector<std::optional<Texture>>(texture_paths.size());
+  auto thread_count = std::min(options.thread_count, texture_paths.size());
+  if (thread_count > 1) {
+    auto thread_pool = ThreadPool{ thread_count };
+    thread_pool.parallel_for(texture_paths.size(), [&](std::size_t index) { textures[index] = import_texture(texture_paths[index], options.compress_textures); });
+  }
+  else {
+    for (auto index = 0UZ; index < texture_paths.size(); ++index) {
+      textures[index] = import_texture(texture_paths[index], options.compress_textures);
+    }
+  }
+  for (auto index = 0UZ; index < texture_paths.size(); ++index) {
+    if (!textures[index]) return {};
+    texture_lib.emplace(texture_paths[index], std::make_shared<const Texture>(std::move(*textures[index])));
+    dependencies.push_back(texture_paths[index]);
+  }
+
+  auto output = MaterialLib{};
+  for (auto& [material, texture_path] : material_maps) {
+    output.insert(std::pair{ std::move(material), texture_lib.at(texture_path) });
+  }
   return output;
 }
 
+// Obj vertex references of a face corner, as written in the file: 1 based, or negative
+// to count back from the last vertex defined
+struct ObjCorner {
+  std::int32_t position_index{};
+  std::int32_t texture_coord_index{};
+};
+
+struct ObjFace {
+  std::size_t first_corner{};
+  // vertices defined by the chunk before the face, the only ones it can reference
+  std::size_t position_count{};
+  std::size_t texture_coord_count{};
+  // where the face line starts in the chunk text, for error messages
+  std::size_t line_offset{};
+};
+
+enum class ObjStatementKind {
+  mtllib,
+  usemtl,
+  // parse error, reported when the chunks are stitched so the first one in the file wins
+  error,
+};
+
+// Line that changes the state of the import. Faces before it are the ones with index below first_face
+struct ObjStatement {
+  ObjStatementKind kind{};
+  std::string_view line{};
+  // material lib or material name, or the error message
+  std::string_view argument{};
+  std::size_t first_face{};
+};
+
+// Lines of an obj file parsed on their own. Whatever depends on the lines before them
+// (materials and vertex references) is kept in order and resolved when stitching the chunks
+struct ObjChunk {
+  std::string_view text{};
+  std::vector<glm::vec3> positions{};
+  std::vector<glm::vec2> texture_coords{};
+  std::vector<ObjCorner> corners{};
+  std::vector<ObjFace> faces{};
+  std::vector<ObjStatement> statements{};
+};
+
+auto parse_obj_chunk(std::string_view text) -> ObjChunk
+{
+  PROFILE_ZONE("parse obj chunk");
+  auto chunk = ObjChunk{};
+  chunk.text = text;
+  // rough guesses from typical line lengths, to skip most of the reallocations
+  chunk.positions.reserve(text.size() / 128);
+  chunk.texture_coords.reserve(text.size() / 128);
+  chunk.faces.reserve(text.size() / 128);
+  chunk.corners.reserve(text.size() / 40);
+  auto add_statement = [&](ObjStatementKind kind, std::string_view line, std::string_view argument) {
+    chunk.statements.push_back(ObjStatement{ kind, line, argument, chunk.faces.size() });
+  };
+
+  for_each_line(text, [&](std::string_view line) {
+    if (line.starts_with('#') || line.length() == 0) return true;
+    auto [head, rest] = split_head(line);
+    if (head == "v") {
+      auto position = glm::vec3{};
+      if (!parse_number(rest, position.x) || !parse_number(rest, position.y) || !parse_number(rest, position.z)) {
+        add_statement(ObjStatementKind::error, line, "Could not parse the geometric vertex on line: ");
+        return false;
+      }
+      chunk.positions.push_back(position);
+    }
+    else if (head == "vt") {
+      auto texture_coord = glm::vec2{};
+      if (!parse_number(rest, texture_coord.x) || !parse_number(rest, texture_coord.y)) {
+        add_statement(ObjStatementKind::error, line, "Could not parse the texture coordinate on line: ");
+        return false;
+      }
+      chunk.texture_coords.push_back(texture_coord);
+    }
+    else if (head == "f") {
+      auto first_corner = chunk.corners.size();
+      // corners are position/texture_coord, with an optional /normal that is ignored
+      for (skip_spaces(rest); !rest.empty(); skip_spaces(rest)) {
+        auto corner = ObjCorner{};
+        if (!parse_number(rest, corner.position_index)) break;
+        auto has_separator = rest.starts_with('/');
+        if (has_separator) rest.remove_prefix(1);
+        if (!has_separator || !parse_number(rest, corner.texture_coord_index)) {
+          add_statement(ObjStatementKind::error, line, "Could not parse indices on line: ");
+          return false;
+        }
+        while (!rest.empty() && !is_space(rest.front())) rest.remove_prefix(1);
+        chunk.corners.push_back(corner);
+      }
+      chunk.faces.push_back(ObjFace{
+        first_corner,
+        chunk.positions.size(),
+        chunk.texture_coords.size(),
+        static_cast<std::size_t>(line.data() - text.data()) });
+    }
+    else if (head == "mtllib") {
+      add_statement(ObjStatementKind::mtllib, line, rest);
+    }
+    else if (head == "usemtl") {
+      add_statement(ObjStatementKind::usemtl, line, rest);
+    }
+    return true;
+  });
+  return chunk;
+}
+
+// Lines of text split in about count pieces, cut at line breaks
+auto split_lines(std::string_view text, std::size_t count) -> std::vector<std::string_view>
+{
+  auto pieces = std::vector<std::string_view>{};
+  while (!text.empty()) {
+    auto end = pieces.size() + 1 < count ? text.find('\n', text.size() / (count - pieces.size())) : std::string_view::npos;
+    end = end == std::string_view::npos ? text.size() : end + 1;
+    pieces.push_back(text.substr(0, end));
+    text.remove_prefix(end);
+  }
+  return pieces;
+}
+
+// Mesh being imported, moved into a Mesh once all of its faces are added
+struct MeshBuilder {
+  std::shared_ptr<const Texture> texture{};
+  std::vector<Vertex> vertices{};
+  std::vector<std::uint32_t> indices{};
+};
+
 // Wavefront obj importer
 //   accepts at least one material
 //   each material must have a diffuse map
 //   each face must have a texture coordinate
-auto import_model(const std::string& obj_path) -> std::optional<Model>
+// Every file read is added to dependencies
+auto parse_obj(const std::string& obj_path, const ImportOptions& options, std::vector<std::string>& dependencies) -> std::optional<Model>
 {
-  auto obj = std::ifstream{ obj_path };
+  auto obj = MappedFile::open(obj_path);
   if (!obj) {
     std::cerr << "Could not open the file: " << obj_path << '\n';
     return {};
   }
+  dependencies.push_back(obj_path);
+
+  // Chunks are parsed in parallel when the file is large enough to pay for the threads
+  constexpr auto min_chunk_size = 1UZ << 20;
+  auto text = obj->view();
+  auto thread_count = std::clamp(text.size() / min_chunk_size, 1UZ, std::max(options.thread_count, 1UZ));
+  auto pieces = split_lines(text, thread_count * 4);
+  auto chunks = std::vector<ObjChunk>(pieces.size());
+  if (thread_count > 1) {
+    auto thread_pool = ThreadPool{ thread_count };
+    thread_pool.parallel_for(pieces.size(), [&](std::size_t index) { chunks[index] = parse_obj_chunk(pieces[index]); });
+  }
+  else {
+    for (auto index = 0UZ; index < pieces.size(); ++index) {
+      chunks[index] = parse_obj_chunk(pieces[index]);
+    }
+  }
+
+  // Stitching: chunks are walked in file order, turning their references into global ones
+  PROFILE_ZONE("stitch obj chunks");
   auto positions = std::vector<glm::vec3>{};
   auto texture_coords = std::vector<glm::vec2>{};
-  auto output = Model{};
+  for (const auto& chunk : chunks) {
+    positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+    texture_coords.insert(texture_coords.end(), chunk.texture_coords.begin(), chunk.texture_coords.end());
+  }
+
+  auto meshes = std::vector<MeshBuilder>{};
   auto material_lib = MaterialLib{};
-  while (obj) {
-    auto line = std::string{};
-    std::getline(obj, line);
-    if (line.starts_with('#') || line.length() == 0) continue;
-    auto line_stream = std::stringstream{ line };
-    auto head = std::string{};
-    std::getline(line_stream, head, ' ');
-    if (head == "mtllib") {
-      auto material_lib_name = std::string{};
-      std::getline(line_stream, material_lib_name);
-      if (!line_stream) {
-        std::cerr << "Could not parse the material lib name on line: " << line << '\n';
-        return {};
-      }
-      auto optional = import_mtllib(get_directory(obj_path) + material_lib_name);
-      if (!optional) return {};
-      material_lib = std::move(*optional);
+  auto texture_lib = TextureLib{};
+  // Vertices of the current mesh sharing a position are chained from first_vertex[position].
+  // Entries are tagged with the mesh, so nothing is cleared on usemtl
+  constexpr auto no_vertex = std::numeric_limits<std::uint32_t>::max();
+  auto first_vertex = std::vector<std::uint32_t>(positions.size(), no_vertex);
+  auto first_vertex_mesh = std::vector<std::size_t>(positions.size());
+  auto next_vertex = std::vector<std::uint32_t>{};
+  auto vertex_texture_coord = std::vector<std::int64_t>{};
+  auto face_indices = std::vector<std::uint32_t>{};
+
+  auto add_face = [&](const ObjChunk& chunk, std::size_t face, std::size_t position_offset, std::size_t texture_coord_offset) {
+    auto line_of_face = [&] {
+      auto line = chunk.text.substr(chunk.faces[face].line_offset);
+      return line.substr(0, line.find_first_of("\r\n"));
+    };
+    if (meshes.size() == 0) {
+      std::cerr << "usemtl must be set before a face element\n";
+      return false;
     }
-    else if (head == "usemtl") {
-      auto material_name = std::string{};
-      std::getline(line_stream, material_name);
-      if (!line_stream) {
-        std::cerr << "Could not parse the material name on line: " << line << '\n';
-        return {};
+
+    auto& mesh = meshes.back();
+    auto mesh_index = meshes.size() - 1;
+    auto max_bounds = glm::vec2{
+      mesh.texture->width() - 1,
+      mesh.texture->height() - 1
+    };
+    auto position_count = static_cast<std::int64_t>(position_offset + chunk.faces[face].position_count);
+    auto texture_coord_count = static_cast<std::int64_t>(texture_coord_offset + chunk.faces[face].texture_coord_count);
+    auto corner_end = face + 1 < chunk.faces.size() ? chunk.faces[face + 1].first_corner : chunk.corners.size();
+    face_indices.clear();
+    for (auto corner = chunk.faces[face].first_corner; corner < corner_end; ++corner) {
+      auto position_index = static_cast<std::int64_t>(chunk.corners[corner].position_index);
+      auto texture_coord_index = static_cast<std::int64_t>(chunk.corners[corner].texture_coord_index);
+      if (position_index < 0) position_index += position_count + 1;
+      if (texture_coord_index < 0) texture_coord_index += texture_coord_count + 1;
+      if (position_index < 1 || position_index > position_count
+          || texture_coord_index < 1 || texture_coord_index > texture_coord_count) {
+        std::cerr << "Invalid indices on line: " << line_of_face() << '\n';
+        return false;
       }
-      if (!material_lib.contains(material_name)) {
-        std::cerr << "Could not find the material " << material_name << " in the material lib."
-                  << " Occurred on the line: " << line << '\n';
-        return {};
+
+      auto position = static_cast<std::size_t>(position_index - 1);
+      auto vertex = first_vertex_mesh[position] == mesh_index ? first_vertex[position] : no_vertex;
+      while (vertex != no_vertex && vertex_texture_coord[vertex] != texture_coord_index) {
+        vertex = next_vertex[vertex];
       }
-      output.meshes.push_back(Mesh{ std::move(material_lib.at(material_name)) });
-      material_lib.erase(material_name);
-    }
-    else if (head == "v") {
-      auto position = glm::vec3{};
-      line_stream >> position.x >> position.y >> position.z;
-      if (!line_stream) {
-        std::cerr << "Could not parse the geometric vertex on line: " << line << '\n';
-        return {};
+      if (vertex == no_vertex) {
+        vertex = static_cast<std::uint32_t>(mesh.vertices.size());
+        mesh.vertices.push_back(Vertex{
+          positions[position],
+          texture_coords[static_cast<std::size_t>(texture_coord_index - 1)] * max_bounds
+        });
+        next_vertex.push_back(first_vertex_mesh[position] == mesh_index ? first_vertex[position] : no_vertex);
+        vertex_texture_coord.push_back(texture_coord_index);
+        first_vertex[position] = vertex;
+        first_vertex_mesh[position] = mesh_index;
       }
-      positions.push_back(position);
+      face_indices.push_back(vertex);
     }
-    else if (head == "vt") {
-      auto texture_coord = glm::vec2{};
-      line_stream >> texture_coord.x >> texture_coord.y;
-      if (!line_stream) {
-        std::cerr << "Could not parse the texture coordinate on line: " << line << '\n';
-        return {};
-      }
-      texture_coords.push_back(texture_coord);
+
+    for (auto i = 2UZ; i < face_indices.size(); ++i) {
+      mesh.indices.push_back(face_indices[0]);
+      mesh.indices.push_back(face_indices[i - 1]);
+      mesh.indices.push_back(face_indices[i]);
     }
-    else if (head == "f") {
-      if (output.meshes.size() == 0) {
-        std::cerr << "usemtl must be set before a face element\n";
-        return {};
-      }
-      
-      auto vertices = std::vector<Vertex>{};
-      auto position_index = std::size_t{};
-      while (line_stream >> position_index) {
-        line_stream.get();
+    return true;
+  };
 
-        auto texture_coord_index = std::size_t{};
-        line_stream >> texture_coord_index;
+  auto position_offset = 0UZ;
+  auto texture_coord_offset = 0UZ;
+  for (const auto& chunk : chunks) {
+    auto face = 0UZ;
+    for (const auto& statement : chunk.statements) {
+      for (; face < statement.first_face; ++face) {
+        if (!add_face(chunk, face, position_offset, texture_coord_offset)) return {};
+      }
 
-        if (!line_stream) {
-          std::cerr << "Could not parse indices on line: " << line << '\n';
+      const auto& line = statement.line;
+      if (statement.kind == ObjStatementKind::error) {
+        std::cerr << statement.argument << line << '\n';
+        return {};
+      }
+      else if (statement.kind == ObjStatementKind::mtllib) {
+        if (statement.argument.empty()) {
+          std::cerr << "Could not parse the material lib name on line: " << line << '\n';
           return {};
         }
-        if (position_index > positions.size() || texture_coord_index > texture_coords.size()) {
-          std::cerr << "Invalid indices on line: " << line << '\n';
+        auto optional = import_mtllib(get_directory(obj_path) + std::string{ statement.argument }, options, texture_lib, dependencies);
+        if (!optional) return {};
+        material_lib = std::move(*optional);
+      }
+      else if (statement.kind == ObjStatementKind::usemtl) {
+        if (statement.argument.empty()) {
+          std::cerr << "Could not parse the material name on line: " << line << '\n';
           return {};
         }
-
-        line_stream.ignore(std::numeric_limits<std::streamsize>::max(), ' ');
-
-        auto max_bounds = glm::vec2{
-          output.meshes.back().texture.width() - 1,
-          output.meshes.back().texture.height() - 1
-        };
-
-        vertices.push_back(Vertex{
-          positions.at(position_index - 1),
-          texture_coords.at(texture_coord_index - 1) * max_bounds
-        });
-      }
-
-      for (auto i = 1U; i < vertices.size() - 1; ++i) {
-        auto face = Mesh::Face{
-          vertices.at(0),
-          vertices.at(i),
-          vertices.at(i + 1)
-        };
-        output.meshes.back().faces.push_back(std::move(face));
+        auto material = material_lib.find(std::string{ statement.argument });
+        if (material == material_lib.end()) {
+          std::cerr << "Could not find the material " << statement.argument << " in the material lib."
+                    << " Occurred on the line: " << line << '\n';
+          return {};
+        }
+        meshes.push_back(MeshBuilder{ std::move(material->second) });
+        material_lib.erase(material);
+        next_vertex.clear();
+        vertex_texture_coord.clear();
       }
     }
+    for (; face < chunk.faces.size(); ++face) {
+      if (!add_face(chunk, face, position_offset, texture_coord_offset)) return {};
+    }
+    position_offset += chunk.positions.size();
+    texture_coord_offset += chunk.texture_coords.size();
   }
-  if (output.meshes.size() == 0) {
+  if (meshes.size() == 0) {
     std::cerr << "Could not import any model meshes on file " << obj_path << '\n';
     return {};
   }
+  PROFILE_ZONE("build meshlets");
+  auto output = Model{};
+  for (auto& mesh : meshes) {
+    output.meshes.push_back(make_mesh(std::move(mesh.texture), std::move(mesh.vertices), std::move(mesh.indices)));
+  }
+  build_model_lods(output);
   return output;
-}
\ No newline at end of file
+}
+
+auto import_model(const std::string& obj_path, const ImportOptions& options) -> std::optional<Model>
+{
+  PROFILE_ZONE("import_model");
+  auto cache_path = get_model_cache_path(obj_path);
+  if (options.use_cache) {
+    PROFILE_ZONE("load model cache");
+    // a cache made with the other texture format is replaced
+    auto model = load_model_cache(cache_path);
+    if (model && (model->meshes.front().texture->format() != TextureFormat::rgba8) == options.compress_textures) return model;
+  }
+  auto dependencies = std::vector<std::string>{};
+  auto model = parse_obj(obj_path, options, dependencies);
+  // the model is fine without a cache, failing to write one only costs the next import
+  if (model && options.use_cache) {
+    PROFILE_ZONE("save model cache");
+    save_model_cache(cache_path, dependencies, *model);
+  }
+  return model;
+}
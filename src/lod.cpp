@@ -0,0 +1,433 @@
+#include "lod.hpp"
+#include "meshlet.hpp"
+#include "profiler.hpp"
+
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+// Constraint planes along UV seams and mesh borders weigh this much more than the faces
+constexpr auto g_lod_border_weight = 4.0;
+
+void compute_model_bounds(Model& model)
+{
+  auto min = glm::vec3{ std::numeric_limits<float>::max() };
+  auto max = glm::vec3{ std::numeric_limits<float>::lowest() };
+  for (const auto& mesh : model.meshes) {
+    for (const auto& vertex : mesh.vertices) {
+      min = glm::min(min, vertex.position);
+      max = glm::max(max, vertex.position);
+    }
+  }
+  if (min.x > max.x) {
+    model.center = glm::vec3{ 0.0F };
+    model.radius = 0.0F;
+    return;
+  }
+  model.center = (min + max) * 0.5F;
+  model.radius = 0.0F;
+  for (const auto& mesh : model.meshes) {
+    for (const auto& vertex : mesh.vertices) {
+      model.radius = std::max(model.radius, glm::distance(model.center, vertex.position));
+    }
+  }
+}
+
+struct PositionHash {
+  auto operator()(const glm::vec3& position) const -> std::size_t
+  {
+    // std::hash gives 0 and -0, which compare equal, the same value
+    auto hash = std::hash<float>{};
+    return (hash(position.x) * 31 + hash(position.y)) * 31 + hash(position.z);
+  }
+};
+
+using PositionSet = std::unordered_set<glm::vec3, PositionHash>;
+
+// Sum of weighted squared distances to a set of planes: p.A.p + 2 b.p + c
+struct Quadric {
+  double xx{};
+  double xy{};
+  double xz{};
+  double yy{};
+  double yz{};
+  double zz{};
+  double x{};
+  double y{};
+  double z{};
+  double c{};
+  // sum of the plane weights
+  double weight{};
+
+  // Plane through point, normal being a unit vector
+  static auto from_plane(const glm::vec3& normal, const glm::vec3& point, double weight) -> Quadric
+  {
+    auto a = static_cast<double>(normal.x);
+    auto b = static_cast<double>(normal.y);
+    auto c = static_cast<double>(normal.z);
+    auto d = -static_cast<double>(glm::dot(normal, point));
+    return Quadric{ weight * a * a, weight * a * b, weight * a * c, weight * b * b, weight * b * c, weight * c * c,
+                    weight * a * d, weight * b * d, weight * c * d, weight * d * d, weight };
+  }
+
+  auto operator+=(const Quadric& other) -> Quadric&
+  {
+    xx += other.xx;
+    xy += other.xy;
+    xz += other.xz;
+    yy += other.yy;
+    yz += other.yz;
+    zz += other.zz;
+    x += other.x;
+    y += other.y;
+    z += other.z;
+    c += other.c;
+    weight += other.weight;
+    return *this;
+  }
+
+  // Weighted mean of the squared distances from point to the planes
+  auto mean_error(const glm::vec3& point) const -> double
+  {
+    auto px = static_cast<double>(point.x);
+    auto py = static_cast<double>(point.y);
+    auto pz = static_cast<double>(point.z);
+    auto sum = xx * px * px + yy * py * py + zz * pz * pz + 2.0 * (xy * px * py + xz * px * pz + yz * py * pz)
+               + 2.0 * (x * px + y * py + z * pz) + c;
+    return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+  }
+};
+
+// Edge collapse simplification of a mesh. Vertices sharing a position, like the two sides of a
+// UV seam, are welded into one point carrying the quadric of the faces around it. A point
+// collapses into a neighbor point, each of its vertices turning into the vertex of the neighbor
+// it shares a triangle with
+class MeshSimplifier final {
+public:
+  MeshSimplifier(const Mesh& mesh, const PositionSet& locked_positions);
+
+  // Collapses the cheapest edges until at most target_index_count indices are left, or until
+  // no edge can collapse without flipping a face or tearing a seam
+  void simplify(std::size_t target_index_count);
+  auto index_count() const -> std::size_t { return m_indices.size(); }
+  // Square root of the largest collapse error so far, a distance in model units
+  auto error() const -> float { return static_cast<float>(std::sqrt(m_max_error)); }
+  auto make_mesh() const -> Mesh;
+
+private:
+  // An edge between two points, seen from its first triangle
+  struct Edge {
+    std::uint32_t triangle_count{};
+    std::uint32_t triangle{};
+    std::uint32_t vertex_a{};
+    std::uint32_t vertex_b{};
+    // the triangles of the edge don't share the same vertices, only their positions
+    bool seam{};
+  };
+
+  auto edge_key(std::uint32_t point_a, std::uint32_t point_b) const -> std::uint64_t
+  {
+    return (std::uint64_t{ std::min(point_a, point_b) } << 32) | std::max(point_a, point_b);
+  }
+  void find_edges();
+  auto collapse_pass(std::size_t target_index_count) -> bool;
+
+  const Mesh& m_mesh;
+  // point of each vertex of the mesh
+  std::vector<std::uint32_t> m_vertex_points{};
+  std::vector<glm::vec3> m_point_positions{};
+  std::vector<Quadric> m_quadrics{};
+  // points used by other meshes of the model
+  std::vector<bool> m_locked_points{};
+  std::vector<std::uint32_t> m_indices{};
+  std::unordered_map<std::uint64_t, Edge> m_edges{};
+  double m_max_error{};
+};
+
+MeshSimplifier::MeshSimplifier(const Mesh& mesh, const PositionSet& locked_positions)
+  : m_mesh{ mesh }
+{
+  auto points = std::unordered_map<glm::vec3, std::uint32_t, PositionHash>{};
+  m_vertex_points.reserve(mesh.vertices.size());
+  for (const auto& vertex : mesh.vertices) {
+    auto [point, inserted] = points.emplace(vertex.position, static_cast<std::uint32_t>(m_point_positions.size()));
+    if (inserted) {
+      m_point_positions.push_back(vertex.position);
+      m_locked_points.push_back(locked_positions.contains(vertex.position));
+    }
+    m_vertex_points.push_back(point->second);
+  }
+
+  // Triangles with two corners at the same position cover no pixel and would get in the way
+  // of the collapses
+  m_indices.reserve(mesh.indices.size());
+  for (auto index = 0UZ; index + 2 < mesh.indices.size(); index += 3) {
+    auto a = m_vertex_points[mesh.indices[index]];
+    auto b = m_vertex_points[mesh.indices[index + 1]];
+    auto c = m_vertex_points[mesh.indices[index + 2]];
+    if (a == b || b == c || c == a) continue;
+    m_indices.insert(m_indices.end(), { mesh.indices[index], mesh.indices[index + 1], mesh.indices[index + 2] });
+  }
+
+  // Every face adds its plane to its points, weighted by its area. Border and seam edges add a
+  // plane through the edge, perpendicular to the face, so they keep their shape too
+  m_quadrics.resize(m_point_positions.size());
+  auto face_normal = [&](std::size_t triangle) {
+    const auto& a = m_point_positions[m_vertex_points[m_indices[triangle * 3]]];
+    const auto& b = m_point_positions[m_vertex_points[m_indices[triangle * 3 + 1]]];
+    const auto& c = m_point_positions[m_vertex_points[m_indices[triangle * 3 + 2]]];
+    return glm::cross(b - a, c - a);
+  };
+  for (auto triangle = 0UZ; triangle < m_indices.size() / 3; ++triangle) {
+    auto normal = face_normal(triangle);
+    auto length = glm::length(normal);
+    if (length == 0.0F) continue;
+    auto quadric = Quadric::from_plane(normal / length, m_point_positions[m_vertex_points[m_indices[triangle * 3]]], 0.5 * length);
+    for (auto corner = 0UZ; corner < 3; ++corner) {
+      m_quadrics[m_vertex_points[m_indices[triangle * 3 + corner]]] += quadric;
+    }
+  }
+  find_edges();
+  for (const auto& [key, edge] : m_edges) {
+    if (edge.triangle_count != 1 && !edge.seam) continue;
+    auto point_a = m_vertex_points[edge.vertex_a];
+    auto point_b = m_vertex_points[edge.vertex_b];
+    auto direction = m_point_positions[point_b] - m_point_positions[point_a];
+    auto normal = glm::cross(direction, face_normal(edge.triangle));
+    auto length = glm::length(normal);
+    if (length == 0.0F) continue;
+    auto weight = g_lod_border_weight * static_cast<double>(glm::dot(direction, direction));
+    auto quadric = Quadric::from_plane(normal / length, m_point_positions[point_a], weight);
+    m_quadrics[point_a] += quadric;
+    m_quadrics[point_b] += quadric;
+  }
+}
+
+void MeshSimplifier::find_edges()
+{
+  m_edges.clear();
+  m_edges.reserve(m_indices.size());
+  for (auto triangle = 0UZ; triangle < m_indices.size() / 3; ++triangle) {
+    for (auto corner = 0UZ; corner < 3; ++corner) {
+      auto vertex_a = m_indices[triangle * 3 + corner];
+      auto vertex_b = m_indices[triangle * 3 + (corner + 1) % 3];
+      if (m_vertex_points[vertex_a] > m_vertex_points[vertex_b]) std::swap(vertex_a, vertex_b);
+      auto key = edge_key(m_vertex_points[vertex_a], m_vertex_points[vertex_b]);
+      auto [edge, inserted] = m_edges.try_emplace(key, Edge{ 0, static_cast<std::uint32_t>(triangle), vertex_a, vertex_b, false });
+      ++edge->second.triangle_count;
+      if (!inserted && (edge->second.vertex_a != vertex_a || edge->second.vertex_b != vertex_b)) edge->second.seam = true;
+    }
+  }
+}
+
+void MeshSimplifier::simplify(std::size_t target_index_count)
+{
+  while (m_indices.size() > target_index_count) {
+    if (!collapse_pass(target_index_count)) break;
+  }
+}
+
+// One round of collapses over the whole mesh. A collapse changes the triangles around its point,
+// so the points of those triangles wait for the next pass, which sees the updated edges
+auto MeshSimplifier::collapse_pass(std::size_t target_index_count) -> bool
+{
+  PROFILE_ZONE("collapse pass");
+  auto point_count = m_point_positions.size();
+  auto triangle_count = m_indices.size() / 3;
+  // Triangles around each point, point p owning [first_triangle[p], first_triangle[p + 1])
+  auto first_triangle = std::vector<std::uint32_t>(point_count + 1);
+  for (auto vertex : m_indices) ++first_triangle[m_vertex_points[vertex] + 1];
+  for (auto point = 0UZ; point < point_count; ++point) first_triangle[point + 1] += first_triangle[point];
+  auto point_triangles = std::vector<std::uint32_t>(m_indices.size());
+  auto fill = std::vector<std::uint32_t>(first_triangle.begin(), first_triangle.end() - 1);
+  for (auto index = 0UZ; index < m_indices.size(); ++index) {
+    point_triangles[fill[m_vertex_points[m_indices[index]]]++] = static_cast<std::uint32_t>(index / 3);
+  }
+
+  // Points on a border may only slide along it. Those on an edge of more than two triangles,
+  // like those shared with other meshes, never move
+  enum class PointKind : std::uint8_t { interior, border, locked };
+  find_edges();
+  auto kinds = std::vector<PointKind>(point_count, PointKind::interior);
+  for (auto point = 0UZ; point < point_count; ++point) {
+    if (m_locked_points[point]) kinds[point] = PointKind::locked;
+  }
+  for (const auto& [key, edge] : m_edges) {
+    for (auto vertex : { edge.vertex_a, edge.vertex_b }) {
+      auto& kind = kinds[m_vertex_points[vertex]];
+      if (edge.triangle_count > 2) kind = PointKind::locked;
+      else if (edge.triangle_count == 1 && kind == PointKind::interior) kind = PointKind::border;
+    }
+  }
+
+  auto triangles_of = [&](std::uint32_t point) {
+    return std::span{ point_triangles.begin() + first_triangle[point], point_triangles.begin() + first_triangle[point + 1] };
+  };
+  auto corner_of = [&](std::uint32_t triangle, std::uint32_t point) {
+    for (auto corner = 0U; corner < 3; ++corner) {
+      if (m_vertex_points[m_indices[triangle * 3 + corner]] == point) return corner;
+    }
+    return 3U;
+  };
+  // Fills the (vertex of from, vertex of to) pairs of the collapse of from into to. Every vertex
+  // of from must share a triangle with exactly one vertex of to, otherwise the collapse would tear
+  // a UV seam apart, and no triangle moving its corner may flip
+  using VertexPair = std::pair<std::uint32_t, std::uint32_t>;
+  auto find_vertex_pairs = [&](std::uint32_t from, std::uint32_t to, std::vector<VertexPair>& pairs) {
+    pairs.clear();
+    for (auto triangle : triangles_of(from)) {
+      auto to_corner = corner_of(triangle, to);
+      if (to_corner == 3) continue;
+      auto from_vertex = m_indices[triangle * 3 + corner_of(triangle, from)];
+      auto to_vertex = m_indices[triangle * 3 + to_corner];
+      auto pair = std::ranges::find(pairs, from_vertex, &VertexPair::first);
+      if (pair == pairs.end()) pairs.push_back(VertexPair{ from_vertex, to_vertex });
+      else if (pair->second != to_vertex) return false;
+    }
+    for (auto triangle : triangles_of(from)) {
+      if (corner_of(triangle, to) != 3) continue;
+      auto from_corner = corner_of(triangle, from);
+      if (std::ranges::find(pairs, m_indices[triangle * 3 + from_corner], &VertexPair::first) == pairs.end()) return false;
+      auto corners = std::array<glm::vec3, 3>{};
+      for (auto corner = 0U; corner < 3; ++corner) corners[corner] = m_point_positions[m_vertex_points[m_indices[triangle * 3 + corner]]];
+      auto before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+      corners[from_corner] = m_point_positions[to];
+      auto after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+      if (glm::dot(before, after) <= 0.0F) return false;
+    }
+    return true;
+  };
+
+  // Cheapest valid collapse of each point, keeping the position of the point it collapses into
+  struct Collapse {
+    std::uint32_t from{};
+    std::uint32_t to{};
+    double error{};
+  };
+  auto collapses = std::vector<Collapse>{};
+  auto vertex_pairs = std::vector<VertexPair>{};
+  for (auto from = 0U; from < point_count; ++from) {
+    if (kinds[from] == PointKind::locked) continue;
+    auto best = Collapse{ from, from, std::numeric_limits<double>::max() };
+    for (auto triangle : triangles_of(from)) {
+      for (auto corner = 0UZ; corner < 3; ++corner) {
+        auto to = m_vertex_points[m_indices[triangle * 3 + corner]];
+        if (to == from) continue;
+        if (kinds[from] == PointKind::border && m_edges.at(edge_key(from, to)).triangle_count != 1) continue;
+        auto quadric = m_quadrics[from];
+        quadric += m_quadrics[to];
+        auto error = quadric.mean_error(m_point_positions[to]);
+        if (error < best.error && find_vertex_pairs(from, to, vertex_pairs)) best = Collapse{ from, to, error };
+      }
+    }
+    if (best.to != from) collapses.push_back(best);
+  }
+  std::ranges::sort(collapses, {}, &Collapse::error);
+
+  // Only the cheapest third is done in a pass, the others may find a cheaper edge once their
+  // neighbors moved. A collapse only changes the triangles around its points, so the collapses
+  // left, whose points were not touched, are still valid
+  auto collapse_limit = std::max(collapses.size() / 3, 1UZ);
+  auto touched = std::vector<bool>(point_count);
+  auto removed = std::vector<bool>(triangle_count);
+  auto index_count = m_indices.size();
+  auto collapse_count = 0UZ;
+  for (auto i = 0UZ; i < std::min(collapse_limit, collapses.size()) && index_count > target_index_count; ++i) {
+    const auto& collapse = collapses[i];
+    if (touched[collapse.from] || touched[collapse.to]) continue;
+    find_vertex_pairs(collapse.from, collapse.to, vertex_pairs);
+    for (auto triangle : triangles_of(collapse.from)) {
+      for (auto corner = 0U; corner < 3; ++corner) touched[m_vertex_points[m_indices[triangle * 3 + corner]]] = true;
+      if (corner_of(triangle, collapse.to) != 3) {
+        removed[triangle] = true;
+        index_count -= 3;
+        continue;
+      }
+      auto& vertex = m_indices[triangle * 3 + corner_of(triangle, collapse.from)];
+      vertex = std::ranges::find(vertex_pairs, vertex, &VertexPair::first)->second;
+    }
+    m_quadrics[collapse.to] += m_quadrics[collapse.from];
+    m_max_error = std::max(m_max_error, collapse.error);
+    ++collapse_count;
+  }
+
+  auto kept = 0UZ;
+  for (auto triangle = 0UZ; triangle < triangle_count; ++triangle) {
+    if (removed[triangle]) continue;
+    for (auto corner = 0UZ; corner < 3; ++corner) m_indices[kept++] = m_indices[triangle * 3 + corner];
+  }
+  m_indices.resize(kept);
+  return collapse_count > 0;
+}
+
+// Mesh made of the remaining triangles and the vertices they use, in the order they are first used
+auto MeshSimplifier::make_mesh() const -> Mesh
+{
+  constexpr auto no_vertex = std::numeric_limits<std::uint32_t>::max();
+  auto new_vertex = std::vector<std::uint32_t>(m_mesh.vertices.size(), no_vertex);
+  auto vertices = std::vector<Vertex>{};
+  auto indices = std::vector<std::uint32_t>{};
+  indices.reserve(m_indices.size());
+  for (auto vertex : m_indices) {
+    if (new_vertex[vertex] == no_vertex) {
+      new_vertex[vertex] = static_cast<std::uint32_t>(vertices.size());
+      vertices.push_back(m_mesh.vertices[vertex]);
+    }
+    indices.push_back(new_vertex[vertex]);
+  }
+  return ::make_mesh(m_mesh.texture, std::move(vertices), std::move(indices));
+}
+
+void build_model_lods(Model& model)
+{
+  PROFILE_ZONE("build lods");
+  compute_model_bounds(model);
+  model.lods.clear();
+
+  // Positions used by several meshes stay in place, so the meshes don't come apart
+  auto position_meshes = std::unordered_map<glm::vec3, std::size_t, PositionHash>{};
+  auto shared_positions = PositionSet{};
+  for (auto mesh = 0UZ; mesh < model.meshes.size(); ++mesh) {
+    for (const auto& vertex : model.meshes[mesh].vertices) {
+      auto [entry, inserted] = position_meshes.emplace(vertex.position, mesh);
+      if (!inserted && entry->second != mesh) shared_positions.insert(vertex.position);
+    }
+  }
+
+  auto simplifiers = std::vector<MeshSimplifier>{};
+  simplifiers.reserve(model.meshes.size());
+  auto triangle_count = 0UZ;
+  for (const auto& mesh : model.meshes) {
+    simplifiers.emplace_back(mesh, shared_positions);
+    triangle_count += mesh.face_count();
+  }
+
+  // Each level goes on from the previous one, so errors only grow along the chain
+  while (model.lods.size() < g_lod_max_levels && triangle_count > 0) {
+    auto lod = ModelLod{};
+    auto level_triangle_count = 0UZ;
+    for (auto& simplifier : simplifiers) {
+      auto target_triangle_count = static_cast<std::size_t>(static_cast<float>(simplifier.index_count() / 3) * g_lod_triangle_ratio);
+      simplifier.simplify(target_triangle_count * 3);
+      lod.error = std::max(lod.error, simplifier.error());
+      level_triangle_count += simplifier.index_count() / 3;
+    }
+    // a level barely smaller than the previous one is not worth its memory
+    if (static_cast<float>(level_triangle_count) > 0.75F * static_cast<float>(triangle_count)) break;
+    for (const auto& simplifier : simplifiers) {
+      lod.meshes.push_back(simplifier.make_mesh());
+    }
+    model.lods.push_back(std::move(lod));
+    triangle_count = level_triangle_count;
+  }
+}
@@ -1,5 +1,7 @@
 #include "importer.hpp"
 #include "model.hpp"
+#include "presenter.hpp"
+#include "profiler.hpp"
 #include "renderer.hpp"
 #include "scene.hpp"
 #include "timer.hpp"
@@ -7,23 +9,11 @@
 #include <SFML/Graphics.hpp>
 #include <glm/vec2.hpp>
 
-#include <cassert>
+#include <iostream>
+#include <memory>
 #include <stdexcept>
-
-auto draw_window(sf::RenderWindow& window, const Renderer& renderer) -> bool
-{
-  auto texture = sf::Texture{};
-  if (!texture.create(
-        static_cast<unsigned>(renderer.render_width()),
-        static_cast<unsigned>(renderer.render_height()))) {
-    assert(false && "Could not create texture");
-    return false;
-  }
-  texture.update(
-    reinterpret_cast<const std::uint8_t*>(renderer.colors().data()));
-  window.draw(sf::Sprite{ texture });
-  return true;
-}
+#include <thread>
+#include <utility>
 
 auto main() -> int
 {
@@ -33,33 +23,68 @@ auto main() -> int
   // auto model = import_model(model_path);
   auto model = import_model("../models/car/car.obj");
   if (!model) return 1;
-  model->position.z = -2;
-  model->position.y = -1;
-  model->scale = glm::vec3{ 0.01F, 0.01F, 0.01F };
 
-  auto scene = Scene{ *model };
+  auto scene = Scene{};
+  scene.instances.push_back(Instance{ std::make_shared<const Model>(std::move(*model)) });
+  auto& transform = scene.instances.back().transform;
+  transform.position.z = -2;
+  transform.position.y = -1;
+  transform.scale = glm::vec3{ 0.01F, 0.01F, 0.01F };
 
   constexpr auto width = 1280;
   constexpr auto height = 720;
-  auto renderer = Renderer{ width, height };
+  // One buffer is drawn while the two others are queued or displayed
+  constexpr auto color_buffer_count = 3UZ;
+  auto renderer = Renderer{ width, height, std::thread::hardware_concurrency(), color_buffer_count };
+  // drops the resolution rather than the frame rate under 60 fps
+  renderer.set_frame_time_budget(1000.0 / 60.0);
   auto window = sf::RenderWindow{ sf::VideoMode{ width, height }, "" };
+  auto presenter = Presenter{ window, width, height, color_buffer_count - 1 };
 
+#if defined(PROFILING)
+  // the summary of the last frame is printed every second
+  auto summary_timer = Timer{};
+#endif
   for (auto timer = Timer{}; window.isOpen(); timer.reset()) {
     auto event = sf::Event{};
     while (window.pollEvent(event)) {
       if (event.type == sf::Event::Closed) {
+        // the presenter draws on the window until it stops
+        presenter.stop();
         window.close();
       }
     }
 
+    if (!window.isOpen()) break;
+
+    auto render_scale = renderer.render_scale();
     renderer.clear();
     renderer.render(scene);
-    draw_window(window, renderer);
-    window.display();
-    window.setTitle("Render time: " + std::to_string(timer.elapsed()) + "ms");
+    auto render_time = timer.elapsed();
+    presenter.present(renderer.colors().data());
+    renderer.swap_buffers();
+    const auto& stats = renderer.stats();
+    window.setTitle("Render time: " + std::to_string(render_time) + "ms"
+                    + " at " + std::to_string(static_cast<int>(render_scale * 100.0F + 0.5F)) + "% resolution"
+                    + " | Present time: " + std::to_string(presenter.present_time()) + "ms"
+                    + " | Triangles: " + std::to_string(stats.rasterized) + " rasterized, "
+                    + std::to_string(stats.meshlet_culled + stats.frustum_culled + stats.backface_culled + stats.empty_culled) + " culled, "
+                    + std::to_string(stats.clipped) + " clipped");
 
-    model->rotation.y += static_cast<float>(timer.elapsed() / 2000.0);
+    transform.rotation.y += static_cast<float>(timer.elapsed() / 2000.0);
+    PROFILE_FRAME();
+#if defined(PROFILING)
+    if (summary_timer.elapsed() > 1000.0) {
+      std::cout << Profiler::summary() << '\n';
+      summary_timer.reset();
+    }
+#endif
   }
 
+#if defined(PROFILING)
+  if (!Profiler::write_trace("trace.json")) {
+    std::cerr << "Could not write the file trace.json\n";
+  }
+#endif
   return 0;
 }
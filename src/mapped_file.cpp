@@ -0,0 +1,102 @@
+#include "mapped_file.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define _3D_FROM_SCRATCH_POSIX
+#endif
+
+auto MappedFile::open(const std::string& path) -> std::optional<MappedFile>
+{
+  auto file = MappedFile{};
+#if defined(_WIN32)
+  auto handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) return {};
+  auto size = LARGE_INTEGER{};
+  if (GetFileSizeEx(handle, &size) && size.QuadPart > 0) {
+    // the view keeps the file mapped after both handles are closed
+    auto mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      file.m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      CloseHandle(mapping);
+    }
+    if (file.m_data != nullptr) {
+      file.m_size = static_cast<std::size_t>(size.QuadPart);
+      file.m_mapped = true;
+    }
+  }
+  CloseHandle(handle);
+  if (file.m_mapped) return file;
+#elif defined(_3D_FROM_SCRATCH_POSIX)
+  auto descriptor = ::open(path.c_str(), O_RDONLY);
+  if (descriptor < 0) return {};
+  struct stat status {};
+  if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+    // the mapping stays valid after the descriptor is closed
+    auto size = static_cast<std::size_t>(status.st_size);
+    auto* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (data != MAP_FAILED) {
+      // the whole file is about to be read, possibly by several threads at once
+      madvise(data, size, MADV_WILLNEED);
+      file.m_data = static_cast<const char*>(data);
+      file.m_size = size;
+      file.m_mapped = true;
+    }
+  }
+  ::close(descriptor);
+  if (file.m_mapped) return file;
+#endif
+
+  auto stream = std::ifstream{ path, std::ios::binary };
+  if (!stream) return {};
+  file.m_buffer.assign(std::istreambuf_iterator<char>{ stream }, std::istreambuf_iterator<char>{});
+  file.m_data = file.m_buffer.data();
+  file.m_size = file.m_buffer.size();
+  return file;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+  : m_data{ std::exchange(other.m_data, nullptr) },
+    m_size{ std::exchange(other.m_size, 0) },
+    m_mapped{ std::exchange(other.m_mapped, false) },
+    m_buffer{ std::move(other.m_buffer) }
+{
+}
+
+auto MappedFile::operator=(MappedFile&& other) noexcept -> MappedFile&
+{
+  if (this != &other) {
+    unmap();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    m_mapped = std::exchange(other.m_mapped, false);
+    m_buffer = std::move(other.m_buffer);
+  }
+  return *this;
+}
+
+MappedFile::~MappedFile()
+{
+  unmap();
+}
+
+void MappedFile::unmap()
+{
+  if (!m_mapped) return;
+#if defined(_WIN32)
+  UnmapViewOfFile(m_data);
+#elif defined(_3D_FROM_SCRATCH_POSIX)
+  munmap(const_cast<char*>(m_data), m_size);
+#endif
+  m_mapped = false;
+}
@@ -0,0 +1,219 @@
+#include "meshlet.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+// Bounding sphere and normal cone of the meshlet triangles
+void compute_meshlet_bounds(Meshlet& meshlet, const std::vector<Vertex>& vertices, const std::vector<std::uint32_t>& indices)
+{
+  auto min = glm::vec3{ std::numeric_limits<float>::max() };
+  auto max = glm::vec3{ std::numeric_limits<float>::lowest() };
+  for (auto vertex = meshlet.first_vertex; vertex < meshlet.first_vertex + meshlet.vertex_count; ++vertex) {
+    min = glm::min(min, vertices[vertex].position);
+    max = glm::max(max, vertices[vertex].position);
+  }
+  meshlet.center = (min + max) * 0.5F;
+  meshlet.radius = 0.0F;
+  for (auto vertex = meshlet.first_vertex; vertex < meshlet.first_vertex + meshlet.vertex_count; ++vertex) {
+    meshlet.radius = std::max(meshlet.radius, glm::distance(meshlet.center, vertices[vertex].position));
+  }
+
+  auto normals = std::vector<glm::vec3>{};
+  auto normal_sum = glm::vec3{ 0.0F };
+  for (auto index = meshlet.first_index; index < meshlet.first_index + meshlet.index_count; index += 3) {
+    const auto& a = vertices[indices[index]].position;
+    const auto& b = vertices[indices[index + 1]].position;
+    const auto& c = vertices[indices[index + 2]].position;
+    auto normal = glm::cross(b - a, c - a);
+    auto length = glm::length(normal);
+    // degenerate triangles are never drawn, so they don't widen the cone
+    if (length == 0.0F) continue;
+    normals.push_back(normal / length);
+    normal_sum += normals.back();
+  }
+  auto axis_length = glm::length(normal_sum);
+  if (normals.empty() || axis_length < 1e-6F) {
+    meshlet.cone_axis = glm::vec3{ 0.0F, 0.0F, 1.0F };
+    meshlet.cone_cutoff = -1.0F;
+    return;
+  }
+  meshlet.cone_axis = normal_sum / axis_length;
+  meshlet.cone_cutoff = 1.0F;
+  for (const auto& normal : normals) {
+    meshlet.cone_cutoff = std::min(meshlet.cone_cutoff, glm::dot(meshlet.cone_axis, normal));
+  }
+}
+
+auto build_meshlets(std::vector<Vertex>& vertices, std::vector<std::uint32_t>& indices) -> std::vector<Meshlet>
+{
+  auto triangle_count = indices.size() / 3;
+  // Triangles using each vertex, vertex v owning [first_triangle[v], first_triangle[v + 1])
+  auto first_triangle = std::vector<std::uint32_t>(vertices.size() + 1);
+  for (auto index : indices) ++first_triangle[index + 1];
+  for (auto vertex = 0UZ; vertex < vertices.size(); ++vertex) first_triangle[vertex + 1] += first_triangle[vertex];
+  auto vertex_triangles = std::vector<std::uint32_t>(indices.size());
+  auto fill = std::vector<std::uint32_t>(first_triangle.begin(), first_triangle.end() - 1);
+  for (auto index = 0UZ; index < indices.size(); ++index) {
+    vertex_triangles[fill[indices[index]]++] = static_cast<std::uint32_t>(index / 3);
+  }
+
+  constexpr auto no_vertex = std::numeric_limits<std::uint32_t>::max();
+  constexpr auto no_triangle = std::numeric_limits<std::uint32_t>::max();
+  auto used = std::vector<bool>(triangle_count);
+  // position of each source vertex inside the current meshlet
+  auto local_vertex = std::vector<std::uint32_t>(vertices.size(), no_vertex);
+  auto meshlet_vertices = std::vector<std::uint32_t>{};
+  auto meshlet_triangles = std::vector<std::uint32_t>{};
+  // unused triangles sharing a vertex with the meshlet, and those already having all their vertices in it
+  auto candidates = std::vector<std::uint32_t>{};
+  auto is_candidate = std::vector<bool>(triangle_count);
+  auto ready = std::vector<std::uint32_t>{};
+  auto centroid_sum = glm::vec3{ 0.0F };
+
+  auto new_vertex_count = [&](std::uint32_t triangle) {
+    auto count = 0UZ;
+    for (auto corner = 0UZ; corner < 3; ++corner) {
+      count += local_vertex[indices[triangle * 3 + corner]] == no_vertex ? 1UZ : 0UZ;
+    }
+    return count;
+  };
+  auto triangle_centroid = [&](std::uint32_t triangle) {
+    return (vertices[indices[triangle * 3]].position + vertices[indices[triangle * 3 + 1]].position
+            + vertices[indices[triangle * 3 + 2]].position) / 3.0F;
+  };
+  auto add_triangle = [&](std::uint32_t triangle) {
+    used[triangle] = true;
+    meshlet_triangles.push_back(triangle);
+    centroid_sum += triangle_centroid(triangle);
+    for (auto corner = 0UZ; corner < 3; ++corner) {
+      auto vertex = indices[triangle * 3 + corner];
+      if (local_vertex[vertex] != no_vertex) continue;
+      local_vertex[vertex] = static_cast<std::uint32_t>(meshlet_vertices.size());
+      meshlet_vertices.push_back(vertex);
+      for (auto i = first_triangle[vertex]; i < first_triangle[vertex + 1]; ++i) {
+        auto neighbor = vertex_triangles[i];
+        if (used[neighbor]) continue;
+        if (new_vertex_count(neighbor) == 0) {
+          ready.push_back(neighbor);
+        }
+        else if (!is_candidate[neighbor]) {
+          is_candidate[neighbor] = true;
+          candidates.push_back(neighbor);
+        }
+      }
+    }
+  };
+
+  auto output_vertices = std::vector<Vertex>{};
+  auto output_indices = std::vector<std::uint32_t>{};
+  output_indices.reserve(indices.size());
+  auto meshlets = std::vector<Meshlet>{};
+  auto flush_meshlet = [&] {
+    auto meshlet = Meshlet{};
+    meshlet.first_vertex = static_cast<std::uint32_t>(output_vertices.size());
+    meshlet.vertex_count = static_cast<std::uint32_t>(meshlet_vertices.size());
+    meshlet.first_index = static_cast<std::uint32_t>(output_indices.size());
+    meshlet.index_count = static_cast<std::uint32_t>(meshlet_triangles.size() * 3);
+    for (auto vertex : meshlet_vertices) {
+      output_vertices.push_back(vertices[vertex]);
+    }
+    for (auto triangle : meshlet_triangles) {
+      for (auto corner = 0UZ; corner < 3; ++corner) {
+        output_indices.push_back(meshlet.first_vertex + local_vertex[indices[triangle * 3 + corner]]);
+      }
+    }
+    for (auto vertex : meshlet_vertices) {
+      local_vertex[vertex] = no_vertex;
+    }
+    meshlets.push_back(meshlet);
+    meshlet_vertices.clear();
+    meshlet_triangles.clear();
+    for (auto triangle : candidates) {
+      is_candidate[triangle] = false;
+    }
+    candidates.clear();
+    ready.clear();
+    centroid_sum = glm::vec3{ 0.0F };
+  };
+
+  // Triangles are taken in file order when the meshlet has no neighbor left, since
+  // consecutive faces are usually close to each other
+  auto next_unused = 0UZ;
+  while (true) {
+    while (next_unused < triangle_count && used[next_unused]) ++next_unused;
+    if (next_unused == triangle_count) break;
+    if (meshlet_triangles.size() == g_meshlet_max_triangles || meshlet_vertices.size() + new_vertex_count(static_cast<std::uint32_t>(next_unused)) > g_meshlet_max_vertices) {
+      flush_meshlet();
+    }
+    add_triangle(static_cast<std::uint32_t>(next_unused));
+
+    // Grow through the neighbors adding no vertex first, then through the nearest one adding
+    // the fewest. Scanning the candidates happens at most once per added vertex
+    while (meshlet_triangles.size() < g_meshlet_max_triangles) {
+      if (!ready.empty()) {
+        auto triangle = ready.back();
+        ready.pop_back();
+        if (!used[triangle]) add_triangle(triangle);
+        continue;
+      }
+      auto centroid = centroid_sum / static_cast<float>(meshlet_triangles.size());
+      auto best = no_triangle;
+      auto best_new_vertices = 4UZ;
+      auto best_distance = 0.0F;
+      std::erase_if(candidates, [&](std::uint32_t triangle) { return used[triangle]; });
+      for (auto triangle : candidates) {
+        auto new_vertices = new_vertex_count(triangle);
+        if (meshlet_vertices.size() + new_vertices > g_meshlet_max_vertices) continue;
+        auto offset = triangle_centroid(triangle) - centroid;
+        auto distance = glm::dot(offset, offset);
+        if (new_vertices < best_new_vertices || (new_vertices == best_new_vertices && distance < best_distance)) {
+          best = triangle;
+          best_new_vertices = new_vertices;
+          best_distance = distance;
+        }
+      }
+      if (best == no_triangle) break;
+      add_triangle(best);
+    }
+  }
+  if (!meshlet_triangles.empty()) flush_meshlet();
+
+  vertices = std::move(output_vertices);
+  indices = std::move(output_indices);
+  for (auto& meshlet : meshlets) {
+    compute_meshlet_bounds(meshlet, vertices, indices);
+  }
+  return meshlets;
+}
+
+auto make_mesh(std::shared_ptr<const Texture> texture, std::vector<Vertex> vertices, std::vector<std::uint32_t> indices) -> Mesh
+{
+  auto meshlets = build_meshlets(vertices, indices);
+  auto position_streams = std::vector<float>(vertices.size() * 3);
+  for (auto vertex = 0UZ; vertex < vertices.size(); ++vertex) {
+    position_streams[vertex] = vertices[vertex].position.x;
+    position_streams[vertices.size() + vertex] = vertices[vertex].position.y;
+    position_streams[vertices.size() * 2 + vertex] = vertices[vertex].position.z;
+  }
+  return Mesh{ std::move(texture), std::move(vertices), std::move(indices), std::move(meshlets), std::move(position_streams) };
+}
+
+// A face is back facing when the camera is behind its plane: dot(normal, point - camera) > 0.
+// Over every normal of the cone and every point of the sphere, the smallest value of that dot
+// product is distance * cos(angle to the axis + half angle of the cone) - radius
+auto is_meshlet_backfacing(const Meshlet& meshlet, const glm::vec3& camera_position, bool mirrored) -> bool
+{
+  if (meshlet.cone_cutoff <= 0.0F) return false;
+  auto offset = meshlet.center - camera_position;
+  auto distance = glm::length(offset);
+  if (distance <= meshlet.radius) return false;
+  auto axis = mirrored ? -meshlet.cone_axis : meshlet.cone_axis;
+  auto cos_angle = glm::dot(offset, axis) / distance;
+  auto sin_angle = std::sqrt(std::max(1.0F - cos_angle * cos_angle, 0.0F));
+  auto sin_cutoff = std::sqrt(std::max(1.0F - meshlet.cone_cutoff * meshlet.cone_cutoff, 0.0F));
+  return cos_angle * meshlet.cone_cutoff - sin_angle * sin_cutoff > meshlet.radius / distance;
+}
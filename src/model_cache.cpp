@@ -0,0 +1,358 @@
+#include "model_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "mapped_file.hpp"
+
+// File layout: the header, then the dependency, texture, level of detail and mesh records, then the
+// data they point to (dependency paths, texels, vertices, indices, meshlets and position streams). Offsets are from the
+// start of the file. The model meshes come first in the mesh records, followed by those of each level of detail
+constexpr auto g_cache_magic = std::array<char, 8>{ '3', 'D', 'F', 'S', 'M', 'O', 'D', 'L' };
+// bumped whenever the layout of the file, a Vertex, a Meshlet or the texels changes
+constexpr auto g_cache_version = std::uint32_t{ 5 };
+// written as a number and compared as one, so caches from a platform of the other endianness are ignored
+constexpr auto g_cache_byte_order = std::uint32_t{ 0x01020304 };
+// every array starts on its own cache line
+constexpr auto g_cache_alignment = 64UZ;
+
+struct CacheHeader {
+  std::array<char, 8> magic{};
+  std::uint32_t version{};
+  std::uint32_t byte_order{};
+  std::uint32_t vertex_size{};
+  std::uint32_t meshlet_size{};
+  std::uint32_t texture_tile_size{};
+  std::uint32_t padding{};
+  // bounding sphere of the model
+  std::array<float, 3> center{};
+  float radius{};
+  std::uint64_t dependency_count{};
+  std::uint64_t texture_count{};
+  std::uint64_t lod_count{};
+  // meshes of the model and of all its levels of detail
+  std::uint64_t mesh_count{};
+};
+
+struct CacheDependency {
+  std::uint64_t size{};
+  std::int64_t modified_time{};
+  // path relative to the cache directory
+  std::uint64_t path_offset{};
+  std::uint64_t path_length{};
+};
+
+// Level 0 size, format and the texels of the whole mip chain, as Texture::texel_buffer() lays them out
+struct CacheTexture {
+  std::uint64_t width{};
+  std::uint64_t height{};
+  std::uint32_t format{};
+  std::uint32_t padding{};
+  std::uint64_t texel_offset{};
+  // 32 bit words, which hold a block of texels in the compressed formats
+  std::uint64_t texel_count{};
+};
+
+struct CacheLod {
+  std::uint64_t mesh_count{};
+  float error{};
+  std::uint32_t padding{};
+};
+
+struct CacheMesh {
+  std::uint64_t texture{};
+  std::uint64_t vertex_offset{};
+  std::uint64_t vertex_count{};
+  std::uint64_t index_offset{};
+  std::uint64_t index_count{};
+  std::uint64_t meshlet_offset{};
+  std::uint64_t meshlet_count{};
+  // Mesh::position_streams, 3 floats per vertex
+  std::uint64_t position_offset{};
+};
+
+struct FileStamp {
+  std::uint64_t size{};
+  std::int64_t modified_time{};
+};
+
+auto get_file_stamp(const std::filesystem::path& path) -> std::optional<FileStamp>
+{
+  auto error = std::error_code{};
+  auto size = std::filesystem::file_size(path, error);
+  if (error) return {};
+  auto modified_time = std::filesystem::last_write_time(path, error);
+  if (error) return {};
+  return FileStamp{ size, static_cast<std::int64_t>(modified_time.time_since_epoch().count()) };
+}
+
+// Array of count T at offset of the file, or nullptr when it doesn't fit in the file
+template <typename T>
+auto get_cache_array(std::string_view file, std::uint64_t offset, std::uint64_t count) -> const T*
+{
+  if (offset > file.size() || count > (file.size() - offset) / sizeof(T)) return nullptr;
+  const auto* data = file.data() + offset;
+  if (reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0) return nullptr;
+  return reinterpret_cast<const T*>(data);
+}
+
+auto get_model_cache_path(const std::string& obj_path) -> std::string
+{
+  return obj_path + ".cache";
+}
+
+auto load_model_cache(const std::string& cache_path) -> std::optional<Model>
+{
+  auto mapped_file = MappedFile::open(cache_path);
+  if (!mapped_file) return {};
+  // shared by the meshes and textures pointing into it
+  auto owner = std::shared_ptr<const MappedFile>{ std::make_shared<MappedFile>(std::move(*mapped_file)) };
+  auto file = owner->view();
+  auto invalid = [&] {
+    std::cerr << "Ignoring the invalid model cache " << cache_path << '\n';
+    return std::optional<Model>{};
+  };
+
+  const auto* header = get_cache_array<CacheHeader>(file, 0, 1);
+  if (header == nullptr
+      || header->magic != g_cache_magic
+      || header->version != g_cache_version
+      || header->byte_order != g_cache_byte_order
+      || header->vertex_size != sizeof(Vertex)
+      || header->meshlet_size != sizeof(Meshlet)
+      || header->texture_tile_size != Texture::tile_size) {
+    return {};
+  }
+  auto offset = std::uint64_t{ sizeof(CacheHeader) };
+  const auto* dependencies = get_cache_array<CacheDependency>(file, offset, header->dependency_count);
+  if (dependencies == nullptr) return invalid();
+  offset += header->dependency_count * sizeof(CacheDependency);
+  const auto* textures = get_cache_array<CacheTexture>(file, offset, header->texture_count);
+  if (textures == nullptr) return invalid();
+  offset += header->texture_count * sizeof(CacheTexture);
+  const auto* lods = get_cache_array<CacheLod>(file, offset, header->lod_count);
+  if (lods == nullptr) return invalid();
+  offset += header->lod_count * sizeof(CacheLod);
+  const auto* meshes = get_cache_array<CacheMesh>(file, offset, header->mesh_count);
+  if (meshes == nullptr) return invalid();
+  // the model itself has at least one mesh
+  auto model_mesh_count = header->mesh_count;
+  for (auto i = 0UZ; i < header->lod_count; ++i) {
+    if (lods[i].mesh_count >= model_mesh_count) return invalid();
+    model_mesh_count -= lods[i].mesh_count;
+  }
+  if (model_mesh_count == 0) return invalid();
+
+  // A source file that changed makes the cache stale, which is not an error
+  auto directory = std::filesystem::path{ cache_path }.parent_path();
+  for (auto i = 0UZ; i < header->dependency_count; ++i) {
+    const auto& dependency = dependencies[i];
+    const auto* path = get_cache_array<char>(file, dependency.path_offset, dependency.path_length);
+    if (path == nullptr) return invalid();
+    auto stamp = get_file_stamp(directory / std::string_view{ path, dependency.path_length });
+    if (!stamp || stamp->size != dependency.size || stamp->modified_time != dependency.modified_time) return {};
+  }
+
+  auto output_textures = std::vector<std::shared_ptr<const Texture>>{};
+  output_textures.reserve(header->texture_count);
+  for (auto i = 0UZ; i < header->texture_count; ++i) {
+    const auto& texture = textures[i];
+    const auto* texels = get_cache_array<std::uint32_t>(file, texture.texel_offset, texture.texel_count);
+    if (texels == nullptr || texture.format > static_cast<std::uint32_t>(TextureFormat::bc3)) return invalid();
+    // the mip chain holds at least width * height texels, which bounds both sizes
+    auto format = static_cast<TextureFormat>(texture.format);
+    auto texel_capacity = texture.texel_count / Texture::tile_word_count(format) * Texture::tile_size * Texture::tile_size;
+    if (texture.width == 0 || texture.width > texel_capacity || texture.height > texel_capacity / texture.width) {
+      return invalid();
+    }
+    try {
+      output_textures.push_back(std::make_shared<const Texture>(Texture::from_texels(
+        Buffer<std::uint32_t>{ owner, texels, texture.texel_count },
+        texture.width,
+        texture.height,
+        format)));
+    }
+    catch (const std::invalid_argument&) {
+      return invalid();
+    }
+  }
+
+  auto load_mesh = [&](const CacheMesh& mesh) -> std::optional<Mesh> {
+    const auto* vertices = get_cache_array<Vertex>(file, mesh.vertex_offset, mesh.vertex_count);
+    const auto* indices = get_cache_array<std::uint32_t>(file, mesh.index_offset, mesh.index_count);
+    const auto* meshlets = get_cache_array<Meshlet>(file, mesh.meshlet_offset, mesh.meshlet_count);
+    const auto* position_streams = get_cache_array<float>(file, mesh.position_offset, mesh.vertex_count * 3);
+    if (vertices == nullptr || indices == nullptr || meshlets == nullptr || position_streams == nullptr || mesh.texture >= output_textures.size()
+        || mesh.index_count % 3 != 0
+        || std::any_of(indices, indices + mesh.index_count, [&](std::uint32_t index) { return index >= mesh.vertex_count; })) {
+      return {};
+    }
+    // the renderer only transforms the vertices of a meshlet for its faces
+    auto is_valid_meshlet = [&](const Meshlet& meshlet) {
+      auto vertex_end = std::uint64_t{ meshlet.first_vertex } + meshlet.vertex_count;
+      auto index_end = std::uint64_t{ meshlet.first_index } + meshlet.index_count;
+      return vertex_end <= mesh.vertex_count && index_end <= mesh.index_count && meshlet.index_count % 3 == 0
+             && std::all_of(indices + meshlet.first_index, indices + index_end, [&](std::uint32_t index) {
+                  return index >= meshlet.first_vertex && index < vertex_end;
+                });
+    };
+    if (!std::all_of(meshlets, meshlets + mesh.meshlet_count, is_valid_meshlet)) return {};
+    return Mesh{
+      output_textures[mesh.texture],
+      Buffer<Vertex>{ owner, vertices, mesh.vertex_count },
+      Buffer<std::uint32_t>{ owner, indices, mesh.index_count },
+      Buffer<Meshlet>{ owner, meshlets, mesh.meshlet_count },
+      Buffer<float>{ owner, position_streams, mesh.vertex_count * 3 } };
+  };
+
+  auto output = Model{};
+  output.center = glm::vec3{ header->center[0], header->center[1], header->center[2] };
+  output.radius = header->radius;
+  output.lods.resize(header->lod_count);
+  auto next_mesh = 0UZ;
+  for (auto level = 0UZ; level <= header->lod_count; ++level) {
+    auto& level_meshes = level == 0 ? output.meshes : output.lods[level - 1].meshes;
+    auto mesh_count = level == 0 ? model_mesh_count : lods[level - 1].mesh_count;
+    if (level > 0) output.lods[level - 1].error = lods[level - 1].error;
+    for (auto i = 0UZ; i < mesh_count; ++i) {
+      auto mesh = load_mesh(meshes[next_mesh++]);
+      if (!mesh) return invalid();
+      level_meshes.push_back(std::move(*mesh));
+    }
+  }
+  return output;
+}
+
+auto save_model_cache(const std::string& cache_path, const std::vector<std::string>& dependencies, const Model& model) -> bool
+{
+  // Pieces of the file, in the order they are written
+  struct Block {
+    std::uint64_t offset{};
+    const void* data{};
+    std::size_t size{};
+  };
+  auto blocks = std::vector<Block>{};
+  auto file_size = std::uint64_t{};
+  auto add_block = [&](const void* data, std::size_t size, std::size_t alignment) {
+    auto offset = (file_size + alignment - 1) / alignment * alignment;
+    blocks.push_back(Block{ offset, data, size });
+    file_size = offset + size;
+    return offset;
+  };
+
+  auto all_meshes = std::vector<const Mesh*>{};
+  for (auto level = 0UZ; level < model.level_count(); ++level) {
+    for (const auto& mesh : model.level_meshes(level)) all_meshes.push_back(&mesh);
+  }
+  // meshes sharing a texture share its record
+  auto texture_indices = std::map<const Texture*, std::uint64_t>{};
+  auto textures = std::vector<const Texture*>{};
+  for (const auto* mesh : all_meshes) {
+    if (texture_indices.emplace(mesh->texture.get(), textures.size()).second) {
+      textures.push_back(mesh->texture.get());
+    }
+  }
+
+  auto header = CacheHeader{
+    g_cache_magic,
+    g_cache_version,
+    g_cache_byte_order,
+    sizeof(Vertex),
+    sizeof(Meshlet),
+    Texture::tile_size,
+    0,
+    { model.center.x, model.center.y, model.center.z },
+    model.radius,
+    dependencies.size(),
+    textures.size(),
+    model.lods.size(),
+    all_meshes.size()
+  };
+  auto dependency_records = std::vector<CacheDependency>(dependencies.size());
+  auto texture_records = std::vector<CacheTexture>(textures.size());
+  auto lod_records = std::vector<CacheLod>(model.lods.size());
+  for (auto i = 0UZ; i < model.lods.size(); ++i) {
+    lod_records[i] = CacheLod{ model.lods[i].meshes.size(), model.lods[i].error };
+  }
+  auto mesh_records = std::vector<CacheMesh>(all_meshes.size());
+  add_block(&header, sizeof(header), alignof(CacheHeader));
+  add_block(dependency_records.data(), dependency_records.size() * sizeof(CacheDependency), alignof(CacheDependency));
+  add_block(texture_records.data(), texture_records.size() * sizeof(CacheTexture), alignof(CacheTexture));
+  add_block(lod_records.data(), lod_records.size() * sizeof(CacheLod), alignof(CacheLod));
+  add_block(mesh_records.data(), mesh_records.size() * sizeof(CacheMesh), alignof(CacheMesh));
+
+  auto directory = std::filesystem::path{ cache_path }.parent_path();
+  auto dependency_paths = std::vector<std::string>(dependencies.size());
+  for (auto i = 0UZ; i < dependencies.size(); ++i) {
+    auto stamp = get_file_stamp(dependencies[i]);
+    if (!stamp) {
+      std::cerr << "Could not read the modification time of " << dependencies[i] << '\n';
+      return false;
+    }
+    auto path = std::filesystem::path{ dependencies[i] };
+    auto relative_path = directory.empty() ? path : path.lexically_relative(directory);
+    dependency_paths[i] = (relative_path.empty() ? std::filesystem::absolute(path) : relative_path).generic_string();
+    auto path_offset = add_block(dependency_paths[i].data(), dependency_paths[i].size(), 1);
+    dependency_records[i] = CacheDependency{ stamp->size, stamp->modified_time, path_offset, dependency_paths[i].size() };
+  }
+  for (auto i = 0UZ; i < textures.size(); ++i) {
+    const auto& texels = textures[i]->texel_buffer();
+    auto texel_offset = add_block(texels.data(), texels.size() * sizeof(std::uint32_t), g_cache_alignment);
+    texture_records[i] = CacheTexture{
+      textures[i]->width(),
+      textures[i]->height(),
+      static_cast<std::uint32_t>(textures[i]->format()),
+      0,
+      texel_offset,
+      texels.size()
+    };
+  }
+  for (auto i = 0UZ; i < all_meshes.size(); ++i) {
+    const auto& mesh = *all_meshes[i];
+    auto vertex_offset = add_block(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex), g_cache_alignment);
+    auto index_offset = add_block(mesh.indices.data(), mesh.indices.size() * sizeof(std::uint32_t), g_cache_alignment);
+    auto meshlet_offset = add_block(mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet), g_cache_alignment);
+    auto position_offset = add_block(mesh.position_streams.data(), mesh.position_streams.size() * sizeof(float), g_cache_alignment);
+    mesh_records[i] = CacheMesh{
+      texture_indices.at(mesh.texture.get()),
+      vertex_offset,
+      mesh.vertices.size(),
+      index_offset,
+      mesh.indices.size(),
+      meshlet_offset,
+      mesh.meshlets.size(),
+      position_offset
+    };
+  }
+
+  // Written aside and renamed over the cache, so readers never see half a file
+  auto temporary_path = cache_path + ".tmp" + std::to_string(std::random_device{}());
+  auto stream = std::ofstream{ temporary_path, std::ios::binary };
+  constexpr auto padding = std::array<char, g_cache_alignment>{};
+  auto position = std::uint64_t{};
+  for (const auto& block : blocks) {
+    stream.write(padding.data(), static_cast<std::streamsize>(block.offset - position));
+    stream.write(static_cast<const char*>(block.data), static_cast<std::streamsize>(block.size));
+    position = block.offset + block.size;
+  }
+  stream.close();
+  auto error = std::error_code{};
+  if (stream) std::filesystem::rename(temporary_path, cache_path, error);
+  if (!stream || error) {
+    std::cerr << "Could not write the model cache " << cache_path << '\n';
+    std::filesystem::remove(temporary_path, error);
+    return false;
+  }
+  return true;
+}
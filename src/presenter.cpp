@@ -0,0 +1,86 @@
+#include "presenter.hpp"
+#include "profiler.hpp"
+#include "timer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+Presenter::Presenter(sf::RenderWindow& window, std::size_t width, std::size_t height, std::size_t max_frames_in_flight)
+  : m_window{ window },
+    m_max_frames_in_flight{ std::max(max_frames_in_flight, 1UZ) },
+    m_frames(m_max_frames_in_flight)
+{
+  if (!m_texture.create(static_cast<unsigned>(width), static_cast<unsigned>(height))) {
+    throw std::runtime_error{ "Could not create the presentation texture" };
+  }
+  m_sprite.setTexture(m_texture);
+  // a context can only be active on one thread at a time
+  m_window.setActive(false);
+  m_thread = std::thread{ [this] { present_loop(); } };
+}
+
+Presenter::~Presenter()
+{
+  stop();
+}
+
+void Presenter::present(const std::uint32_t* colors)
+{
+  {
+    auto lock = std::unique_lock{ m_mutex };
+    m_displayed.wait(lock, [this] { return m_frame_count < m_max_frames_in_flight; });
+    m_frames[(m_first_frame + m_frame_count) % m_frames.size()] = colors;
+    ++m_frame_count;
+  }
+  m_queued.notify_one();
+}
+
+void Presenter::stop()
+{
+  if (!m_thread.joinable()) return;
+  {
+    auto lock = std::scoped_lock{ m_mutex };
+    m_stop = true;
+  }
+  m_queued.notify_one();
+  m_thread.join();
+  m_window.setActive(true);
+}
+
+auto Presenter::present_time() const -> double
+{
+  auto lock = std::scoped_lock{ m_mutex };
+  return m_present_time;
+}
+
+void Presenter::present_loop()
+{
+  m_window.setActive(true);
+  while (true) {
+    const std::uint32_t* colors{};
+    {
+      auto lock = std::unique_lock{ m_mutex };
+      m_queued.wait(lock, [this] { return m_stop || m_frame_count > 0; });
+      // queued frames are still displayed after stop
+      if (m_frame_count == 0) break;
+      colors = m_frames[m_first_frame];
+    }
+
+    auto timer = Timer{};
+    {
+      PROFILE_ZONE("present");
+      m_texture.update(reinterpret_cast<const std::uint8_t*>(colors));
+      m_window.draw(m_sprite);
+      m_window.display();
+    }
+
+    {
+      auto lock = std::scoped_lock{ m_mutex };
+      m_first_frame = (m_first_frame + 1) % m_frames.size();
+      --m_frame_count;
+      m_present_time = timer.elapsed();
+    }
+    m_displayed.notify_one();
+  }
+  m_window.setActive(false);
+}
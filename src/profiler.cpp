@@ -0,0 +1,185 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+// Times are in nanoseconds since the program started
+struct ZoneEvent {
+  const char* name{};
+  std::int64_t begin{};
+  std::int64_t duration{};
+};
+
+struct CounterEvent {
+  const char* name{};
+  std::int64_t time{};
+  double value{};
+};
+
+// Events recorded by one thread. Its mutex is only contended while a frame ends or the trace is written
+struct ThreadEvents {
+  std::mutex mutex{};
+  std::size_t thread_index{};
+  std::vector<ZoneEvent> zones{};
+  std::vector<CounterEvent> counters{};
+  // first events of the current frame
+  std::size_t frame_zone_begin{};
+  std::size_t frame_counter_begin{};
+};
+
+// Past this many events a thread keeps summarizing frames but stops adding them to the trace
+constexpr auto g_max_trace_events = 1UZ << 20;
+
+const auto g_profiler_start = Profiler::Clock::now();
+
+struct ProfilerState {
+  std::mutex mutex{};
+  std::vector<std::unique_ptr<ThreadEvents>> threads{};
+  std::string summary{};
+};
+
+auto get_profiler_state() -> ProfilerState&
+{
+  // never destroyed, so threads outliving main can still record
+  static auto* s_state = new ProfilerState{};
+  return *s_state;
+}
+
+auto get_thread_events() -> ThreadEvents&
+{
+  thread_local auto* t_events = [] {
+    auto& state = get_profiler_state();
+    auto lock = std::scoped_lock{ state.mutex };
+    state.threads.push_back(std::make_unique<ThreadEvents>());
+    state.threads.back()->thread_index = state.threads.size() - 1;
+    return state.threads.back().get();
+  }();
+  return *t_events;
+}
+
+auto to_nanoseconds(Profiler::Clock::time_point time) -> std::int64_t
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time - g_profiler_start).count();
+}
+
+void Profiler::add_zone(const char* name, Clock::time_point begin, Clock::time_point end)
+{
+  auto& events = get_thread_events();
+  auto lock = std::scoped_lock{ events.mutex };
+  events.zones.push_back(ZoneEvent{ name, to_nanoseconds(begin), std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() });
+}
+
+void Profiler::add_counter(const char* name, double value)
+{
+  auto& events = get_thread_events();
+  auto lock = std::scoped_lock{ events.mutex };
+  events.counters.push_back(CounterEvent{ name, to_nanoseconds(Clock::now()), value });
+}
+
+void Profiler::end_frame()
+{
+  struct ZoneTotal {
+    std::int64_t duration{};
+    std::size_t count{};
+  };
+  auto zone_totals = std::map<std::string_view, ZoneTotal>{};
+  auto counters = std::map<std::string_view, double>{};
+
+  auto& state = get_profiler_state();
+  auto lock = std::scoped_lock{ state.mutex };
+  for (auto& thread : state.threads) {
+    auto thread_lock = std::scoped_lock{ thread->mutex };
+    for (auto i = thread->frame_zone_begin; i < thread->zones.size(); ++i) {
+      auto& total = zone_totals[thread->zones[i].name];
+      total.duration += thread->zones[i].duration;
+      ++total.count;
+    }
+    for (auto i = thread->frame_counter_begin; i < thread->counters.size(); ++i) {
+      counters[thread->counters[i].name] = thread->counters[i].value;
+    }
+    if (thread->zones.size() > g_max_trace_events) thread->zones.resize(thread->frame_zone_begin);
+    if (thread->counters.size() > g_max_trace_events) thread->counters.resize(thread->frame_counter_begin);
+    thread->frame_zone_begin = thread->zones.size();
+    thread->frame_counter_begin = thread->counters.size();
+  }
+
+  // slowest zones first
+  auto zones = std::vector<std::pair<std::string_view, ZoneTotal>>(zone_totals.begin(), zone_totals.end());
+  std::ranges::stable_sort(zones, [](const auto& a, const auto& b) { return a.second.duration > b.second.duration; });
+  auto stream = std::ostringstream{};
+  stream << std::fixed << std::setprecision(3);
+  for (const auto& [name, total] : zones) {
+    stream << std::left << std::setw(28) << name << std::right << std::setw(10)
+           << static_cast<double>(total.duration) / 1e6 << " ms  x" << total.count << '\n';
+  }
+  stream << std::setprecision(0);
+  for (const auto& [name, value] : counters) {
+    stream << std::left << std::setw(28) << name << std::right << std::setw(10) << value << '\n';
+  }
+  state.summary = stream.str();
+}
+
+auto Profiler::summary() -> std::string
+{
+  auto& state = get_profiler_state();
+  auto lock = std::scoped_lock{ state.mutex };
+  return state.summary;
+}
+
+void write_json_string(std::ostream& stream, std::string_view text)
+{
+  stream << '"';
+  for (auto character : text) {
+    if (character == '"' || character == '\\') stream << '\\';
+    stream << character;
+  }
+  stream << '"';
+}
+
+auto Profiler::write_trace(const std::string& path) -> bool
+{
+  auto stream = std::ofstream{ path };
+  if (!stream) return false;
+  stream << std::fixed << std::setprecision(3);
+  stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  auto first = true;
+  auto separator = [&]() -> std::ostream& {
+    stream << (first ? "\n" : ",\n");
+    first = false;
+    return stream;
+  };
+
+  auto& state = get_profiler_state();
+  auto lock = std::scoped_lock{ state.mutex };
+  for (auto& thread : state.threads) {
+    auto thread_lock = std::scoped_lock{ thread->mutex };
+    auto tid = thread->thread_index;
+    separator() << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << tid
+                << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+    // timestamps are in microseconds
+    for (const auto& zone : thread->zones) {
+      separator() << "{\"ph\":\"X\",\"name\":";
+      write_json_string(stream, zone.name);
+      stream << ",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << static_cast<double>(zone.begin) / 1e3
+             << ",\"dur\":" << static_cast<double>(zone.duration) / 1e3 << '}';
+    }
+    for (const auto& counter : thread->counters) {
+      separator() << "{\"ph\":\"C\",\"name\":";
+      write_json_string(stream, counter.name);
+      stream << ",\"pid\":1,\"ts\":" << static_cast<double>(counter.time) / 1e3
+             << ",\"args\":{\"value\":" << counter.value << "}}";
+    }
+  }
+  stream << "\n]}\n";
+  stream.close();
+  return static_cast<bool>(stream);
+}
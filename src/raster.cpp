@@ -0,0 +1,293 @@
+#include "raster.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+auto detect_simd_level() -> SimdLevel
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SimdLevel::avx2;
+  if (__builtin_cpu_supports("sse4.1")) return SimdLevel::sse41;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4]{};
+  __cpuid(info, 0);
+  auto max_leaf = info[0];
+  __cpuid(info, 1);
+  auto has_sse41 = (info[2] & (1 << 19)) != 0;
+  auto has_osxsave = (info[2] & (1 << 27)) != 0;
+  if (max_leaf >= 7 && has_osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+    __cpuidex(info, 7, 0);
+    if ((info[1] & (1 << 5)) != 0) return SimdLevel::avx2;
+  }
+  if (has_sse41) return SimdLevel::sse41;
+#endif
+  return SimdLevel::scalar;
+}
+
+auto find_edge_bound(std::int64_t w, std::int64_t xinc, int count) -> int
+{
+  if (xinc > 0) return w >= 0 ? 0 : static_cast<int>(std::min((-w + xinc - 1) / xinc, std::int64_t{ count }));
+  if (xinc < 0) return w < 0 ? 0 : static_cast<int>(std::min(w / -xinc + 1, std::int64_t{ count }));
+  return w >= 0 ? 0 : count;
+}
+
+// Moves bound until the pixels passing the edge test are those from bound on, or before it when
+// xinc is negative
+void step_edge_bound(std::int64_t w, std::int64_t xinc, int count, int& bound)
+{
+  auto passes = [&](int x) { return w + x * xinc >= 0; };
+  if (xinc > 0) {
+    while (bound > 0 && passes(bound - 1)) --bound;
+    while (bound < count && !passes(bound)) ++bound;
+  }
+  else if (xinc < 0) {
+    while (bound < count && passes(bound)) ++bound;
+    while (bound > 0 && !passes(bound - 1)) --bound;
+  }
+  else {
+    bound = w >= 0 ? 0 : count;
+  }
+}
+
+auto find_edge_bounds(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count) -> EdgeBounds
+{
+  return EdgeBounds{
+    find_edge_bound(wa, triangle.wa_xinc, count),
+    find_edge_bound(wb, triangle.wb_xinc, count),
+    find_edge_bound(wc, triangle.wc_xinc, count)
+  };
+}
+
+auto step_row_span(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, EdgeBounds& bounds) -> RowSpan
+{
+  auto values = std::array{ wa, wb, wc };
+  auto xincs = std::array{ triangle.wa_xinc, triangle.wb_xinc, triangle.wc_xinc };
+  auto span = RowSpan{ 0, count - 1 };
+  for (auto edge = 0UZ; edge < bounds.size(); ++edge) {
+    step_edge_bound(values[edge], xincs[edge], count, bounds[edge]);
+    if (xincs[edge] < 0) span.last = std::min(span.last, bounds[edge] - 1);
+    else span.first = std::max(span.first, bounds[edge]);
+  }
+  return span;
+}
+
+auto get_row_rasterizers(SimdLevel level) -> const PipelineKernels<RowRasterizer>&
+{
+  switch (level) {
+    case SimdLevel::avx2:
+      return get_row_rasterizers_avx2();
+    case SimdLevel::sse41:
+      return get_row_rasterizers_sse41();
+    default:
+      return get_row_rasterizers_scalar();
+  }
+}
+
+template <PipelineState state>
+auto rasterize_row_scalar(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* colors) -> int
+{
+  auto written = 0;
+  for (auto x = 0; x < count; ++x) {
+    if (wa >= 0 && wb >= 0 && wc >= 0) {
+      auto alpha = static_cast<float>(wa) * triangle.inv_area;
+      auto beta = static_cast<float>(wb) * triangle.inv_area;
+      auto gama = static_cast<float>(wc) * triangle.inv_area;
+
+      auto z = alpha * triangle.z_a + beta * triangle.z_b + gama * triangle.z_c;
+      if (z < depth[x]) {
+        depth[x] = z;
+        auto w = 1.0F / (alpha * triangle.inv_w_a + beta * triangle.inv_w_b + gama * triangle.inv_w_c);
+        auto tcoord = w * (alpha * triangle.tcoord_a + beta * triangle.tcoord_b + gama * triangle.tcoord_c);
+        colors[x] = sample_texture<state>(triangle, tcoord.x, tcoord.y);
+        ++written;
+      }
+    }
+    wa += triangle.wa_xinc;
+    wb += triangle.wb_xinc;
+    wc += triangle.wc_xinc;
+  }
+  return written;
+}
+
+auto get_row_rasterizers_scalar() -> const PipelineKernels<RowRasterizer>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<RowRasterizer>([]<PipelineState state>() { return &rasterize_row_scalar<state>; });
+  return kernels;
+}
+
+auto get_visibility_row_rasterizer(SimdLevel level) -> VisibilityRowRasterizer
+{
+  switch (level) {
+    case SimdLevel::avx2:
+      return rasterize_visibility_row_avx2;
+    case SimdLevel::sse41:
+      return rasterize_visibility_row_sse41;
+    default:
+      return rasterize_visibility_row_scalar;
+  }
+}
+
+auto rasterize_visibility_row_scalar(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int
+{
+  auto written = 0;
+  for (auto x = 0; x < count; ++x) {
+    if (wa >= 0 && wb >= 0 && wc >= 0) {
+      auto alpha = static_cast<float>(wa) * triangle.inv_area;
+      auto beta = static_cast<float>(wb) * triangle.inv_area;
+      auto gama = static_cast<float>(wc) * triangle.inv_area;
+
+      auto z = alpha * triangle.z_a + beta * triangle.z_b + gama * triangle.z_c;
+      if (z < depth[x]) {
+        depth[x] = z;
+        ids[x] = id;
+        ++written;
+      }
+    }
+    wa += triangle.wa_xinc;
+    wb += triangle.wb_xinc;
+    wc += triangle.wc_xinc;
+  }
+  return written;
+}
+
+auto get_row_shaders(SimdLevel level) -> const PipelineKernels<RowShader>&
+{
+  switch (level) {
+    case SimdLevel::avx2:
+      return get_row_shaders_avx2();
+    case SimdLevel::sse41:
+      return get_row_shaders_sse41();
+    default:
+      return get_row_shaders_scalar();
+  }
+}
+
+template <PipelineState state>
+void shade_row_scalar(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, std::uint32_t* colors)
+{
+  for (auto x = 0; x < count; ++x) {
+    auto alpha = static_cast<float>(wa) * triangle.inv_area;
+    auto beta = static_cast<float>(wb) * triangle.inv_area;
+    auto gama = static_cast<float>(wc) * triangle.inv_area;
+    auto w = 1.0F / (alpha * triangle.inv_w_a + beta * triangle.inv_w_b + gama * triangle.inv_w_c);
+    auto tcoord = w * (alpha * triangle.tcoord_a + beta * triangle.tcoord_b + gama * triangle.tcoord_c);
+    colors[x] = sample_texture<state>(triangle, tcoord.x, tcoord.y);
+    wa += triangle.wa_xinc;
+    wb += triangle.wb_xinc;
+    wc += triangle.wc_xinc;
+  }
+}
+
+auto get_row_shaders_scalar() -> const PipelineKernels<RowShader>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<RowShader>([]<PipelineState state>() { return &shade_row_scalar<state>; });
+  return kernels;
+}
+
+auto get_msaa_row_rasterizers(SimdLevel level) -> const PipelineKernels<MsaaRowRasterizer>&
+{
+  switch (level) {
+    case SimdLevel::avx2:
+      return get_msaa_row_rasterizers_avx2();
+    case SimdLevel::sse41:
+      return get_msaa_row_rasterizers_sse41();
+    default:
+      return get_msaa_row_rasterizers_scalar();
+  }
+}
+
+template <PipelineState state>
+auto rasterize_msaa_row_scalar(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, float* sample_depth, std::uint32_t* sample_colors, std::size_t sample_stride) -> int
+{
+  auto offsets_a = get_sample_edge_offsets(triangle.wa_xinc, triangle.wa_yinc);
+  auto offsets_b = get_sample_edge_offsets(triangle.wb_xinc, triangle.wb_yinc);
+  auto offsets_c = get_sample_edge_offsets(triangle.wc_xinc, triangle.wc_yinc);
+  auto written = 0;
+  for (auto x = 0UZ; x < static_cast<std::size_t>(count); ++x) {
+    auto passed = 0U;
+    auto max_depth = std::numeric_limits<float>::lowest();
+    for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+      auto& sample_z = sample_depth[sample * sample_stride + x];
+      auto sample_wa = wa + offsets_a[sample];
+      auto sample_wb = wb + offsets_b[sample];
+      auto sample_wc = wc + offsets_c[sample];
+      if (sample_wa >= 0 && sample_wb >= 0 && sample_wc >= 0) {
+        auto alpha = static_cast<float>(sample_wa) * triangle.inv_area;
+        auto beta = static_cast<float>(sample_wb) * triangle.inv_area;
+        auto gama = static_cast<float>(sample_wc) * triangle.inv_area;
+
+        auto z = alpha * triangle.z_a + beta * triangle.z_b + gama * triangle.z_c;
+        if (z < sample_z) {
+          sample_z = z;
+          passed |= 1U << sample;
+        }
+      }
+      max_depth = std::max(max_depth, sample_z);
+    }
+    if (passed != 0) {
+      // The pixel is shaded once, at its center. A center outside the triangle gets its weights
+      // clamped to 0 and scaled back to a sum of 1, which moves it onto the triangle: texture
+      // coordinates extrapolated past the triangle can be anything, even infinite where the
+      // interpolated 1 / w reaches 0
+      auto alpha = static_cast<float>(wa) * triangle.inv_area;
+      auto beta = static_cast<float>(wb) * triangle.inv_area;
+      auto gama = static_cast<float>(wc) * triangle.inv_area;
+      if (wa < 0 || wb < 0 || wc < 0) {
+        auto a = static_cast<float>(std::max(wa, 0));
+        auto b = static_cast<float>(std::max(wb, 0));
+        auto c = static_cast<float>(std::max(wc, 0));
+        auto scale = 1.0F / (a + b + c);
+        alpha = a * scale;
+        beta = b * scale;
+        gama = c * scale;
+      }
+      auto w = 1.0F / (alpha * triangle.inv_w_a + beta * triangle.inv_w_b + gama * triangle.inv_w_c);
+      auto tcoord = w * (alpha * triangle.tcoord_a + beta * triangle.tcoord_b + gama * triangle.tcoord_c);
+      auto color = sample_texture<state>(triangle, tcoord.x, tcoord.y);
+      for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+        if ((passed & (1U << sample)) != 0) sample_colors[sample * sample_stride + x] = color;
+      }
+      depth[x] = max_depth;
+      ++written;
+    }
+    wa += triangle.wa_xinc;
+    wb += triangle.wb_xinc;
+    wc += triangle.wc_xinc;
+  }
+  return written;
+}
+
+auto get_msaa_row_rasterizers_scalar() -> const PipelineKernels<MsaaRowRasterizer>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<MsaaRowRasterizer>([]<PipelineState state>() { return &rasterize_msaa_row_scalar<state>; });
+  return kernels;
+}
+
+auto get_row_upscaler(SimdLevel level) -> RowUpscaler
+{
+  switch (level) {
+    case SimdLevel::avx2:
+      return upscale_row_avx2;
+    case SimdLevel::sse41:
+      return upscale_row_sse41;
+    default:
+      return upscale_row_scalar;
+  }
+}
+
+void upscale_row_scalar(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output)
+{
+  for (auto x = 0UZ; x < count; ++x) {
+    auto column = static_cast<std::size_t>(columns[x]);
+    auto next_column = static_cast<std::size_t>(next_columns[x]);
+    auto weight = static_cast<std::uint32_t>(weights[x]);
+    auto upper = lerp_color(top[column], top[next_column], weight);
+    auto lower = lerp_color(bottom[column], bottom[next_column], weight);
+    output[x] = lerp_color(upper, lower, weight_y);
+  }
+}
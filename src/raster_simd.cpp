@@ -0,0 +1,854 @@
+#include "raster.hpp"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define _3D_FROM_SCRATCH_X86
+#include <immintrin.h>
+#endif
+
+// Kernels are compiled for their instruction set with function attributes instead of
+// per-file flags, so nothing else in the program may end up using AVX2 by accident
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+#ifdef _3D_FROM_SCRATCH_X86
+
+// The float math follows the scalar kernel operation by operation,
+// so every lane rounds exactly like rasterize_row_scalar
+template <PipelineState state>
+TARGET_SSE41 auto rasterize_row_sse41(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* colors) -> int
+{
+  constexpr auto lanes = 4;
+  auto lane_index = _mm_setr_epi32(0, 1, 2, 3);
+  auto wa_v = _mm_add_epi32(_mm_set1_epi32(wa), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm_add_epi32(_mm_set1_epi32(wb), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm_add_epi32(_mm_set1_epi32(wc), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wc_xinc));
+
+  auto one = _mm_set1_ps(1.0F);
+  auto inv_area = _mm_set1_ps(triangle.inv_area);
+  auto z_a = _mm_set1_ps(triangle.z_a);
+  auto z_b = _mm_set1_ps(triangle.z_b);
+  auto z_c = _mm_set1_ps(triangle.z_c);
+  auto inv_w_a = _mm_set1_ps(triangle.inv_w_a);
+  auto inv_w_b = _mm_set1_ps(triangle.inv_w_b);
+  auto inv_w_c = _mm_set1_ps(triangle.inv_w_c);
+  auto tcoord_a_x = _mm_set1_ps(triangle.tcoord_a.x);
+  auto tcoord_a_y = _mm_set1_ps(triangle.tcoord_a.y);
+  auto tcoord_b_x = _mm_set1_ps(triangle.tcoord_b.x);
+  auto tcoord_b_y = _mm_set1_ps(triangle.tcoord_b.y);
+  auto tcoord_c_x = _mm_set1_ps(triangle.tcoord_c.x);
+  auto tcoord_c_y = _mm_set1_ps(triangle.tcoord_c.y);
+
+  auto written = 0;
+  auto x = 0;
+  for (; x + lanes <= count; x += lanes) {
+    // a lane is outside when any of its edge values is negative
+    auto outside = _mm_castsi128_ps(_mm_srai_epi32(_mm_or_si128(_mm_or_si128(wa_v, wb_v), wc_v), 31));
+    if (_mm_movemask_ps(outside) != 0xF) {
+      auto alpha = _mm_mul_ps(_mm_cvtepi32_ps(wa_v), inv_area);
+      auto beta = _mm_mul_ps(_mm_cvtepi32_ps(wb_v), inv_area);
+      auto gama = _mm_mul_ps(_mm_cvtepi32_ps(wc_v), inv_area);
+
+      auto z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, z_a), _mm_mul_ps(beta, z_b)), _mm_mul_ps(gama, z_c));
+      auto old_depth = _mm_loadu_ps(depth + x);
+      auto pass = _mm_andnot_ps(outside, _mm_cmplt_ps(z, old_depth));
+      auto pass_bits = static_cast<unsigned>(_mm_movemask_ps(pass));
+      if (pass_bits != 0) {
+        written += std::popcount(pass_bits);
+        _mm_storeu_ps(depth + x, _mm_blendv_ps(old_depth, z, pass));
+        auto w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, inv_w_a), _mm_mul_ps(beta, inv_w_b)), _mm_mul_ps(gama, inv_w_c)));
+        alignas(16) float tcoord_x[lanes];
+        alignas(16) float tcoord_y[lanes];
+        _mm_store_ps(tcoord_x, _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, tcoord_a_x), _mm_mul_ps(beta, tcoord_b_x)), _mm_mul_ps(gama, tcoord_c_x))));
+        _mm_store_ps(tcoord_y, _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, tcoord_a_y), _mm_mul_ps(beta, tcoord_b_y)), _mm_mul_ps(gama, tcoord_c_y))));
+        for (; pass_bits != 0; pass_bits &= pass_bits - 1) {
+          auto lane = std::countr_zero(pass_bits);
+          colors[x + lane] = sample_texture<state>(triangle, tcoord_x[lane], tcoord_y[lane]);
+        }
+      }
+    }
+    wa_v = _mm_add_epi32(wa_v, wa_step);
+    wb_v = _mm_add_epi32(wb_v, wb_step);
+    wc_v = _mm_add_epi32(wc_v, wc_step);
+  }
+  if (x < count) {
+    const auto& finish_row = get_row_rasterizers_scalar()[get_pipeline_index(state)];
+    written += finish_row(triangle, _mm_cvtsi128_si32(wa_v), _mm_cvtsi128_si32(wb_v), _mm_cvtsi128_si32(wc_v), count - x, depth + x, colors + x);
+  }
+  return written;
+}
+
+auto get_row_rasterizers_sse41() -> const PipelineKernels<RowRasterizer>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<RowRasterizer>([]<PipelineState state>() { return &rasterize_row_sse41<state>; });
+  return kernels;
+}
+
+TARGET_SSE41 auto rasterize_visibility_row_sse41(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int
+{
+  constexpr auto lanes = 4;
+  auto lane_index = _mm_setr_epi32(0, 1, 2, 3);
+  auto wa_v = _mm_add_epi32(_mm_set1_epi32(wa), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm_add_epi32(_mm_set1_epi32(wb), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm_add_epi32(_mm_set1_epi32(wc), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wc_xinc));
+
+  auto inv_area = _mm_set1_ps(triangle.inv_area);
+  auto z_a = _mm_set1_ps(triangle.z_a);
+  auto z_b = _mm_set1_ps(triangle.z_b);
+  auto z_c = _mm_set1_ps(triangle.z_c);
+  auto id_v = _mm_set1_epi32(static_cast<int>(id));
+
+  auto written = 0;
+  auto x = 0;
+  for (; x + lanes <= count; x += lanes) {
+    auto outside = _mm_castsi128_ps(_mm_srai_epi32(_mm_or_si128(_mm_or_si128(wa_v, wb_v), wc_v), 31));
+    if (_mm_movemask_ps(outside) != 0xF) {
+      auto alpha = _mm_mul_ps(_mm_cvtepi32_ps(wa_v), inv_area);
+      auto beta = _mm_mul_ps(_mm_cvtepi32_ps(wb_v), inv_area);
+      auto gama = _mm_mul_ps(_mm_cvtepi32_ps(wc_v), inv_area);
+
+      auto z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, z_a), _mm_mul_ps(beta, z_b)), _mm_mul_ps(gama, z_c));
+      auto old_depth = _mm_loadu_ps(depth + x);
+      auto pass = _mm_andnot_ps(outside, _mm_cmplt_ps(z, old_depth));
+      auto pass_bits = static_cast<unsigned>(_mm_movemask_ps(pass));
+      if (pass_bits != 0) {
+        written += std::popcount(pass_bits);
+        _mm_storeu_ps(depth + x, _mm_blendv_ps(old_depth, z, pass));
+        auto* id_address = reinterpret_cast<__m128i*>(ids + x);
+        _mm_storeu_si128(id_address, _mm_blendv_epi8(_mm_loadu_si128(id_address), id_v, _mm_castps_si128(pass)));
+      }
+    }
+    wa_v = _mm_add_epi32(wa_v, wa_step);
+    wb_v = _mm_add_epi32(wb_v, wb_step);
+    wc_v = _mm_add_epi32(wc_v, wc_step);
+  }
+  if (x < count) {
+    written += rasterize_visibility_row_scalar(triangle, _mm_cvtsi128_si32(wa_v), _mm_cvtsi128_si32(wb_v), _mm_cvtsi128_si32(wc_v), count - x, depth + x, ids + x, id);
+  }
+  return written;
+}
+
+template <PipelineState state>
+TARGET_SSE41 void shade_row_sse41(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, std::uint32_t* colors)
+{
+  constexpr auto lanes = 4;
+  auto lane_index = _mm_setr_epi32(0, 1, 2, 3);
+  auto wa_v = _mm_add_epi32(_mm_set1_epi32(wa), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm_add_epi32(_mm_set1_epi32(wb), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm_add_epi32(_mm_set1_epi32(wc), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wc_xinc));
+
+  auto one = _mm_set1_ps(1.0F);
+  auto inv_area = _mm_set1_ps(triangle.inv_area);
+  auto inv_w_a = _mm_set1_ps(triangle.inv_w_a);
+  auto inv_w_b = _mm_set1_ps(triangle.inv_w_b);
+  auto inv_w_c = _mm_set1_ps(triangle.inv_w_c);
+  auto tcoord_a_x = _mm_set1_ps(triangle.tcoord_a.x);
+  auto tcoord_a_y = _mm_set1_ps(triangle.tcoord_a.y);
+  auto tcoord_b_x = _mm_set1_ps(triangle.tcoord_b.x);
+  auto tcoord_b_y = _mm_set1_ps(triangle.tcoord_b.y);
+  auto tcoord_c_x = _mm_set1_ps(triangle.tcoord_c.x);
+  auto tcoord_c_y = _mm_set1_ps(triangle.tcoord_c.y);
+
+  auto x = 0;
+  for (; x + lanes <= count; x += lanes) {
+    auto alpha = _mm_mul_ps(_mm_cvtepi32_ps(wa_v), inv_area);
+    auto beta = _mm_mul_ps(_mm_cvtepi32_ps(wb_v), inv_area);
+    auto gama = _mm_mul_ps(_mm_cvtepi32_ps(wc_v), inv_area);
+    auto w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, inv_w_a), _mm_mul_ps(beta, inv_w_b)), _mm_mul_ps(gama, inv_w_c)));
+    alignas(16) float tcoord_x[lanes];
+    alignas(16) float tcoord_y[lanes];
+    _mm_store_ps(tcoord_x, _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, tcoord_a_x), _mm_mul_ps(beta, tcoord_b_x)), _mm_mul_ps(gama, tcoord_c_x))));
+    _mm_store_ps(tcoord_y, _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, tcoord_a_y), _mm_mul_ps(beta, tcoord_b_y)), _mm_mul_ps(gama, tcoord_c_y))));
+    for (auto lane = 0; lane < lanes; ++lane) {
+      colors[x + lane] = sample_texture<state>(triangle, tcoord_x[lane], tcoord_y[lane]);
+    }
+    wa_v = _mm_add_epi32(wa_v, wa_step);
+    wb_v = _mm_add_epi32(wb_v, wb_step);
+    wc_v = _mm_add_epi32(wc_v, wc_step);
+  }
+  if (x < count) {
+    const auto& finish_row = get_row_shaders_scalar()[get_pipeline_index(state)];
+    finish_row(triangle, _mm_cvtsi128_si32(wa_v), _mm_cvtsi128_si32(wb_v), _mm_cvtsi128_si32(wc_v), count - x, colors + x);
+  }
+}
+
+auto get_row_shaders_sse41() -> const PipelineKernels<RowShader>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<RowShader>([]<PipelineState state>() { return &shade_row_sse41<state>; });
+  return kernels;
+}
+
+// Four pixels at a time, one sample of each at a time
+template <PipelineState state>
+TARGET_SSE41 auto rasterize_msaa_row_sse41(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, float* sample_depth, std::uint32_t* sample_colors, std::size_t sample_stride) -> int
+{
+  constexpr auto lanes = 4;
+  auto offsets_a = get_sample_edge_offsets(triangle.wa_xinc, triangle.wa_yinc);
+  auto offsets_b = get_sample_edge_offsets(triangle.wb_xinc, triangle.wb_yinc);
+  auto offsets_c = get_sample_edge_offsets(triangle.wc_xinc, triangle.wc_yinc);
+  auto lane_index = _mm_setr_epi32(0, 1, 2, 3);
+  auto wa_v = _mm_add_epi32(_mm_set1_epi32(wa), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm_add_epi32(_mm_set1_epi32(wb), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm_add_epi32(_mm_set1_epi32(wc), _mm_mullo_epi32(lane_index, _mm_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm_mullo_epi32(_mm_set1_epi32(lanes), _mm_set1_epi32(triangle.wc_xinc));
+
+  auto one = _mm_set1_ps(1.0F);
+  auto inv_area = _mm_set1_ps(triangle.inv_area);
+  auto z_a = _mm_set1_ps(triangle.z_a);
+  auto z_b = _mm_set1_ps(triangle.z_b);
+  auto z_c = _mm_set1_ps(triangle.z_c);
+  auto inv_w_a = _mm_set1_ps(triangle.inv_w_a);
+  auto inv_w_b = _mm_set1_ps(triangle.inv_w_b);
+  auto inv_w_c = _mm_set1_ps(triangle.inv_w_c);
+  auto tcoord_a_x = _mm_set1_ps(triangle.tcoord_a.x);
+  auto tcoord_a_y = _mm_set1_ps(triangle.tcoord_a.y);
+  auto tcoord_b_x = _mm_set1_ps(triangle.tcoord_b.x);
+  auto tcoord_b_y = _mm_set1_ps(triangle.tcoord_b.y);
+  auto tcoord_c_x = _mm_set1_ps(triangle.tcoord_c.x);
+  auto tcoord_c_y = _mm_set1_ps(triangle.tcoord_c.y);
+
+  auto written = 0;
+  auto x = 0;
+  for (; x + lanes <= count; x += lanes) {
+    __m128 pass[g_msaa_sample_count];
+    auto any_pass = _mm_setzero_ps();
+    auto max_depth = _mm_set1_ps(std::numeric_limits<float>::lowest());
+    for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+      auto sample_wa = _mm_add_epi32(wa_v, _mm_set1_epi32(offsets_a[sample]));
+      auto sample_wb = _mm_add_epi32(wb_v, _mm_set1_epi32(offsets_b[sample]));
+      auto sample_wc = _mm_add_epi32(wc_v, _mm_set1_epi32(offsets_c[sample]));
+      auto* sample_address = sample_depth + sample * sample_stride + static_cast<std::size_t>(x);
+      auto old_depth = _mm_loadu_ps(sample_address);
+      pass[sample] = _mm_setzero_ps();
+      auto outside = _mm_castsi128_ps(_mm_srai_epi32(_mm_or_si128(_mm_or_si128(sample_wa, sample_wb), sample_wc), 31));
+      if (_mm_movemask_ps(outside) != 0xF) {
+        auto alpha = _mm_mul_ps(_mm_cvtepi32_ps(sample_wa), inv_area);
+        auto beta = _mm_mul_ps(_mm_cvtepi32_ps(sample_wb), inv_area);
+        auto gama = _mm_mul_ps(_mm_cvtepi32_ps(sample_wc), inv_area);
+
+        auto z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, z_a), _mm_mul_ps(beta, z_b)), _mm_mul_ps(gama, z_c));
+        pass[sample] = _mm_andnot_ps(outside, _mm_cmplt_ps(z, old_depth));
+        old_depth = _mm_blendv_ps(old_depth, z, pass[sample]);
+        _mm_storeu_ps(sample_address, old_depth);
+        any_pass = _mm_or_ps(any_pass, pass[sample]);
+      }
+      max_depth = _mm_max_ps(max_depth, old_depth);
+    }
+    auto pass_bits = static_cast<unsigned>(_mm_movemask_ps(any_pass));
+    if (pass_bits != 0) {
+      written += std::popcount(pass_bits);
+      _mm_storeu_ps(depth + x, _mm_blendv_ps(_mm_loadu_ps(depth + x), max_depth, any_pass));
+      auto alpha = _mm_mul_ps(_mm_cvtepi32_ps(wa_v), inv_area);
+      auto beta = _mm_mul_ps(_mm_cvtepi32_ps(wb_v), inv_area);
+      auto gama = _mm_mul_ps(_mm_cvtepi32_ps(wc_v), inv_area);
+      // pixel centers outside the triangle are moved onto it, like rasterize_msaa_row_scalar does
+      auto center_outside = _mm_castsi128_ps(_mm_srai_epi32(_mm_or_si128(_mm_or_si128(wa_v, wb_v), wc_v), 31));
+      if (_mm_movemask_ps(_mm_and_ps(center_outside, any_pass)) != 0) {
+        auto zero = _mm_setzero_si128();
+        auto a = _mm_cvtepi32_ps(_mm_max_epi32(wa_v, zero));
+        auto b = _mm_cvtepi32_ps(_mm_max_epi32(wb_v, zero));
+        auto c = _mm_cvtepi32_ps(_mm_max_epi32(wc_v, zero));
+        auto scale = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(a, b), c));
+        alpha = _mm_blendv_ps(alpha, _mm_mul_ps(a, scale), center_outside);
+        beta = _mm_blendv_ps(beta, _mm_mul_ps(b, scale), center_outside);
+        gama = _mm_blendv_ps(gama, _mm_mul_ps(c, scale), center_outside);
+      }
+      auto w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, inv_w_a), _mm_mul_ps(beta, inv_w_b)), _mm_mul_ps(gama, inv_w_c)));
+      alignas(16) float tcoord_x[lanes];
+      alignas(16) float tcoord_y[lanes];
+      _mm_store_ps(tcoord_x, _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, tcoord_a_x), _mm_mul_ps(beta, tcoord_b_x)), _mm_mul_ps(gama, tcoord_c_x))));
+      _mm_store_ps(tcoord_y, _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, tcoord_a_y), _mm_mul_ps(beta, tcoord_b_y)), _mm_mul_ps(gama, tcoord_c_y))));
+      alignas(16) std::uint32_t colors[lanes]{};
+      for (; pass_bits != 0; pass_bits &= pass_bits - 1) {
+        auto lane = std::countr_zero(pass_bits);
+        colors[lane] = sample_texture<state>(triangle, tcoord_x[lane], tcoord_y[lane]);
+      }
+      auto color = _mm_load_si128(reinterpret_cast<const __m128i*>(colors));
+      for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+        auto* color_address = reinterpret_cast<__m128i*>(sample_colors + sample * sample_stride + static_cast<std::size_t>(x));
+        _mm_storeu_si128(color_address, _mm_blendv_epi8(_mm_loadu_si128(color_address), color, _mm_castps_si128(pass[sample])));
+      }
+    }
+    wa_v = _mm_add_epi32(wa_v, wa_step);
+    wb_v = _mm_add_epi32(wb_v, wb_step);
+    wc_v = _mm_add_epi32(wc_v, wc_step);
+  }
+  if (x < count) {
+    auto offset = static_cast<std::size_t>(x);
+    const auto& finish_row = get_msaa_row_rasterizers_scalar()[get_pipeline_index(state)];
+    written += finish_row(triangle, _mm_cvtsi128_si32(wa_v), _mm_cvtsi128_si32(wb_v), _mm_cvtsi128_si32(wc_v), count - x, depth + offset, sample_depth + offset, sample_colors + offset, sample_stride);
+  }
+  return written;
+}
+
+auto get_msaa_row_rasterizers_sse41() -> const PipelineKernels<MsaaRowRasterizer>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<MsaaRowRasterizer>([]<PipelineState state>() { return &rasterize_msaa_row_sse41<state>; });
+  return kernels;
+}
+
+// Texture sampling for 8 lanes, with the same integer math as Texture, so colors match the
+// scalar samplers bit for bit. Lanes outside mask are never read
+
+// weight holds a 0 to 256 weight in both 16 bit halves of every lane
+TARGET_AVX2 static auto lerp_colors_avx2(__m256i a, __m256i b, __m256i weight) -> __m256i
+{
+  auto low_bytes = _mm256_set1_epi16(0x00FF);
+  auto inv_weight = _mm256_sub_epi16(_mm256_set1_epi16(256), weight);
+  auto red_blue = _mm256_srli_epi16(_mm256_add_epi16(
+    _mm256_mullo_epi16(_mm256_and_si256(a, low_bytes), inv_weight),
+    _mm256_mullo_epi16(_mm256_and_si256(b, low_bytes), weight)), 8);
+  auto alpha_green = _mm256_srli_epi16(_mm256_add_epi16(
+    _mm256_mullo_epi16(_mm256_srli_epi16(a, 8), inv_weight),
+    _mm256_mullo_epi16(_mm256_srli_epi16(b, 8), weight)), 8);
+  return _mm256_or_si256(red_blue, _mm256_slli_epi16(alpha_green, 8));
+}
+
+// Coordinates clamped like Texture::clamp_coord. max_ps returns its second operand when the
+// first one is NaN, so NaN becomes 0 here too
+TARGET_AVX2 static auto clamp_coords_avx2(__m256 coords) -> __m256
+{
+  return _mm256_min_ps(_mm256_max_ps(coords, _mm256_setzero_ps()), _mm256_set1_ps(Texture::max_coord));
+}
+
+// Index of the texels (x, y) of a level, like Texture::row_offset + Texture::column_offset
+TARGET_AVX2 static auto texel_index_avx2(const Texture::MipLevel& mip, __m256i x, __m256i y) -> __m256i
+{
+  constexpr auto tile_size = static_cast<int>(Texture::tile_size);
+  static_assert(tile_size == 4);
+  x = _mm256_min_epi32(x, _mm256_set1_epi32(static_cast<int>(mip.width) - 1));
+  y = _mm256_min_epi32(y, _mm256_set1_epi32(static_cast<int>(mip.height) - 1));
+  auto row = _mm256_add_epi32(
+    _mm256_mullo_epi32(_mm256_srli_epi32(y, 2), _mm256_set1_epi32(static_cast<int>(mip.tile_count_x) * tile_size * tile_size)),
+    _mm256_slli_epi32(_mm256_and_si256(y, _mm256_set1_epi32(tile_size - 1)), 2));
+  auto column = _mm256_add_epi32(
+    _mm256_slli_epi32(_mm256_srli_epi32(x, 2), 4),
+    _mm256_and_si256(x, _mm256_set1_epi32(tile_size - 1)));
+  return _mm256_add_epi32(row, column);
+}
+
+// RGB565 colors expanded to opaque ABGR colors, like expand_rgb565
+TARGET_AVX2 static auto expand_rgb565_avx2(__m256i color) -> __m256i
+{
+  auto red = _mm256_and_si256(_mm256_srli_epi32(color, 11), _mm256_set1_epi32(0x1F));
+  auto green = _mm256_and_si256(_mm256_srli_epi32(color, 5), _mm256_set1_epi32(0x3F));
+  auto blue = _mm256_and_si256(color, _mm256_set1_epi32(0x1F));
+  red = _mm256_or_si256(_mm256_slli_epi32(red, 3), _mm256_srli_epi32(red, 2));
+  green = _mm256_or_si256(_mm256_slli_epi32(green, 2), _mm256_srli_epi32(green, 4));
+  blue = _mm256_or_si256(_mm256_slli_epi32(blue, 3), _mm256_srli_epi32(blue, 2));
+  return _mm256_or_si256(
+    _mm256_or_si256(_mm256_set1_epi32(static_cast<int>(0xFF000000U)), _mm256_slli_epi32(blue, 16)),
+    _mm256_or_si256(_mm256_slli_epi32(green, 8), red));
+}
+
+// Texels of the bc1 blocks starting at word block of words, like decode_bc1_texel
+TARGET_AVX2 static auto decode_bc1_avx2(const int* words, __m256i block, __m256i texel, __m256i mask) -> __m256i
+{
+  auto colors = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words, block, mask, 4);
+  auto indices = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words + 1, block, mask, 4);
+  auto index = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_slli_epi32(texel, 1)), _mm256_set1_epi32(3));
+  const auto& weights = g_bc1_index_weights;
+  auto weight = _mm256_permutevar8x32_epi32(
+    _mm256_setr_epi32(static_cast<int>(weights[0]), static_cast<int>(weights[1]), static_cast<int>(weights[2]), static_cast<int>(weights[3]), 0, 0, 0, 0),
+    index);
+  return lerp_colors_avx2(
+    expand_rgb565_avx2(_mm256_and_si256(colors, _mm256_set1_epi32(0xFFFF))),
+    expand_rgb565_avx2(_mm256_srli_epi32(colors, 16)),
+    _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16)));
+}
+
+// Texels of the bc3 blocks starting at word block of words, like decode_bc3_texel
+TARGET_AVX2 static auto decode_bc3_avx2(const int* words, __m256i block, __m256i texel, __m256i mask) -> __m256i
+{
+  auto low = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words, block, mask, 4);
+  auto high = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words + 1, block, mask, 4);
+  auto byte = _mm256_set1_epi32(0xFF);
+  auto alpha0 = _mm256_and_si256(low, byte);
+  auto alpha1 = _mm256_and_si256(_mm256_srli_epi32(low, 8), byte);
+  // the 3 bits of the index may straddle both words. Shifts of 32 bits or more give 0
+  auto bit = _mm256_add_epi32(_mm256_set1_epi32(16), _mm256_mullo_epi32(texel, _mm256_set1_epi32(3)));
+  auto thirty_two = _mm256_set1_epi32(32);
+  auto index = _mm256_or_si256(
+    _mm256_or_si256(_mm256_srlv_epi32(low, bit), _mm256_sllv_epi32(high, _mm256_sub_epi32(thirty_two, bit))),
+    _mm256_srlv_epi32(high, _mm256_sub_epi32(bit, thirty_two)));
+  index = _mm256_and_si256(index, _mm256_set1_epi32(7));
+  // (x * 18725) >> 17 is x / 7 for every x up to 7 * 255
+  auto one = _mm256_set1_epi32(1);
+  auto sum = _mm256_add_epi32(
+    _mm256_mullo_epi32(_mm256_sub_epi32(_mm256_set1_epi32(8), index), alpha0),
+    _mm256_mullo_epi32(_mm256_sub_epi32(index, one), alpha1));
+  auto alpha = _mm256_srli_epi32(_mm256_mullo_epi32(sum, _mm256_set1_epi32(18725)), 17);
+  alpha = _mm256_blendv_epi8(alpha, alpha0, _mm256_cmpeq_epi32(index, _mm256_setzero_si256()));
+  alpha = _mm256_blendv_epi8(alpha, alpha1, _mm256_cmpeq_epi32(index, one));
+  auto colors = decode_bc1_avx2(words, _mm256_add_epi32(block, _mm256_set1_epi32(2)), texel, mask);
+  return _mm256_or_si256(_mm256_and_si256(colors, _mm256_set1_epi32(0x00FFFFFF)), _mm256_slli_epi32(alpha, 24));
+}
+
+// Texels of a texture in format
+template <TextureFormat format>
+TARGET_AVX2 static auto gather_texels_avx2(const Texture& texture, const Texture::MipLevel& mip, __m256i index, __m256i mask) -> __m256i
+{
+  if constexpr (format == TextureFormat::rgba8) {
+    const auto* texels = reinterpret_cast<const int*>(texture.texels() + mip.offset);
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), texels, index, mask, 4);
+  }
+  else {
+    // Levels start on a tile, so the tile of a texel is its index in the level over 16
+    auto word_count = Texture::tile_word_count(format);
+    const auto* words = reinterpret_cast<const int*>(texture.texels() + mip.offset / 16 * word_count);
+    auto block = _mm256_mullo_epi32(_mm256_srli_epi32(index, 4), _mm256_set1_epi32(static_cast<int>(word_count)));
+    auto texel = _mm256_and_si256(index, _mm256_set1_epi32(15));
+    if constexpr (format == TextureFormat::bc1) return decode_bc1_avx2(words, block, texel, mask);
+    else return decode_bc3_avx2(words, block, texel, mask);
+  }
+}
+
+template <TextureFormat format>
+TARGET_AVX2 static auto sample_nearest_avx2(const Texture& texture, std::size_t level, __m256 x, __m256 y, __m256i mask) -> __m256i
+{
+  const auto& mip = texture.level(level);
+  auto scale = _mm256_set1_ps(mip.scale);
+  auto half = _mm256_set1_ps(0.5F);
+  auto level_x = _mm256_cvttps_epi32(clamp_coords_avx2(_mm256_mul_ps(_mm256_add_ps(x, half), scale)));
+  auto level_y = _mm256_cvttps_epi32(clamp_coords_avx2(_mm256_mul_ps(_mm256_add_ps(y, half), scale)));
+  return gather_texels_avx2<format>(texture, mip, texel_index_avx2(mip, level_x, level_y), mask);
+}
+
+template <TextureFormat format>
+TARGET_AVX2 static auto sample_bilinear_avx2(const Texture& texture, std::size_t level, __m256 x, __m256 y, __m256i mask) -> __m256i
+{
+  const auto& mip = texture.level(level);
+  auto scale = _mm256_set1_ps(mip.scale);
+  auto half = _mm256_set1_ps(0.5F);
+  auto level_x = clamp_coords_avx2(_mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(x, half), scale), half));
+  auto level_y = clamp_coords_avx2(_mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(y, half), scale), half));
+  auto x0 = _mm256_cvttps_epi32(level_x);
+  auto y0 = _mm256_cvttps_epi32(level_y);
+  auto weight_x = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(level_x, _mm256_cvtepi32_ps(x0)), _mm256_set1_ps(256.0F)));
+  auto weight_y = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(level_y, _mm256_cvtepi32_ps(y0)), _mm256_set1_ps(256.0F)));
+  weight_x = _mm256_or_si256(weight_x, _mm256_slli_epi32(weight_x, 16));
+  weight_y = _mm256_or_si256(weight_y, _mm256_slli_epi32(weight_y, 16));
+
+  auto one = _mm256_set1_epi32(1);
+  auto x1 = _mm256_add_epi32(x0, one);
+  auto y1 = _mm256_add_epi32(y0, one);
+  auto top = lerp_colors_avx2(
+    gather_texels_avx2<format>(texture, mip, texel_index_avx2(mip, x0, y0), mask),
+    gather_texels_avx2<format>(texture, mip, texel_index_avx2(mip, x1, y0), mask),
+    weight_x);
+  auto bottom = lerp_colors_avx2(
+    gather_texels_avx2<format>(texture, mip, texel_index_avx2(mip, x0, y1), mask),
+    gather_texels_avx2<format>(texture, mip, texel_index_avx2(mip, x1, y1), mask),
+    weight_x);
+  return lerp_colors_avx2(top, bottom, weight_y);
+}
+
+// Like sample_texture
+template <PipelineState state>
+TARGET_AVX2 static auto sample_texture_avx2(const TriangleSetup& triangle, __m256 x, __m256 y, __m256i mask) -> __m256i
+{
+  const auto& texture = *triangle.texture;
+  if constexpr (state.sampler == SamplerMode::nearest) {
+    return sample_nearest_avx2<state.format>(texture, triangle.mip_level, x, y, mask);
+  }
+  else if constexpr (state.sampler == SamplerMode::bilinear) {
+    return sample_bilinear_avx2<state.format>(texture, triangle.mip_level, x, y, mask);
+  }
+  else {
+    auto color = sample_bilinear_avx2<state.format>(texture, triangle.mip_level, x, y, mask);
+    auto blend = _mm256_set1_epi16(static_cast<short>(triangle.mip_blend));
+    return lerp_colors_avx2(color, sample_bilinear_avx2<state.format>(texture, triangle.mip_level + 1, x, y, mask), blend);
+  }
+}
+
+template <PipelineState state>
+TARGET_AVX2 auto rasterize_row_avx2(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* colors) -> int
+{
+  constexpr auto lanes = 8;
+  auto lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  auto wa_v = _mm256_add_epi32(_mm256_set1_epi32(wa), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm256_add_epi32(_mm256_set1_epi32(wb), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm256_add_epi32(_mm256_set1_epi32(wc), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wc_xinc));
+
+  auto one = _mm256_set1_ps(1.0F);
+  auto inv_area = _mm256_set1_ps(triangle.inv_area);
+  auto z_a = _mm256_set1_ps(triangle.z_a);
+  auto z_b = _mm256_set1_ps(triangle.z_b);
+  auto z_c = _mm256_set1_ps(triangle.z_c);
+  auto inv_w_a = _mm256_set1_ps(triangle.inv_w_a);
+  auto inv_w_b = _mm256_set1_ps(triangle.inv_w_b);
+  auto inv_w_c = _mm256_set1_ps(triangle.inv_w_c);
+  auto tcoord_a_x = _mm256_set1_ps(triangle.tcoord_a.x);
+  auto tcoord_a_y = _mm256_set1_ps(triangle.tcoord_a.y);
+  auto tcoord_b_x = _mm256_set1_ps(triangle.tcoord_b.x);
+  auto tcoord_b_y = _mm256_set1_ps(triangle.tcoord_b.y);
+  auto tcoord_c_x = _mm256_set1_ps(triangle.tcoord_c.x);
+  auto tcoord_c_y = _mm256_set1_ps(triangle.tcoord_c.y);
+
+  // the last group of a row is partial, its missing lanes are masked out and never touch memory
+  auto written = 0;
+  for (auto x = 0; x < count; x += lanes) {
+    auto valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - x), lane_index);
+    // a lane is outside when any of its edge values is negative
+    auto outside = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_srai_epi32(_mm256_or_si256(_mm256_or_si256(wa_v, wb_v), wc_v), 31),
+      _mm256_xor_si256(valid, _mm256_set1_epi32(-1))));
+    if (_mm256_movemask_ps(outside) != 0xFF) {
+      auto alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(wa_v), inv_area);
+      auto beta = _mm256_mul_ps(_mm256_cvtepi32_ps(wb_v), inv_area);
+      auto gama = _mm256_mul_ps(_mm256_cvtepi32_ps(wc_v), inv_area);
+
+      auto z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, z_a), _mm256_mul_ps(beta, z_b)), _mm256_mul_ps(gama, z_c));
+      auto old_depth = _mm256_maskload_ps(depth + x, valid);
+      auto pass = _mm256_andnot_ps(outside, _mm256_cmp_ps(z, old_depth, _CMP_LT_OQ));
+      auto pass_bits = static_cast<unsigned>(_mm256_movemask_ps(pass));
+      if (pass_bits != 0) {
+        written += std::popcount(pass_bits);
+        _mm256_maskstore_ps(depth + x, _mm256_castps_si256(pass), z);
+        auto w = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, inv_w_a), _mm256_mul_ps(beta, inv_w_b)), _mm256_mul_ps(gama, inv_w_c)));
+        auto tcoord_x = _mm256_mul_ps(w, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, tcoord_a_x), _mm256_mul_ps(beta, tcoord_b_x)), _mm256_mul_ps(gama, tcoord_c_x)));
+        auto tcoord_y = _mm256_mul_ps(w, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, tcoord_a_y), _mm256_mul_ps(beta, tcoord_b_y)), _mm256_mul_ps(gama, tcoord_c_y)));
+        auto pass_mask = _mm256_castps_si256(pass);
+        auto color = sample_texture_avx2<state>(triangle, tcoord_x, tcoord_y, pass_mask);
+        _mm256_maskstore_epi32(reinterpret_cast<int*>(colors + x), pass_mask, color);
+      }
+    }
+    wa_v = _mm256_add_epi32(wa_v, wa_step);
+    wb_v = _mm256_add_epi32(wb_v, wb_step);
+    wc_v = _mm256_add_epi32(wc_v, wc_step);
+  }
+  return written;
+}
+
+auto get_row_rasterizers_avx2() -> const PipelineKernels<RowRasterizer>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<RowRasterizer>([]<PipelineState state>() { return &rasterize_row_avx2<state>; });
+  return kernels;
+}
+
+TARGET_AVX2 auto rasterize_visibility_row_avx2(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int
+{
+  constexpr auto lanes = 8;
+  auto lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  auto wa_v = _mm256_add_epi32(_mm256_set1_epi32(wa), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm256_add_epi32(_mm256_set1_epi32(wb), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm256_add_epi32(_mm256_set1_epi32(wc), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wc_xinc));
+
+  auto inv_area = _mm256_set1_ps(triangle.inv_area);
+  auto z_a = _mm256_set1_ps(triangle.z_a);
+  auto z_b = _mm256_set1_ps(triangle.z_b);
+  auto z_c = _mm256_set1_ps(triangle.z_c);
+  auto id_v = _mm256_set1_epi32(static_cast<int>(id));
+
+  auto written = 0;
+  for (auto x = 0; x < count; x += lanes) {
+    auto valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - x), lane_index);
+    auto outside = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_srai_epi32(_mm256_or_si256(_mm256_or_si256(wa_v, wb_v), wc_v), 31),
+      _mm256_xor_si256(valid, _mm256_set1_epi32(-1))));
+    if (_mm256_movemask_ps(outside) != 0xFF) {
+      auto alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(wa_v), inv_area);
+      auto beta = _mm256_mul_ps(_mm256_cvtepi32_ps(wb_v), inv_area);
+      auto gama = _mm256_mul_ps(_mm256_cvtepi32_ps(wc_v), inv_area);
+
+      auto z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, z_a), _mm256_mul_ps(beta, z_b)), _mm256_mul_ps(gama, z_c));
+      auto old_depth = _mm256_maskload_ps(depth + x, valid);
+      auto pass = _mm256_andnot_ps(outside, _mm256_cmp_ps(z, old_depth, _CMP_LT_OQ));
+      auto pass_bits = static_cast<unsigned>(_mm256_movemask_ps(pass));
+      if (pass_bits != 0) {
+        written += std::popcount(pass_bits);
+        _mm256_maskstore_ps(depth + x, _mm256_castps_si256(pass), z);
+        _mm256_maskstore_epi32(reinterpret_cast<int*>(ids + x), _mm256_castps_si256(pass), id_v);
+      }
+    }
+    wa_v = _mm256_add_epi32(wa_v, wa_step);
+    wb_v = _mm256_add_epi32(wb_v, wb_step);
+    wc_v = _mm256_add_epi32(wc_v, wc_step);
+  }
+  return written;
+}
+
+template <PipelineState state>
+TARGET_AVX2 void shade_row_avx2(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, std::uint32_t* colors)
+{
+  constexpr auto lanes = 8;
+  auto lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  auto wa_v = _mm256_add_epi32(_mm256_set1_epi32(wa), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm256_add_epi32(_mm256_set1_epi32(wb), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm256_add_epi32(_mm256_set1_epi32(wc), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wc_xinc));
+
+  auto one = _mm256_set1_ps(1.0F);
+  auto inv_area = _mm256_set1_ps(triangle.inv_area);
+  auto inv_w_a = _mm256_set1_ps(triangle.inv_w_a);
+  auto inv_w_b = _mm256_set1_ps(triangle.inv_w_b);
+  auto inv_w_c = _mm256_set1_ps(triangle.inv_w_c);
+  auto tcoord_a_x = _mm256_set1_ps(triangle.tcoord_a.x);
+  auto tcoord_a_y = _mm256_set1_ps(triangle.tcoord_a.y);
+  auto tcoord_b_x = _mm256_set1_ps(triangle.tcoord_b.x);
+  auto tcoord_b_y = _mm256_set1_ps(triangle.tcoord_b.y);
+  auto tcoord_c_x = _mm256_set1_ps(triangle.tcoord_c.x);
+  auto tcoord_c_y = _mm256_set1_ps(triangle.tcoord_c.y);
+
+  // lanes past the end of the row are masked out and never touch memory
+  for (auto x = 0; x < count; x += lanes) {
+    auto valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - x), lane_index);
+    auto alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(wa_v), inv_area);
+    auto beta = _mm256_mul_ps(_mm256_cvtepi32_ps(wb_v), inv_area);
+    auto gama = _mm256_mul_ps(_mm256_cvtepi32_ps(wc_v), inv_area);
+    auto w = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, inv_w_a), _mm256_mul_ps(beta, inv_w_b)), _mm256_mul_ps(gama, inv_w_c)));
+    auto tcoord_x = _mm256_mul_ps(w, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, tcoord_a_x), _mm256_mul_ps(beta, tcoord_b_x)), _mm256_mul_ps(gama, tcoord_c_x)));
+    auto tcoord_y = _mm256_mul_ps(w, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, tcoord_a_y), _mm256_mul_ps(beta, tcoord_b_y)), _mm256_mul_ps(gama, tcoord_c_y)));
+    auto color = sample_texture_avx2<state>(triangle, tcoord_x, tcoord_y, valid);
+    _mm256_maskstore_epi32(reinterpret_cast<int*>(colors + x), valid, color);
+    wa_v = _mm256_add_epi32(wa_v, wa_step);
+    wb_v = _mm256_add_epi32(wb_v, wb_step);
+    wc_v = _mm256_add_epi32(wc_v, wc_step);
+  }
+}
+
+auto get_row_shaders_avx2() -> const PipelineKernels<RowShader>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<RowShader>([]<PipelineState state>() { return &shade_row_avx2<state>; });
+  return kernels;
+}
+
+template <PipelineState state>
+TARGET_AVX2 auto rasterize_msaa_row_avx2(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, float* sample_depth, std::uint32_t* sample_colors, std::size_t sample_stride) -> int
+{
+  constexpr auto lanes = 8;
+  auto offsets_a = get_sample_edge_offsets(triangle.wa_xinc, triangle.wa_yinc);
+  auto offsets_b = get_sample_edge_offsets(triangle.wb_xinc, triangle.wb_yinc);
+  auto offsets_c = get_sample_edge_offsets(triangle.wc_xinc, triangle.wc_yinc);
+  auto lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  auto wa_v = _mm256_add_epi32(_mm256_set1_epi32(wa), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wa_xinc)));
+  auto wb_v = _mm256_add_epi32(_mm256_set1_epi32(wb), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wb_xinc)));
+  auto wc_v = _mm256_add_epi32(_mm256_set1_epi32(wc), _mm256_mullo_epi32(lane_index, _mm256_set1_epi32(triangle.wc_xinc)));
+  auto wa_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wa_xinc));
+  auto wb_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wb_xinc));
+  auto wc_step = _mm256_mullo_epi32(_mm256_set1_epi32(lanes), _mm256_set1_epi32(triangle.wc_xinc));
+
+  auto one = _mm256_set1_ps(1.0F);
+  auto inv_area = _mm256_set1_ps(triangle.inv_area);
+  auto z_a = _mm256_set1_ps(triangle.z_a);
+  auto z_b = _mm256_set1_ps(triangle.z_b);
+  auto z_c = _mm256_set1_ps(triangle.z_c);
+  auto inv_w_a = _mm256_set1_ps(triangle.inv_w_a);
+  auto inv_w_b = _mm256_set1_ps(triangle.inv_w_b);
+  auto inv_w_c = _mm256_set1_ps(triangle.inv_w_c);
+  auto tcoord_a_x = _mm256_set1_ps(triangle.tcoord_a.x);
+  auto tcoord_a_y = _mm256_set1_ps(triangle.tcoord_a.y);
+  auto tcoord_b_x = _mm256_set1_ps(triangle.tcoord_b.x);
+  auto tcoord_b_y = _mm256_set1_ps(triangle.tcoord_b.y);
+  auto tcoord_c_x = _mm256_set1_ps(triangle.tcoord_c.x);
+  auto tcoord_c_y = _mm256_set1_ps(triangle.tcoord_c.y);
+
+  // Eight pixels at a time, one sample of each at a time. The last group of a row is partial,
+  // its missing lanes are masked out and never touch memory
+  auto written = 0;
+  for (auto x = 0; x < count; x += lanes) {
+    auto valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - x), lane_index);
+    auto invalid = _mm256_xor_si256(valid, _mm256_set1_epi32(-1));
+    __m256 pass[g_msaa_sample_count];
+    auto any_pass = _mm256_setzero_ps();
+    auto max_depth = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+    for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+      auto sample_wa = _mm256_add_epi32(wa_v, _mm256_set1_epi32(offsets_a[sample]));
+      auto sample_wb = _mm256_add_epi32(wb_v, _mm256_set1_epi32(offsets_b[sample]));
+      auto sample_wc = _mm256_add_epi32(wc_v, _mm256_set1_epi32(offsets_c[sample]));
+      auto* sample_address = sample_depth + sample * sample_stride + static_cast<std::size_t>(x);
+      auto old_depth = _mm256_maskload_ps(sample_address, valid);
+      pass[sample] = _mm256_setzero_ps();
+      auto outside = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_srai_epi32(_mm256_or_si256(_mm256_or_si256(sample_wa, sample_wb), sample_wc), 31),
+        invalid));
+      if (_mm256_movemask_ps(outside) != 0xFF) {
+        auto alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(sample_wa), inv_area);
+        auto beta = _mm256_mul_ps(_mm256_cvtepi32_ps(sample_wb), inv_area);
+        auto gama = _mm256_mul_ps(_mm256_cvtepi32_ps(sample_wc), inv_area);
+
+        auto z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, z_a), _mm256_mul_ps(beta, z_b)), _mm256_mul_ps(gama, z_c));
+        pass[sample] = _mm256_andnot_ps(outside, _mm256_cmp_ps(z, old_depth, _CMP_LT_OQ));
+        _mm256_maskstore_ps(sample_address, _mm256_castps_si256(pass[sample]), z);
+        old_depth = _mm256_blendv_ps(old_depth, z, pass[sample]);
+        any_pass = _mm256_or_ps(any_pass, pass[sample]);
+      }
+      max_depth = _mm256_max_ps(max_depth, old_depth);
+    }
+    auto pass_bits = static_cast<unsigned>(_mm256_movemask_ps(any_pass));
+    if (pass_bits != 0) {
+      written += std::popcount(pass_bits);
+      auto pass_mask = _mm256_castps_si256(any_pass);
+      _mm256_maskstore_ps(depth + x, pass_mask, max_depth);
+      auto alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(wa_v), inv_area);
+      auto beta = _mm256_mul_ps(_mm256_cvtepi32_ps(wb_v), inv_area);
+      auto gama = _mm256_mul_ps(_mm256_cvtepi32_ps(wc_v), inv_area);
+      // pixel centers outside the triangle are moved onto it, like rasterize_msaa_row_scalar does
+      auto center_outside = _mm256_castsi256_ps(_mm256_srai_epi32(_mm256_or_si256(_mm256_or_si256(wa_v, wb_v), wc_v), 31));
+      if (_mm256_movemask_ps(_mm256_and_ps(center_outside, any_pass)) != 0) {
+        auto zero = _mm256_setzero_si256();
+        auto a = _mm256_cvtepi32_ps(_mm256_max_epi32(wa_v, zero));
+        auto b = _mm256_cvtepi32_ps(_mm256_max_epi32(wb_v, zero));
+        auto c = _mm256_cvtepi32_ps(_mm256_max_epi32(wc_v, zero));
+        auto scale = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(a, b), c));
+        alpha = _mm256_blendv_ps(alpha, _mm256_mul_ps(a, scale), center_outside);
+        beta = _mm256_blendv_ps(beta, _mm256_mul_ps(b, scale), center_outside);
+        gama = _mm256_blendv_ps(gama, _mm256_mul_ps(c, scale), center_outside);
+      }
+      auto w = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, inv_w_a), _mm256_mul_ps(beta, inv_w_b)), _mm256_mul_ps(gama, inv_w_c)));
+      auto tcoord_x = _mm256_mul_ps(w, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, tcoord_a_x), _mm256_mul_ps(beta, tcoord_b_x)), _mm256_mul_ps(gama, tcoord_c_x)));
+      auto tcoord_y = _mm256_mul_ps(w, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, tcoord_a_y), _mm256_mul_ps(beta, tcoord_b_y)), _mm256_mul_ps(gama, tcoord_c_y)));
+      auto color = sample_texture_avx2<state>(triangle, tcoord_x, tcoord_y, pass_mask);
+      for (auto sample = 0UZ; sample < g_msaa_sample_count; ++sample) {
+        auto* color_address = reinterpret_cast<int*>(sample_colors + sample * sample_stride + static_cast<std::size_t>(x));
+        _mm256_maskstore_epi32(color_address, _mm256_castps_si256(pass[sample]), color);
+      }
+    }
+    wa_v = _mm256_add_epi32(wa_v, wa_step);
+    wb_v = _mm256_add_epi32(wb_v, wb_step);
+    wc_v = _mm256_add_epi32(wc_v, wc_step);
+  }
+  return written;
+}
+
+auto get_msaa_row_rasterizers_avx2() -> const PipelineKernels<MsaaRowRasterizer>&
+{
+  static constexpr auto kernels = make_pipeline_kernels<MsaaRowRasterizer>([]<PipelineState state>() { return &rasterize_msaa_row_avx2<state>; });
+  return kernels;
+}
+
+// weight holds a 0 to 256 weight in both 16 bit halves of every lane, like lerp_colors_avx2
+TARGET_SSE41 static auto lerp_colors_sse41(__m128i a, __m128i b, __m128i weight) -> __m128i
+{
+  auto low_bytes = _mm_set1_epi16(0x00FF);
+  auto inv_weight = _mm_sub_epi16(_mm_set1_epi16(256), weight);
+  auto red_blue = _mm_srli_epi16(_mm_add_epi16(
+    _mm_mullo_epi16(_mm_and_si128(a, low_bytes), inv_weight),
+    _mm_mullo_epi16(_mm_and_si128(b, low_bytes), weight)), 8);
+  auto alpha_green = _mm_srli_epi16(_mm_add_epi16(
+    _mm_mullo_epi16(_mm_srli_epi16(a, 8), inv_weight),
+    _mm_mullo_epi16(_mm_srli_epi16(b, 8), weight)), 8);
+  return _mm_or_si128(red_blue, _mm_slli_epi16(alpha_green, 8));
+}
+
+// Without gathers, the 4 pixels of each column are loaded one by one
+TARGET_SSE41 void upscale_row_sse41(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output)
+{
+  auto load = [](const std::uint32_t* row, const std::int32_t* indices) {
+    return _mm_setr_epi32(
+      static_cast<int>(row[indices[0]]),
+      static_cast<int>(row[indices[1]]),
+      static_cast<int>(row[indices[2]]),
+      static_cast<int>(row[indices[3]]));
+  };
+  auto row_weight = _mm_set1_epi16(static_cast<short>(weight_y));
+  auto x = 0UZ;
+  for (; x + 4 <= count; x += 4) {
+    auto weight = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + x));
+    weight = _mm_or_si128(weight, _mm_slli_epi32(weight, 16));
+    auto upper = lerp_colors_sse41(load(top, columns + x), load(top, next_columns + x), weight);
+    auto lower = lerp_colors_sse41(load(bottom, columns + x), load(bottom, next_columns + x), weight);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + x), lerp_colors_sse41(upper, lower, row_weight));
+  }
+  upscale_row_scalar(top, bottom, weight_y, columns + x, next_columns + x, weights + x, count - x, output + x);
+}
+
+TARGET_AVX2 void upscale_row_avx2(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output)
+{
+  const auto* top_words = reinterpret_cast<const int*>(top);
+  const auto* bottom_words = reinterpret_cast<const int*>(bottom);
+  auto row_weight = _mm256_set1_epi16(static_cast<short>(weight_y));
+  auto x = 0UZ;
+  for (; x + 8 <= count; x += 8) {
+    auto column = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns + x));
+    auto next_column = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next_columns + x));
+    auto weight = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + x));
+    weight = _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+    auto upper = lerp_colors_avx2(_mm256_i32gather_epi32(top_words, column, 4), _mm256_i32gather_epi32(top_words, next_column, 4), weight);
+    auto lower = lerp_colors_avx2(_mm256_i32gather_epi32(bottom_words, column, 4), _mm256_i32gather_epi32(bottom_words, next_column, 4), weight);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + x), lerp_colors_avx2(upper, lower, row_weight));
+  }
+  upscale_row_scalar(top, bottom, weight_y, columns + x, next_columns + x, weights + x, count - x, output + x);
+}
+
+#else
+
+auto get_row_rasterizers_sse41() -> const PipelineKernels<RowRasterizer>&
+{
+  return get_row_rasterizers_scalar();
+}
+
+auto get_row_rasterizers_avx2() -> const PipelineKernels<RowRasterizer>&
+{
+  return get_row_rasterizers_scalar();
+}
+
+auto rasterize_visibility_row_sse41(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int
+{
+  return rasterize_visibility_row_scalar(triangle, wa, wb, wc, count, depth, ids, id);
+}
+
+auto rasterize_visibility_row_avx2(const TriangleSetup& triangle, Fixed wa, Fixed wb, Fixed wc, int count, float* depth, std::uint32_t* ids, std::uint32_t id) -> int
+{
+  return rasterize_visibility_row_scalar(triangle, wa, wb, wc, count, depth, ids, id);
+}
+
+auto get_row_shaders_sse41() -> const PipelineKernels<RowShader>&
+{
+  return get_row_shaders_scalar();
+}
+
+auto get_row_shaders_avx2() -> const PipelineKernels<RowShader>&
+{
+  return get_row_shaders_scalar();
+}
+
+auto get_msaa_row_rasterizers_sse41() -> const PipelineKernels<MsaaRowRasterizer>&
+{
+  return get_msaa_row_rasterizers_scalar();
+}
+
+auto get_msaa_row_rasterizers_avx2() -> const PipelineKernels<MsaaRowRasterizer>&
+{
+  return get_msaa_row_rasterizers_scalar();
+}
+
+void upscale_row_sse41(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output)
+{
+  upscale_row_scalar(top, bottom, weight_y, columns, next_columns, weights, count, output);
+}
+
+void upscale_row_avx2(const std::uint32_t* top, const std::uint32_t* bottom, std::uint32_t weight_y, const std::int32_t* columns, const std::int32_t* next_columns, const std::int32_t* weights, std::size_t count, std::uint32_t* output)
+{
+  upscale_row_scalar(top, bottom, weight_y, columns, next_columns, weights, count, output);
+}
+
+#endif
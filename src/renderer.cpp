@@ -1,79 +1,660 @@
 #include "renderer.hpp"
+#include "allocation_counter.hpp"
 #include "clipper.hpp"
+#include "meshlet.hpp"
 #include "model.hpp"
+#include "profiler.hpp"
+#include "raster.hpp"
 #include "timer.hpp"
+#include "vertex_transform.hpp"
 
 #include <glm/ext/matrix_clip_space.hpp>
+#include <glm/geometric.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/matrix.hpp>
 #include <glm/trigonometric.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
+#include <limits>
+#include <tuple>
+#include <memory_resource>
+#include <unordered_map>
+#include <utility>
 
 #include <iostream>
 
-auto get_model_matrix(const Model& model) -> glm::mat4
+auto get_model_matrix(const Transform& transform) -> glm::mat4
 {
-  auto transform = glm::translate(glm::mat4{ 1.0F }, model.position);
-  transform = glm::rotate(transform, model.rotation.x, glm::vec3{ 1.0F, 0.0F, 0.0F });
-  transform = glm::rotate(transform, model.rotation.y, glm::vec3{ 0.0F, 1.0F, 0.0F });
-  transform = glm::rotate(transform, model.rotation.z, glm::vec3{ 0.0F, 0.0F, 1.0F });
-  transform = glm::scale(transform, model.scale);
-  return transform;
+  auto matrix = glm::translate(glm::mat4{ 1.0F }, transform.position);
+  matrix = glm::rotate(matrix, transform.rotation.x, glm::vec3{ 1.0F, 0.0F, 0.0F });
+  matrix = glm::rotate(matrix, transform.rotation.y, glm::vec3{ 0.0F, 1.0F, 0.0F });
+  matrix = glm::rotate(matrix, transform.rotation.z, glm::vec3{ 0.0F, 0.0F, 1.0F });
+  matrix = glm::scale(matrix, transform.scale);
+  return matrix;
+}
+
+Renderer::Renderer(std::size_t render_width, std::size_t render_height, std::size_t thread_count, std::size_t color_buffer_count)
+  : m_render_width{ render_width },
+    m_render_height{ render_height },
+    m_viewport_width{ render_width },
+    m_viewport_height{ render_height },
+    m_colors(render_width * render_height),
+    m_depth(render_width * render_height),
+    m_simd_level{ detect_simd_level() },
+    m_row_rasterizers{ get_row_rasterizers(m_simd_level) },
+    m_rasterize_visibility_row{ get_visibility_row_rasterizer(m_simd_level) },
+    m_row_shaders{ get_row_shaders(m_simd_level) },
+    m_msaa_row_rasterizers{ get_msaa_row_rasterizers(m_simd_level) },
+    m_upscale_row{ get_row_upscaler(m_simd_level) },
+    m_transform_vertices{ get_vertex_transformer(m_simd_level) },
+    m_tile_count_x{ (render_width + tile_size - 1) / tile_size },
+    m_tile_count_y{ (render_height + tile_size - 1) / tile_size },
+    m_thread_pool{ std::max(thread_count, 1UZ) }
+{
+  auto spare_count = std::max(color_buffer_count, 1UZ) - 1;
+  m_background_tiles.resize(m_tile_count_x * m_tile_count_y);
+  m_spare_colors.resize(spare_count, m_colors);
+  m_spare_background_tiles.resize(spare_count, m_background_tiles);
+  m_tile_generation.resize(m_tile_count_x * m_tile_count_y);
+  m_block_count_x = (render_width + block_size - 1) / block_size;
+  m_block_count_y = (render_height + block_size - 1) / block_size;
+  m_block_max_depth.resize(m_block_count_x * m_block_count_y);
+  m_block_writes.resize(m_block_count_x * m_block_count_y);
+  m_tile_max_depth.resize(m_tile_count_x * m_tile_count_y);
+  m_tile_dirty.resize(m_tile_count_x * m_tile_count_y);
+  clear();
+
+  auto chunk_count = m_thread_pool.thread_count();
+  m_chunk_arenas = std::make_unique<FrameArena[]>(chunk_count);
+  for (auto chunk = 0UZ; chunk < chunk_count; ++chunk) {
+    m_chunk_triangles.emplace_back(&m_chunk_arenas[chunk]);
+    m_bin_block_pools.emplace_back(m_chunk_arenas[chunk]);
+  }
+  m_chunk_stats.resize(chunk_count);
+  m_chunk_first_ids.resize(chunk_count);
+  m_bins.resize(chunk_count * m_tile_count_x * m_tile_count_y);
+  m_tile_stats.resize(m_tile_count_x * m_tile_count_y);
+}
+
+void Renderer::set_simd_level(SimdLevel level)
+{
+  m_simd_level = std::min(level, detect_simd_level());
+  m_row_rasterizers = get_row_rasterizers(m_simd_level);
+  m_rasterize_visibility_row = get_visibility_row_rasterizer(m_simd_level);
+  m_row_shaders = get_row_shaders(m_simd_level);
+  m_msaa_row_rasterizers = get_msaa_row_rasterizers(m_simd_level);
+  m_upscale_row = get_row_upscaler(m_simd_level);
+  m_transform_vertices = get_vertex_transformer(m_simd_level);
+}
+
+void Renderer::set_shading_mode(ShadingMode mode)
+{
+  m_shading_mode = mode;
+  // only allocated once needed
+  if (mode == ShadingMode::visibility) m_triangle_ids.resize(m_render_width * m_render_height);
+}
+
+void Renderer::set_msaa(bool enabled)
+{
+  m_msaa = enabled;
+  if (enabled) {
+    m_sample_depth.resize(m_render_width * m_render_height * g_msaa_sample_count);
+    m_sample_colors.resize(m_render_width * m_render_height * g_msaa_sample_count);
+  }
+}
+
+void Renderer::set_frame_time_budget(double milliseconds)
+{
+  m_resolution_scaler.reset();
+  if (milliseconds <= 0.0) return;
+  m_resolution_scaler.emplace(milliseconds);
+  m_scaled_colors.resize(m_colors.size());
+  m_scaled_background_tiles.assign(m_background_tiles.size(), 0);
+  m_upscale_columns.resize(m_render_width);
+  m_upscale_next_columns.resize(m_render_width);
+  m_upscale_weights.resize(m_render_width);
 }
 
 void Renderer::render(const Scene& scene)
 {
-  auto view_matrix = glm::lookAt(glm::vec3{ 0.0F, 1.5F, 8.0F }, glm::vec3{ 0.0F, 1.5F, 0.0 }, glm::vec3{ 0.0F, 1.0F, 0.0F });
+  // The check is left out of release builds, and of profiled ones, as the profiler records
+  // its events on the heap
+#if !defined(PROFILING) && !defined(NDEBUG)
+  auto allocations = AllocationScope{};
+  auto memory_growth = get_memory_growth();
+#endif
+  if (m_resolution_scaler) draw_scaled(scene);
+  else draw(scene);
+#if !defined(PROFILING) && !defined(NDEBUG)
+  assert(allocations.count() == 0 || get_memory_growth() != memory_growth);
+#endif
+}
+
+void Renderer::draw_scaled(const Scene& scene)
+{
+  // The frame is drawn into the top left corner of m_scaled_colors, then upscaled into m_colors
+  auto timer = Timer{};
+  auto scale = m_resolution_scaler->scale();
+  auto width = std::clamp(static_cast<std::size_t>(std::lround(static_cast<float>(m_render_width) * scale)), 1UZ, m_render_width);
+  auto height = std::clamp(static_cast<std::size_t>(std::lround(static_cast<float>(m_render_height) * scale)), 1UZ, m_render_height);
+  if (width == m_render_width && height == m_render_height) {
+    draw(scene);
+    m_resolution_scaler->update(timer.elapsed());
+    return;
+  }
+  std::swap(m_colors, m_scaled_colors);
+  std::swap(m_background_tiles, m_scaled_background_tiles);
+  // the background flags of the scaled buffer hold for the tiles of the size it was last drawn at
+  if (width != m_scaled_width || height != m_scaled_height) {
+    std::ranges::fill(m_background_tiles, 0);
+    m_scaled_width = width;
+    m_scaled_height = height;
+  }
+  set_viewport(width, height);
+  draw(scene);
+  set_viewport(m_render_width, m_render_height);
+  std::swap(m_colors, m_scaled_colors);
+  std::swap(m_background_tiles, m_scaled_background_tiles);
+  upscale(width, height);
+  // the upscale writes every pixel, so plot() must not clear the tiles again
+  std::ranges::fill(m_tile_generation, m_generation);
+  std::ranges::fill(m_background_tiles, 0);
+  m_resolution_scaler->update(timer.elapsed());
+}
+
+void Renderer::reset_frame_memory()
+{
+  m_frame_arena.reset();
+  for (auto chunk = 0UZ; chunk < m_chunk_triangles.size(); ++chunk) {
+    // the last frame tells how many triangles to expect
+    auto expected_count = m_chunk_triangles[chunk].size();
+    m_chunk_triangles[chunk] = std::pmr::vector<TriangleSetup>{ &m_chunk_arenas[chunk] };
+    m_bin_block_pools[chunk].reset();
+    m_chunk_arenas[chunk].reset();
+    m_chunk_triangles[chunk].reserve(expected_count);
+  }
+}
+
+auto Renderer::get_memory_growth() const -> std::size_t
+{
+  auto growth = m_instance_levels_growth + m_frame_arena.growth_count();
+  for (auto chunk = 0UZ; chunk < m_chunk_triangles.size(); ++chunk) {
+    growth += m_chunk_arenas[chunk].growth_count();
+  }
+  return growth;
+}
+
+void Renderer::set_viewport(std::size_t width, std::size_t height)
+{
+  if (width == m_viewport_width && height == m_viewport_height) return;
+  m_viewport_width = width;
+  m_viewport_height = height;
+  m_tile_count_x = (width + tile_size - 1) / tile_size;
+  m_tile_count_y = (height + tile_size - 1) / tile_size;
+  m_block_count_x = (width + block_size - 1) / block_size;
+  m_block_count_y = (height + block_size - 1) / block_size;
+  // the tile indices now stand for other pixels, which must be cleared again
+  std::ranges::fill(m_tile_generation, 0);
+}
+
+// Bilinear upscaling of the top left width x height pixels of m_scaled_colors into m_colors.
+// Pixel centers of both images line up, like texels of the mip levels of a texture
+void Renderer::upscale(std::size_t width, std::size_t height)
+{
+  PROFILE_ZONE("upscale");
+  auto source_position = [](std::size_t index, std::size_t size, std::size_t output_size) {
+    auto position = (static_cast<float>(index) + 0.5F) * static_cast<float>(size) / static_cast<float>(output_size) - 0.5F;
+    position = std::clamp(position, 0.0F, static_cast<float>(size - 1));
+    auto first = static_cast<std::size_t>(position);
+    auto weight = static_cast<std::uint32_t>((position - static_cast<float>(first)) * 256.0F);
+    return std::tuple{ first, std::min(first + 1, size - 1), weight };
+  };
+  for (auto x = 0UZ; x < m_render_width; ++x) {
+    auto [column, next_column, weight] = source_position(x, width, m_render_width);
+    m_upscale_columns[x] = static_cast<std::int32_t>(column);
+    m_upscale_next_columns[x] = static_cast<std::int32_t>(next_column);
+    m_upscale_weights[x] = static_cast<std::int32_t>(weight);
+  }
+
+  // rows of a tile height at a time
+  auto band_count = (m_render_height + tile_size - 1) / tile_size;
+  m_thread_pool.parallel_for(band_count, [&](std::size_t band) {
+    auto y_end = std::min((band + 1) * tile_size, m_render_height);
+    for (auto y = band * tile_size; y < y_end; ++y) {
+      auto [row, next_row, weight] = source_position(y, height, m_render_height);
+      m_upscale_row(
+        &m_scaled_colors[row * m_render_width],
+        &m_scaled_colors[next_row * m_render_width],
+        weight,
+        m_upscale_columns.data(),
+        m_upscale_next_columns.data(),
+        m_upscale_weights.data(),
+        m_render_width,
+        &m_colors[y * m_render_width]);
+    }
+  });
+}
+
+void Renderer::draw(const Scene& scene)
+{
+  PROFILE_ZONE("render");
+  const auto& camera = scene.camera;
+  auto view_matrix = glm::lookAt(camera.position, camera.target, camera.up);
   auto projection_matrix = glm::perspective(
-    glm::radians(60.0F),
+    glm::radians(camera.vertical_fov),
     static_cast<float>(m_render_width) / static_cast<float>(m_render_height),
-    0.1F,
-    100.0F);
-  auto transform_matrix = projection_matrix * view_matrix * get_model_matrix(scene.model);
-  for (const auto& mesh : scene.model.meshes) {
-    for (const auto& face : mesh.faces) {
-      auto vert_a = transform_matrix * glm::vec4{ face[0].position, 1.0F };
-      auto vert_b = transform_matrix * glm::vec4{ face[1].position, 1.0F };
-      auto vert_c = transform_matrix * glm::vec4{ face[2].position, 1.0F };
-      render_triangle(
-        ClipVertex{ vert_a, face[0].texture_coord },
-        ClipVertex{ vert_b, face[1].texture_coord },
-        ClipVertex{ vert_c, face[2].texture_coord },
-        mesh.texture);
-      // if (is_triangle_outside_frustum(vert_a, vert_b, vert_c)) continue;
-      // if (is_triangle_inside_frustum(vert_a, vert_b, vert_c)) {
-      //   render_triangle(
-      //     ClipVertex{ vert_a, face[0].texture_coord },
-      //     ClipVertex{ vert_b, face[1].texture_coord },
-      //     ClipVertex{ vert_c, face[2].texture_coord },
-      //     mesh.texture);
-      // }
-      // else {
-      //   auto clipped_verts = clip_triangle(
-      //     ClipVertex{ vert_a, face[0].texture_coord },
-      //     ClipVertex{ vert_b, face[1].texture_coord },
-      //     ClipVertex{ vert_c, face[2].texture_coord });
-      //   for (auto index = 2UZ; index < clipped_verts.size(); ++index) {
-      //     render_triangle(clipped_verts[0], clipped_verts[index - 1], clipped_verts[index], mesh.texture);
-      //   }
-      // }
-    }
-  }
-}
-
-constexpr auto g_num_fractional_bits = 18;
-using Fixed = std::int32_t;
-auto to_fixed(float num) -> Fixed
-{
-  return static_cast<Fixed>(num * (1 << g_num_fractional_bits) + 0.5F);
-}
-
-auto from_fixed(Fixed num) -> float
-{
-  return static_cast<float>(num) / (1 << g_num_fractional_bits);
+    camera.near_plane,
+    camera.far_plane);
+  auto view_projection_matrix = projection_matrix * view_matrix;
+
+  // Each instance picks its level of detail, starting from the one it drew last frame
+  if (scene.instances.size() > m_instance_levels.capacity()) ++m_instance_levels_growth;
+  m_instance_levels.resize(scene.instances.size());
+  auto focal_length = projection_matrix[1][1] * 0.5F * static_cast<float>(m_viewport_height);
+  for (auto instance = 0UZ; instance < scene.instances.size(); ++instance) {
+    const auto& [model, transform] = scene.instances[instance];
+    if (model == nullptr) continue;
+    auto model_view_matrix = view_matrix * get_model_matrix(transform);
+    m_instance_levels[instance] = select_level(*model, model_view_matrix, focal_length, m_instance_levels[instance]);
+  }
+
+  // Instances of the same model are grouped, in the order their model first appears, then by level.
+  // (model group, instance index) of the scene instances, sorted by group, level and then index
+  auto instance_order = std::pmr::vector<std::pair<std::size_t, std::size_t>>{ &m_frame_arena };
+  instance_order.reserve(scene.instances.size());
+  {
+    auto model_groups = std::pmr::unordered_map<const Model*, std::size_t>{ &m_frame_arena };
+    for (auto instance = 0UZ; instance < scene.instances.size(); ++instance) {
+      const auto* model = scene.instances[instance].model.get();
+      if (model == nullptr) continue;
+      auto group = model_groups.emplace(model, model_groups.size()).first->second;
+      instance_order.push_back(std::pair{ group, instance });
+    }
+  }
+  std::ranges::sort(instance_order, {}, [this](const auto& entry) { return std::tuple{ entry.first, m_instance_levels[entry.second], entry.second }; });
+
+  // Clip space coefficients of the frustum planes: dot_product(v, plane) == dot(coefficients, v)
+  auto plane_coefficients = std::array<glm::vec4, plane_count>{};
+  for (auto plane = 0UZ; plane < plane_count; ++plane) {
+    plane_coefficients[plane] = glm::vec4{
+      dot_product(glm::vec4{ 1.0F, 0.0F, 0.0F, 0.0F }, static_cast<FrustumPlane>(plane)),
+      dot_product(glm::vec4{ 0.0F, 1.0F, 0.0F, 0.0F }, static_cast<FrustumPlane>(plane)),
+      dot_product(glm::vec4{ 0.0F, 0.0F, 1.0F, 0.0F }, static_cast<FrustumPlane>(plane)),
+      dot_product(glm::vec4{ 0.0F, 0.0F, 0.0F, 1.0F }, static_cast<FrustumPlane>(plane))
+    };
+  }
+
+  // Meshlet stage: meshlets entirely outside one frustum plane or facing away from the camera
+  // are dropped before any of their vertices is transformed. Both tests run in the model space
+  // of each instance. Batches are emitted mesh by mesh, each one drawn by every instance of its
+  // model in a row, so the mesh vertices and texture stay in cache between instances
+  auto batches = std::pmr::vector<DrawBatch>{ &m_frame_arena };
+  auto draw_ranges = std::pmr::vector<DrawRange>{ &m_frame_arena };
+  auto instance_views = std::pmr::vector<InstanceView>{ &m_frame_arena };
+  auto culled_faces = 0UZ;
+  auto draw_vertex_count = 0UZ;
+  auto draw_face_count = 0UZ;
+  {
+    PROFILE_ZONE("meshlet culling");
+    for (auto group_begin = 0UZ; group_begin < instance_order.size();) {
+      auto group = instance_order[group_begin].first;
+      auto level = m_instance_levels[instance_order[group_begin].second];
+      auto group_end = group_begin + 1;
+      while (group_end < instance_order.size() && instance_order[group_end].first == group
+             && m_instance_levels[instance_order[group_end].second] == level) {
+        ++group_end;
+      }
+
+      instance_views.clear();
+      for (auto entry = group_begin; entry < group_end; ++entry) {
+        auto model_matrix = get_model_matrix(scene.instances[instance_order[entry].second].transform);
+        auto view = InstanceView{};
+        view.transform = view_projection_matrix * model_matrix;
+        for (auto plane = 0UZ; plane < plane_count; ++plane) {
+          view.frustum_planes[plane] = glm::transpose(view.transform) * plane_coefficients[plane];
+        }
+        view.camera_position = glm::vec3{ glm::inverse(view_matrix * model_matrix) * glm::vec4{ 0.0F, 0.0F, 0.0F, 1.0F } };
+        view.mirrored = glm::dot(glm::vec3{ model_matrix[0] }, glm::cross(glm::vec3{ model_matrix[1] }, glm::vec3{ model_matrix[2] })) < 0.0F;
+        instance_views.push_back(view);
+      }
+      auto is_visible = [](const InstanceView& view, const Meshlet& meshlet) {
+        for (const auto& plane : view.frustum_planes) {
+          if (glm::dot(glm::vec3{ plane }, meshlet.center) + plane.w < -meshlet.radius * glm::length(glm::vec3{ plane })) return false;
+        }
+        return !is_meshlet_backfacing(meshlet, view.camera_position, view.mirrored);
+      };
+      auto add_range = [&](std::size_t first_vertex, std::size_t vertex_count, std::size_t first_face, std::size_t face_count) {
+        draw_ranges.push_back(DrawRange{ batches.size() - 1, first_vertex, vertex_count, first_face, face_count, draw_vertex_count });
+        draw_vertex_count += vertex_count;
+        draw_face_count += face_count;
+      };
+
+      const auto& model = *scene.instances[instance_order[group_begin].second].model;
+      for (const auto& mesh : model.level_meshes(level)) {
+        for (const auto& view : instance_views) {
+          batches.push_back(DrawBatch{ &mesh, view.transform });
+          if (mesh.meshlets.empty()) {
+            add_range(0, mesh.vertices.size(), 0, mesh.face_count());
+            continue;
+          }
+          for (const auto& meshlet : mesh.meshlets) {
+            if (m_meshlet_culling && !is_visible(view, meshlet)) {
+              culled_faces += meshlet.index_count / 3;
+              continue;
+            }
+            add_range(meshlet.first_vertex, meshlet.vertex_count, meshlet.first_index / 3, meshlet.index_count / 3);
+          }
+        }
+      }
+      group_begin = group_end;
+    }
+  }
+  // Clip space position of every vertex drawn, by draw range, and in the same order its screen
+  // position and outcodes
+  auto clip_positions = std::pmr::vector<glm::vec4>(draw_vertex_count, &m_frame_arena);
+  auto screen_positions = std::pmr::vector<glm::vec2>(draw_vertex_count, &m_frame_arena);
+  auto outcodes = std::pmr::vector<Outcode>(draw_vertex_count, &m_frame_arena);
+  auto guard_band_outcodes = std::pmr::vector<Outcode>(draw_vertex_count, &m_frame_arena);
+  m_stats.meshlet_culled += culled_faces;
+
+  // The elements of all draw ranges are seen as one sequence, split evenly between chunks.
+  // It calls function(range, begin, end) for each part of a range in the chunk, with the
+  // element indices in the mesh from begin to end
+  auto chunk_count = m_chunk_triangles.size();
+  auto for_each_in_chunk = [&](std::size_t chunk, std::size_t total, auto&& element_range, auto&& function) {
+    auto begin = total * chunk / chunk_count;
+    auto end = total * (chunk + 1) / chunk_count;
+    auto range_begin = 0UZ;
+    for (auto range_index = 0UZ; range_index < draw_ranges.size() && range_begin < end; ++range_index) {
+      const auto& range = draw_ranges[range_index];
+      auto [first, count] = element_range(range);
+      auto range_end = range_begin + count;
+      if (std::max(begin, range_begin) < std::min(end, range_end)) {
+        function(range, first + std::max(begin, range_begin) - range_begin, first + std::min(end, range_end) - range_begin);
+      }
+      range_begin = range_end;
+    }
+  };
+
+  // Vertex stage: every vertex drawn is transformed exactly once per frame, along with its screen
+  // position and outcodes, several vertices at a time from the position streams of the mesh
+  auto screen_max = glm::vec2{ static_cast<float>(m_viewport_width - 1), static_cast<float>(m_viewport_height - 1) };
+  m_thread_pool.parallel_for(chunk_count, [&](std::size_t chunk) {
+    PROFILE_ZONE("vertex transform");
+    for_each_in_chunk(
+      chunk,
+      draw_vertex_count,
+      [](const DrawRange& range) { return std::pair{ range.first_vertex, range.vertex_count }; },
+      [&](const DrawRange& range, std::size_t begin, std::size_t end) {
+        const auto& batch = batches[range.batch];
+        const auto* streams = batch.mesh->position_streams.data();
+        auto vertex_count = batch.mesh->vertices.size();
+        auto offset = range.clip_offset + begin - range.first_vertex;
+        auto output = TransformedVertices{
+          &clip_positions[offset],
+          &screen_positions[offset],
+          &outcodes[offset],
+          &guard_band_outcodes[offset]
+        };
+        m_transform_vertices(
+          batch.transform,
+          streams + begin,
+          streams + vertex_count + begin,
+          streams + vertex_count * 2 + begin,
+          end - begin,
+          screen_max,
+          guard_band,
+          output);
+      });
+  });
+
+  // Primitive stage: each chunk sets up a contiguous range of faces and bins them into tiles
+  auto tile_count = m_tile_count_x * m_tile_count_y;
+  m_thread_pool.parallel_for(chunk_count, [&](std::size_t chunk) {
+    PROFILE_ZONE("triangle setup");
+    m_chunk_triangles[chunk].clear();
+    m_chunk_stats[chunk] = RenderStats{};
+    for (auto tile = 0UZ; tile < tile_count; ++tile) {
+      m_bins[chunk * tile_count + tile] = Bin{};
+    }
+
+    for_each_in_chunk(
+      chunk,
+      draw_face_count,
+      [](const DrawRange& range) { return std::pair{ range.first_face, range.face_count }; },
+      [&](const DrawRange& range, std::size_t begin, std::size_t end) {
+        const auto& mesh = *batches[range.batch].mesh;
+        // the indices of a range only refer to its own vertices
+        auto get_vertex = [&](std::uint32_t index) {
+          auto transformed = range.clip_offset + index - range.first_vertex;
+          return ProjectedVertex{
+            ClipVertex{ clip_positions[transformed], mesh.vertices[index].texture_coord },
+            screen_positions[transformed],
+            outcodes[transformed],
+            guard_band_outcodes[transformed]
+          };
+        };
+        for (auto face = begin; face < end; ++face) {
+          process_triangle(
+            get_vertex(mesh.indices[face * 3]),
+            get_vertex(mesh.indices[face * 3 + 1]),
+            get_vertex(mesh.indices[face * 3 + 2]),
+            *mesh.texture,
+            m_chunk_stats[chunk],
+            [&](const TriangleSetup& triangle) { bin_triangle(chunk, triangle); });
+        }
+      });
+  });
+
+  for (const auto& stats : m_chunk_stats) {
+    m_stats += stats;
+  }
+  auto triangle_count = 0UZ;
+  for (auto chunk = 0UZ; chunk < chunk_count; ++chunk) {
+    m_chunk_first_ids[chunk] = static_cast<std::uint32_t>(triangle_count + 1);
+    triangle_count += m_chunk_triangles[chunk].size();
+  }
+
+  // Back-end: tiles don't share pixels, so they are rasterized in parallel without locking
+  m_thread_pool.parallel_for(tile_count, [this](std::size_t tile) {
+    PROFILE_ZONE("rasterize tile");
+    m_tile_stats[tile] = RenderStats{};
+    rasterize_tile(tile, m_tile_stats[tile]);
+  });
+  for (auto tile = 0UZ; tile < tile_count; ++tile) {
+    m_stats += m_tile_stats[tile];
+  }
+
+  PROFILE_COUNTER("triangles submitted", m_stats.submitted);
+  PROFILE_COUNTER("triangles rasterized", m_stats.rasterized);
+  PROFILE_COUNTER("triangles culled", m_stats.meshlet_culled + m_stats.frustum_culled + m_stats.backface_culled + m_stats.empty_culled);
+  PROFILE_COUNTER("pixels written", m_stats.pixels_written);
+  PROFILE_COUNTER("pixels shaded", m_stats.pixels_shaded);
+  PROFILE_COUNTER("depth culled blocks", m_stats.depth_culled_blocks);
+}
+
+// Pixels covered by the error of each level: the error is scaled like the model, then projected
+// at the nearest point of the bounding sphere. focal_length is the size in pixels of one unit
+// seen at a distance of one
+auto Renderer::select_level(const Model& model, const glm::mat4& model_view_matrix, float focal_length, std::size_t level) const -> std::size_t
+{
+  if (model.lods.empty() || m_lod_error <= 0.0F) return 0;
+  auto scale = std::max({ glm::length(glm::vec3{ model_view_matrix[0] }),
+                          glm::length(glm::vec3{ model_view_matrix[1] }),
+                          glm::length(glm::vec3{ model_view_matrix[2] }) });
+  auto center = glm::vec3{ model_view_matrix * glm::vec4{ model.center, 1.0F } };
+  // no closer than the near plane
+  auto distance = std::max(glm::length(center) - model.radius * scale, 0.1F);
+  auto unit_pixels = scale * focal_length / distance;
+  auto error_pixels = [&](std::size_t level) { return model.level_error(level) * unit_pixels; };
+
+  level = std::min(level, model.level_count() - 1);
+  while (level > 0 && error_pixels(level) > m_lod_error) --level;
+  while (level + 1 < model.level_count() && error_pixels(level + 1) <= (1.0F - lod_hysteresis) * m_lod_error) ++level;
+  return level;
+}
+
+void Renderer::bin_triangle(std::size_t chunk, const TriangleSetup& triangle)
+{
+  auto& triangles = m_chunk_triangles[chunk];
+  auto index = static_cast<std::uint32_t>(triangles.size());
+  triangles.push_back(triangle);
+
+  auto tile_count = m_tile_count_x * m_tile_count_y;
+  auto tile_xmin = static_cast<std::size_t>(triangle.xmin / tile_size);
+  auto tile_xmax = static_cast<std::size_t>(triangle.xmax / tile_size);
+  auto tile_ymin = static_cast<std::size_t>(triangle.ymin / tile_size);
+  auto tile_ymax = static_cast<std::size_t>(triangle.ymax / tile_size);
+  for (auto tile_y = tile_ymin; tile_y <= tile_ymax; ++tile_y) {
+    for (auto tile_x = tile_xmin; tile_x <= tile_xmax; ++tile_x) {
+      auto& bin = m_bins[chunk * tile_count + tile_y * m_tile_count_x + tile_x];
+      if (bin.last == nullptr || bin.last->count == bin_block_size) {
+        auto* block = m_bin_block_pools[chunk].create();
+        (bin.last == nullptr ? bin.first : bin.last->next) = block;
+        bin.last = block;
+      }
+      bin.last->indices[bin.last->count++] = index;
+    }
+  }
+}
+
+auto Renderer::tile_rect(std::size_t tile) const -> Rect
+{
+  auto tile_x = static_cast<int>(tile % m_tile_count_x) * tile_size;
+  auto tile_y = static_cast<int>(tile / m_tile_count_x) * tile_size;
+  return Rect{
+    tile_x,
+    std::min(tile_x + tile_size, static_cast<int>(m_viewport_width)) - 1,
+    tile_y,
+    std::min(tile_y + tile_size, static_cast<int>(m_viewport_height)) - 1
+  };
+}
+
+// Clears the depth of the tile, and its colors unless they already are the background,
+// the first time it is drawn into since clear()
+void Renderer::begin_tile(std::size_t tile)
+{
+  if (m_tile_generation[tile] == m_generation) return;
+  m_tile_generation[tile] = m_generation;
+  auto rect = tile_rect(tile);
+  auto width = static_cast<std::size_t>(rect.xmax - rect.xmin + 1);
+  for (auto y = rect.ymin; y <= rect.ymax; ++y) {
+    auto row = static_cast<std::size_t>(y) * m_render_width + static_cast<std::size_t>(rect.xmin);
+    std::fill_n(m_depth.begin() + static_cast<std::ptrdiff_t>(row), width, std::numeric_limits<float>::max());
+    if (!m_background_tiles[tile]) {
+      std::fill_n(m_colors.begin() + static_cast<std::ptrdiff_t>(row), width, background_color);
+    }
+    for (auto sample = 0UZ; uses_msaa() && sample < g_msaa_sample_count; ++sample) {
+      auto first_sample = static_cast<std::ptrdiff_t>(get_first_sample(static_cast<std::size_t>(rect.xmin), static_cast<std::size_t>(y)) + sample * m_render_width);
+      std::fill_n(m_sample_depth.begin() + first_sample, width, std::numeric_limits<float>::max());
+      std::fill_n(m_sample_colors.begin() + first_sample, width, background_color);
+    }
+  }
+  m_background_tiles[tile] = false;
+
+  for (auto block_y = rect.ymin / block_size; block_y <= rect.ymax / block_size; ++block_y) {
+    for (auto block_x = rect.xmin / block_size; block_x <= rect.xmax / block_size; ++block_x) {
+      auto block = static_cast<std::size_t>(block_y) * m_block_count_x + static_cast<std::size_t>(block_x);
+      m_block_max_depth[block] = std::numeric_limits<float>::max();
+      m_block_writes[block] = 0;
+    }
+  }
+  m_tile_max_depth[tile] = std::numeric_limits<float>::max();
+  m_tile_dirty[tile] = false;
+}
+
+// Fills a tile nothing was drawn into since clear() with the background color
+void Renderer::fill_background(std::size_t tile)
+{
+  if (m_tile_generation[tile] == m_generation || m_background_tiles[tile]) return;
+  auto rect = tile_rect(tile);
+  auto width = static_cast<std::size_t>(rect.xmax - rect.xmin + 1);
+  for (auto y = rect.ymin; y <= rect.ymax; ++y) {
+    auto row = static_cast<std::size_t>(y) * m_render_width + static_cast<std::size_t>(rect.xmin);
+    std::fill_n(m_colors.begin() + static_cast<std::ptrdiff_t>(row), width, background_color);
+  }
+  m_background_tiles[tile] = true;
+}
+
+void Renderer::rasterize_tile(std::size_t tile, RenderStats& stats)
+{
+  auto tile_count = m_tile_count_x * m_tile_count_y;
+  auto has_triangles = false;
+  for (auto chunk = 0UZ; chunk < m_chunk_triangles.size(); ++chunk) {
+    has_triangles = has_triangles || m_bins[chunk * tile_count + tile].first != nullptr;
+  }
+  if (!has_triangles) {
+    fill_background(tile);
+    return;
+  }
+  begin_tile(tile);
+
+  auto rect = tile_rect(tile);
+  auto visibility = m_shading_mode == ShadingMode::visibility;
+  if (visibility) {
+    auto width = static_cast<std::size_t>(rect.xmax - rect.xmin + 1);
+    for (auto y = rect.ymin; y <= rect.ymax; ++y) {
+      auto row = static_cast<std::size_t>(y) * m_render_width + static_cast<std::size_t>(rect.xmin);
+      std::fill_n(m_triangle_ids.begin() + static_cast<std::ptrdiff_t>(row), width, 0U);
+    }
+  }
+  for (auto chunk = 0UZ; chunk < m_chunk_triangles.size(); ++chunk) {
+    const auto& triangles = m_chunk_triangles[chunk];
+    for (const auto* block = m_bins[chunk * tile_count + tile].first; block != nullptr; block = block->next) {
+      for (auto entry = 0U; entry < block->count; ++entry) {
+        auto index = block->indices[entry];
+        auto id = visibility ? m_chunk_first_ids[chunk] + index : 0U;
+        rasterize_triangle(triangles[index], rect, id, stats);
+      }
+    }
+  }
+  if (visibility) resolve_tile(rect, stats);
+  if (uses_msaa()) resolve_msaa(rect);
+}
+
+// Averages the samples of every pixel of rect into its color
+void Renderer::resolve_msaa(const Rect& rect)
+{
+  PROFILE_ZONE("resolve samples");
+  for (auto y = static_cast<std::size_t>(rect.ymin); y <= static_cast<std::size_t>(rect.ymax); ++y) {
+    for (auto x = static_cast<std::size_t>(rect.xmin); x <= static_cast<std::size_t>(rect.xmax); ++x) {
+      m_colors[y * m_render_width + x] = resolve_samples(&m_sample_colors[get_first_sample(x, y)], m_render_width);
+    }
+  }
+}
+
+// Shades every pixel of rect covered by a triangle in the visibility buffer, a run of
+// pixels of the same triangle at a time. Edge values are rebuilt at the start of each run,
+// so the colors are the ones forward shading writes
+void Renderer::resolve_tile(const Rect& rect, RenderStats& stats)
+{
+  PROFILE_ZONE("resolve tile");
+  for (auto y = rect.ymin; y <= rect.ymax; ++y) {
+    const auto* ids = &m_triangle_ids[static_cast<std::size_t>(y) * m_render_width];
+    for (auto x = rect.xmin; x <= rect.xmax;) {
+      auto id = ids[x];
+      auto run_end = x + 1;
+      while (run_end <= rect.xmax && ids[run_end] == id) ++run_end;
+      if (id != 0) {
+        auto chunk = static_cast<std::size_t>(std::ranges::upper_bound(m_chunk_first_ids, id) - m_chunk_first_ids.begin()) - 1;
+        const auto& triangle = m_chunk_triangles[chunk][id - m_chunk_first_ids[chunk]];
+        auto step_x = static_cast<std::int64_t>(x - triangle.xmin);
+        auto step_y = static_cast<std::int64_t>(y - triangle.ymin);
+        auto wa = static_cast<Fixed>(triangle.wa + step_x * triangle.wa_xinc + step_y * triangle.wa_yinc);
+        auto wb = static_cast<Fixed>(triangle.wb + step_x * triangle.wb_xinc + step_y * triangle.wb_yinc);
+        auto wc = static_cast<Fixed>(triangle.wc + step_x * triangle.wc_xinc + step_y * triangle.wc_yinc);
+        auto pixel = static_cast<std::size_t>(y) * m_render_width + static_cast<std::size_t>(x);
+        m_row_shaders[triangle.pipeline](triangle, wa, wb, wc, run_end - x, &m_colors[pixel]);
+        stats.pixels_shaded += static_cast<std::size_t>(run_end - x);
+      }
+      x = run_end;
+    }
+  }
 }
 
 // It verifies if a pixel center lying exactly on an edge needs to be rendered.
@@ -101,94 +682,394 @@ auto cross(const glm::vec2& a, const glm::vec2& b) -> float
 
 auto Renderer::get_screen_position(const glm::vec4& v) const -> glm::vec2
 {
-  auto max_x = static_cast<float>(m_render_width - 1);
+  auto max_x = static_cast<float>(m_viewport_width - 1);
   auto x = ((v.x / v.w) * 0.5F + 0.5F) * max_x;
-  auto max_y = static_cast<float>(m_render_height - 1);
+  auto max_y = static_cast<float>(m_viewport_height - 1);
   auto y = ((-v.y / v.w) * 0.5F + 0.5F) * max_y;
   return { x, y };
 }
 
-// accepts counter-clockwise triangles
-void Renderer::render_triangle(const ClipVertex& p, const ClipVertex& q, const ClipVertex& r, const Texture& texture)
+// What the vertex stage computes, for a vertex that did not go through it
+auto Renderer::project_vertex(const ClipVertex& v) const -> ProjectedVertex
 {
-  auto screen_a = get_screen_position(p.position);
-  auto screen_b = get_screen_position(q.position);
-  auto screen_c = get_screen_position(r.position);
+  return ProjectedVertex{ v, get_screen_position(v.position), get_outcode(v.position), get_outcode(v.position, guard_band) };
+}
 
-  auto inv_z_a = p.position.w / p.position.z;
-  auto inv_z_b = q.position.w / q.position.z;
-  auto inv_z_c = r.position.w / r.position.z;
+// accepts counter-clockwise triangles, with positive w
+auto Renderer::setup_triangle(const ProjectedVertex& pa, const ProjectedVertex& pb, const ProjectedVertex& pc, const Texture& texture) const -> std::optional<TriangleSetup>
+{
+  const auto& p = pa.vertex;
+  const auto& q = pb.vertex;
+  const auto& r = pc.vertex;
+  auto screen_a = pa.screen_position;
+  auto screen_b = pb.screen_position;
+  auto screen_c = pc.screen_position;
 
-  auto tcoord_a = p.texture_coord * inv_z_a;
-  auto tcoord_b = q.texture_coord * inv_z_b;
-  auto tcoord_c = r.texture_coord * inv_z_c;
+  auto triangle = TriangleSetup{};
+  triangle.texture = &texture;
 
-  auto xmin = static_cast<int>(std::min(std::min(screen_a.x, screen_b.x), screen_c.x) + 0.5F);
-  xmin = glm::clamp(xmin, 0, static_cast<int>(m_render_width) - 1);
-  auto xmax = static_cast<int>(std::max(std::max(screen_a.x, screen_b.x), screen_c.x) - 0.5F);
-  xmax = glm::clamp(xmax, 0, static_cast<int>(m_render_width) - 1);
+  triangle.inv_w_a = 1.0F / p.position.w;
+  triangle.inv_w_b = 1.0F / q.position.w;
+  triangle.inv_w_c = 1.0F / r.position.w;
 
-  auto ymin = static_cast<int>(std::min(std::min(screen_a.y, screen_b.y), screen_c.y) + 0.5F);
-  ymin = glm::clamp(ymin, 0, static_cast<int>(m_render_height) - 1);
-  auto ymax = static_cast<int>(std::max(std::max(screen_a.y, screen_b.y), screen_c.y) - 0.5F);
-  ymax = glm::clamp(ymax, 0, static_cast<int>(m_render_height) - 1);
+  triangle.z_a = p.position.z * triangle.inv_w_a;
+  triangle.z_b = q.position.z * triangle.inv_w_b;
+  triangle.z_c = r.position.z * triangle.inv_w_c;
+  triangle.min_z = std::min(std::min(triangle.z_a, triangle.z_b), triangle.z_c);
 
-  auto start = glm::vec2{
-    static_cast<float>(xmin) + 0.5F,
-    static_cast<float>(ymin) + 0.5F
-  };
+  triangle.tcoord_a = p.texture_coord * triangle.inv_w_a;
+  triangle.tcoord_b = q.texture_coord * triangle.inv_w_b;
+  triangle.tcoord_c = r.texture_coord * triangle.inv_w_c;
+
+  auto min_x = std::min(std::min(screen_a.x, screen_b.x), screen_c.x);
+  auto max_x = std::max(std::max(screen_a.x, screen_b.x), screen_c.x);
+  auto min_y = std::min(std::min(screen_a.y, screen_b.y), screen_c.y);
+  auto max_y = std::max(std::max(screen_a.y, screen_b.y), screen_c.y);
+
+  // pixels whose center or, when multisampling, one of whose samples is inside the bounds
+  auto margin = uses_msaa() ? g_msaa_max_sample_offset : 0.0F;
+  triangle.xmin = glm::clamp(static_cast<int>(min_x + 0.5F - margin), 0, static_cast<int>(m_viewport_width) - 1);
+  triangle.xmax = glm::clamp(static_cast<int>(max_x - 0.5F + margin), 0, static_cast<int>(m_viewport_width) - 1);
+  triangle.ymin = glm::clamp(static_cast<int>(min_y + 0.5F - margin), 0, static_cast<int>(m_viewport_height) - 1);
+  triangle.ymax = glm::clamp(static_cast<int>(max_y - 0.5F + margin), 0, static_cast<int>(m_viewport_height) - 1);
+
+  if (triangle.xmin > triangle.xmax || triangle.ymin > triangle.ymax) return {};
 
   auto cb = screen_c - screen_b;
   auto ac = screen_a - screen_c;
   auto ba = screen_b - screen_a;
 
+  auto area = cross(-ba, cb);
+  if (area <= 0.0F) return {};
+
+  // Inside the bounding box, no edge value is larger than extent * extent
+  constexpr auto max_edge_value = static_cast<float>(1 << 30);
+  auto extent = (max_x - min_x) + (max_y - min_y) + 1.0F;
+  auto fractional_bits = g_max_fractional_bits;
+  while (fractional_bits > 0 && extent * extent * static_cast<float>(1 << fractional_bits) >= max_edge_value) {
+    --fractional_bits;
+  }
+  triangle.inv_area = 1.0F / (area * static_cast<float>(1 << fractional_bits));
+
+  // Texture coordinates are in texels, so the texel to pixel area ratio gives the mip level
+  auto texel_area = std::abs(cross(q.texture_coord - p.texture_coord, r.texture_coord - p.texture_coord));
+  auto lod = texel_area > area ? 0.5F * std::log2(texel_area / area) : 0.0F;
+  lod = std::min(lod, static_cast<float>(texture.level_count() - 1));
+  auto sampler = m_sampler_mode;
+  if (m_sampler_mode == SamplerMode::trilinear) {
+    triangle.mip_level = static_cast<std::size_t>(lod);
+    triangle.mip_blend = static_cast<std::uint32_t>((lod - static_cast<float>(triangle.mip_level)) * 256.0F);
+    // nothing to blend with the next level: bilinear sampling gives the same colors from one level
+    if (triangle.mip_blend == 0 || triangle.mip_level + 1 >= texture.level_count()) sampler = SamplerMode::bilinear;
+  }
+  else {
+    triangle.mip_level = static_cast<std::size_t>(lod + 0.5F);
+  }
+  triangle.pipeline = get_pipeline_index(PipelineState{ sampler, texture.format() });
+
+  auto start = glm::vec2{
+    static_cast<float>(triangle.xmin) + 0.5F,
+    static_cast<float>(triangle.ymin) + 0.5F
+  };
+
   auto bias_a = needs_to_render_edge(cb) ? 0 : -1;
   auto bias_b = needs_to_render_edge(ac) ? 0 : -1;
   auto bias_c = needs_to_render_edge(ba) ? 0 : -1;
 
-  auto wa = to_fixed(cross(start - screen_b, cb)) + bias_a;
-  auto wb = to_fixed(cross(start - screen_c, ac)) + bias_b;
-  auto wc = to_fixed(cross(start - screen_a, ba)) + bias_c;
+  triangle.wa = to_fixed(cross(start - screen_b, cb), fractional_bits) + bias_a;
+  triangle.wb = to_fixed(cross(start - screen_c, ac), fractional_bits) + bias_b;
+  triangle.wc = to_fixed(cross(start - screen_a, ba), fractional_bits) + bias_c;
 
-  auto wa_xinc = to_fixed(cb.y);
-  auto wb_xinc = to_fixed(ac.y);
-  auto wc_xinc = to_fixed(ba.y);
+  triangle.wa_xinc = to_fixed(cb.y, fractional_bits);
+  triangle.wb_xinc = to_fixed(ac.y, fractional_bits);
+  triangle.wc_xinc = to_fixed(ba.y, fractional_bits);
 
-  auto wa_yinc = to_fixed(-cb.x);
-  auto wb_yinc = to_fixed(-ac.x);
-  auto wc_yinc = to_fixed(-ba.x);
+  triangle.wa_yinc = to_fixed(-cb.x, fractional_bits);
+  triangle.wb_yinc = to_fixed(-ac.x, fractional_bits);
+  triangle.wc_yinc = to_fixed(-ba.x, fractional_bits);
+  return triangle;
+}
 
-  auto area = cross(-ba, cb);
-  if (area <= 0.0F) return;
-  auto inv_area = 1.0F / area;
-
-  for (auto y = ymin; y <= ymax; ++y) {
-    auto wa_x = wa;
-    auto wb_x = wb;
-    auto wc_x = wc;
-
-    for (auto x = xmin; x <= xmax; ++x) {
-      if (wa_x >= 0 && wb_x >= 0 && wc_x >= 0) {
-        assert(x < static_cast<int>(m_render_width) && y < static_cast<int>(m_render_height));
-        auto alpha = from_fixed(wa_x) * inv_area;
-        auto beta = from_fixed(wb_x) * inv_area;
-        auto gama = from_fixed(wc_x) * inv_area;
-    
-        auto z = 1.0F / (alpha * inv_z_a + beta * inv_z_b + gama * inv_z_c);
-        auto screen_index = static_cast<std::size_t>(y) * m_render_width
-                            + static_cast<std::size_t>(x);
-        if (z < m_depth[screen_index]) {
-          m_depth[screen_index] = z;
-          auto tcoord = z * (alpha * tcoord_a + beta * tcoord_b + gama * tcoord_c);
-          m_colors[screen_index] = texture.at(static_cast<std::size_t>(tcoord.x), static_cast<std::size_t>(tcoord.y));
+// Culls the triangle against the frustum and its back face, clips it against the near plane
+// and the guard band, and calls emit(setup) for every triangle left to rasterize
+template <typename Emit>
+void Renderer::process_triangle(const ProjectedVertex& pa, const ProjectedVertex& pb, const ProjectedVertex& pc, const Texture& texture, RenderStats& stats, Emit&& emit) const
+{
+  ++stats.submitted;
+  const auto& p = pa.vertex;
+  const auto& q = pb.vertex;
+  const auto& r = pc.vertex;
+  auto outcode_a = pa.outcode;
+  auto outcode_b = pb.outcode;
+  auto outcode_c = pc.outcode;
+  if ((outcode_a & outcode_b & outcode_c) != 0) {
+    ++stats.frustum_culled;
+    return;
+  }
+
+  // Orientation of the projected triangle, valid even for vertices behind the camera
+  // (Olano and Greer, "Triangle scan conversion using 2D homogeneous coordinates")
+  auto determinant = glm::dot(
+    glm::vec3{ p.position.x, p.position.y, p.position.w },
+    glm::cross(glm::vec3{ q.position.x, q.position.y, q.position.w }, glm::vec3{ r.position.x, r.position.y, r.position.w }));
+  if (determinant <= 0.0F) {
+    ++stats.backface_culled;
+    return;
+  }
+
+  auto emit_setup = [&](const ProjectedVertex& a, const ProjectedVertex& b, const ProjectedVertex& c) {
+    auto triangle = setup_triangle(a, b, c, texture);
+    if (!triangle) {
+      ++stats.empty_culled;
+      return;
+    }
+    ++stats.rasterized;
+    emit(*triangle);
+  };
+
+  // The far plane is only used for culling: pixels beyond it just get a depth above 1
+  constexpr auto near_bit = Outcode{ 1 << near };
+  constexpr auto side_bits = Outcode{ (1 << left) | (1 << bottom) | (1 << right) | (1 << top) };
+  auto planes = static_cast<Outcode>(((outcode_a | outcode_b | outcode_c) & near_bit)
+                                     | ((pa.guard_band_outcode | pb.guard_band_outcode | pc.guard_band_outcode) & side_bits));
+  if (planes == 0) {
+    emit_setup(pa, pb, pc);
+    return;
+  }
+  auto polygon = clip_triangle(p, q, r, planes, guard_band);
+  // nothing of the triangle is left inside the planes
+  if (polygon.size < 3) {
+    ++stats.frustum_culled;
+    return;
+  }
+  ++stats.clipped;
+  auto first = project_vertex(polygon.vertices[0]);
+  auto previous = project_vertex(polygon.vertices[1]);
+  for (auto index = 2UZ; index < polygon.size; ++index) {
+    auto next = project_vertex(polygon.vertices[index]);
+    emit_setup(first, previous, next);
+    previous = next;
+  }
+}
+
+void Renderer::render_triangle(const ClipVertex& p, const ClipVertex& q, const ClipVertex& r, const Texture& texture)
+{
+  PROFILE_ZONE("render_triangle");
+  auto rect = Rect{ 0, static_cast<int>(m_viewport_width) - 1, 0, static_cast<int>(m_viewport_height) - 1 };
+  process_triangle(project_vertex(p), project_vertex(q), project_vertex(r), texture, m_stats, [&](const TriangleSetup& triangle) {
+    for (auto tile_y = triangle.ymin / tile_size; tile_y <= triangle.ymax / tile_size; ++tile_y) {
+      for (auto tile_x = triangle.xmin / tile_size; tile_x <= triangle.xmax / tile_size; ++tile_x) {
+        begin_tile(static_cast<std::size_t>(tile_y) * m_tile_count_x + static_cast<std::size_t>(tile_x));
+      }
+    }
+    rasterize_triangle(triangle, rect, 0, m_stats);
+    if (uses_msaa()) resolve_msaa(Rect{ triangle.xmin, triangle.xmax, triangle.ymin, triangle.ymax });
+  });
+}
+
+// Farthest depth stored in the block. Writes only make it nearer, so the stored value stays a
+// valid bound and is recomputed only after about a block worth of pixels were written
+auto Renderer::block_max_depth(std::size_t block) -> float
+{
+  if (m_block_writes[block] >= block_size * block_size) {
+    auto x_begin = (block % m_block_count_x) * block_size;
+    auto x_end = std::min(x_begin + block_size, m_viewport_width);
+    auto y_begin = (block / m_block_count_x) * block_size;
+    auto y_end = std::min(y_begin + block_size, m_viewport_height);
+    auto max_depth = std::numeric_limits<float>::lowest();
+    for (auto y = y_begin; y < y_end; ++y) {
+      for (auto x = x_begin; x < x_end; ++x) {
+        max_depth = std::max(max_depth, m_depth[y * m_render_width + x]);
+      }
+    }
+    m_block_max_depth[block] = max_depth;
+    m_block_writes[block] = 0;
+
+    constexpr auto blocks_per_tile = static_cast<std::size_t>(tile_size / block_size);
+    auto tile_x = (block % m_block_count_x) / blocks_per_tile;
+    auto tile_y = (block / m_block_count_x) / blocks_per_tile;
+    m_tile_dirty[tile_y * m_tile_count_x + tile_x] = true;
+  }
+  return m_block_max_depth[block];
+}
+
+// Farthest depth stored in the tile, taken again from its blocks when any of them changed
+auto Renderer::tile_max_depth(std::size_t tile) -> float
+{
+  if (m_tile_dirty[tile]) {
+    constexpr auto blocks_per_tile = static_cast<std::size_t>(tile_size / block_size);
+    auto block_x_begin = (tile % m_tile_count_x) * blocks_per_tile;
+    auto block_x_end = std::min(block_x_begin + blocks_per_tile, m_block_count_x);
+    auto block_y_begin = (tile / m_tile_count_x) * blocks_per_tile;
+    auto block_y_end = std::min(block_y_begin + blocks_per_tile, m_block_count_y);
+    auto max_depth = std::numeric_limits<float>::lowest();
+    for (auto block_y = block_y_begin; block_y < block_y_end; ++block_y) {
+      for (auto block_x = block_x_begin; block_x < block_x_end; ++block_x) {
+        max_depth = std::max(max_depth, block_max_depth(block_y * m_block_count_x + block_x));
+      }
+    }
+    m_tile_max_depth[tile] = max_depth;
+    m_tile_dirty[tile] = false;
+  }
+  return m_tile_max_depth[tile];
+}
+
+// Rasterizes the part of the triangle that falls inside rect. Pixels are shaded right away
+// when id is 0, otherwise they get id in the visibility buffer.
+// Blocks (or the whole tile) whose farthest depth is nearer than the triangle are skipped
+void Renderer::rasterize_triangle(const TriangleSetup& triangle, const Rect& rect, std::uint32_t id, RenderStats& stats)
+{
+  auto xmin = std::max(triangle.xmin, rect.xmin);
+  auto xmax = std::min(triangle.xmax, rect.xmax);
+  auto ymin = std::max(triangle.ymin, rect.ymin);
+  auto ymax = std::min(triangle.ymax, rect.ymax);
+  if (xmin > xmax || ymin > ymax) return;
+  auto msaa = uses_msaa();
+  // triangles no wider than a block have no empty blocks to skip, and few pixels to save
+  auto scanline = m_raster_backend == RasterBackend::scanline && xmax - xmin >= block_size;
+  // With multisampling, spans take every pixel with a sample inside the triangle: each edge is
+  // moved out by the largest edge value its samples add
+  auto margin_a = Fixed{};
+  auto margin_b = Fixed{};
+  auto margin_c = Fixed{};
+  if (scanline && msaa && id == 0) {
+    margin_a = std::ranges::max(get_sample_edge_offsets(triangle.wa_xinc, triangle.wa_yinc));
+    margin_b = std::ranges::max(get_sample_edge_offsets(triangle.wb_xinc, triangle.wb_yinc));
+    margin_c = std::ranges::max(get_sample_edge_offsets(triangle.wc_xinc, triangle.wc_yinc));
+  }
+
+  auto block_xmin = xmin / block_size;
+  auto block_xmax = xmax / block_size;
+  auto block_ymin = ymin / block_size;
+  auto block_ymax = ymax / block_size;
+
+  // Large triangles inside a single tile are tested against the tile first, so they
+  // don't need to query every block
+  constexpr auto tile_test_min_blocks = 16;
+  auto tile_x = xmin / tile_size;
+  auto tile_y = ymin / tile_size;
+  if ((block_xmax - block_xmin + 1) * (block_ymax - block_ymin + 1) > tile_test_min_blocks
+      && tile_x == xmax / tile_size && tile_y == ymax / tile_size) {
+    auto tile = static_cast<std::size_t>(tile_y) * m_tile_count_x + static_cast<std::size_t>(tile_x);
+    if (triangle.min_z >= tile_max_depth(tile)) {
+      stats.depth_culled_blocks += static_cast<std::size_t>((block_xmax - block_xmin + 1) * (block_ymax - block_ymin + 1));
+      return;
+    }
+  }
+
+  // The scanline backend walks the edges down the rows from the left of the clipped bounding box,
+  // keeping the screen pixels covered by each row of the current block row. Blocks left of the
+  // first span or right of the last one are skipped
+  auto width = xmax - xmin + 1;
+  auto row_wa = Fixed{};
+  auto row_wb = Fixed{};
+  auto row_wc = Fixed{};
+  auto bounds = EdgeBounds{};
+  if (scanline) {
+    auto start_x = static_cast<std::int64_t>(xmin - triangle.xmin);
+    auto start_y = static_cast<std::int64_t>(ymin - triangle.ymin);
+    row_wa = static_cast<Fixed>(triangle.wa + start_x * triangle.wa_xinc + start_y * triangle.wa_yinc + margin_a);
+    row_wb = static_cast<Fixed>(triangle.wb + start_x * triangle.wb_xinc + start_y * triangle.wb_yinc + margin_b);
+    row_wc = static_cast<Fixed>(triangle.wc + start_x * triangle.wc_xinc + start_y * triangle.wc_yinc + margin_c);
+    bounds = find_edge_bounds(triangle, row_wa, row_wb, row_wc, width);
+  }
+  auto spans = std::array<RowSpan, block_size>{};
+  // the kernels specialized for the pipeline state of the triangle
+  auto rasterize_row = m_row_rasterizers[triangle.pipeline];
+  auto rasterize_msaa_row = m_msaa_row_rasterizers[triangle.pipeline];
+
+  // Runs of consecutive visible blocks of a block row are rasterized together, so the row
+  // rasterizer still gets long spans
+  for (auto block_y = block_ymin; block_y <= block_ymax; ++block_y) {
+    auto y_begin = std::max(block_y * block_size, ymin);
+    auto y_end = std::min(block_y * block_size + block_size - 1, ymax);
+    auto row_first_block = static_cast<std::size_t>(block_y) * m_block_count_x;
+    auto first_block = block_xmin;
+    auto last_block = block_xmax;
+    if (scanline) {
+      auto span_xmin = xmax + 1;
+      auto span_xmax = xmin - 1;
+      for (auto y = y_begin; y <= y_end; ++y) {
+        auto span = step_row_span(triangle, row_wa, row_wb, row_wc, width, bounds);
+        spans[static_cast<std::size_t>(y - y_begin)] = RowSpan{ xmin + span.first, xmin + span.last };
+        if (span.first <= span.last) {
+          span_xmin = std::min(span_xmin, xmin + span.first);
+          span_xmax = std::max(span_xmax, xmin + span.last);
         }
+        row_wa += triangle.wa_yinc;
+        row_wb += triangle.wb_yinc;
+        row_wc += triangle.wc_yinc;
       }
-      wa_x += wa_xinc;
-      wb_x += wb_xinc;
-      wc_x += wc_xinc;
+      if (span_xmin > span_xmax) continue;
+      first_block = span_xmin / block_size;
+      last_block = span_xmax / block_size;
+    }
+    for (auto run_begin = first_block; run_begin <= last_block;) {
+      if (triangle.min_z >= block_max_depth(row_first_block + static_cast<std::size_t>(run_begin))) {
+        ++stats.depth_culled_blocks;
+        ++run_begin;
+        continue;
+      }
+      auto run_end = run_begin;
+      while (run_end < last_block && triangle.min_z < block_max_depth(row_first_block + static_cast<std::size_t>(run_end + 1))) {
+        ++run_end;
+      }
+
+      auto x_begin = std::max(run_begin * block_size, xmin);
+      auto x_end = std::min(run_end * block_size + block_size - 1, xmax);
+
+      // Step the edge values from the bounding box corner to the first pixel of the run
+      auto step_x = static_cast<std::int64_t>(x_begin - triangle.xmin);
+      auto step_y = static_cast<std::int64_t>(y_begin - triangle.ymin);
+      auto wa = static_cast<Fixed>(triangle.wa + step_x * triangle.wa_xinc + step_y * triangle.wa_yinc);
+      auto wb = static_cast<Fixed>(triangle.wb + step_x * triangle.wb_xinc + step_y * triangle.wb_yinc);
+      auto wc = static_cast<Fixed>(triangle.wc + step_x * triangle.wc_xinc + step_y * triangle.wc_yinc);
+
+      auto count = x_end - x_begin + 1;
+      auto written = 0;
+      for (auto y = y_begin; y <= y_end; ++y) {
+        auto x_first = x_begin;
+        auto span_count = count;
+        auto span_wa = wa;
+        auto span_wb = wb;
+        auto span_wc = wc;
+        if (scanline) {
+          const auto& span = spans[static_cast<std::size_t>(y - y_begin)];
+          x_first = std::max(span.first, x_begin);
+          span_count = std::min(span.last, x_end) - x_first + 1;
+          span_wa = static_cast<Fixed>(wa + (x_first - x_begin) * triangle.wa_xinc);
+          span_wb = static_cast<Fixed>(wb + (x_first - x_begin) * triangle.wb_xinc);
+          span_wc = static_cast<Fixed>(wc + (x_first - x_begin) * triangle.wc_xinc);
+        }
+        if (span_count > 0) {
+          auto x = static_cast<std::size_t>(x_first);
+          auto screen_index = static_cast<std::size_t>(y) * m_render_width + x;
+          if (id == 0 && msaa) {
+            auto first_sample = get_first_sample(x, static_cast<std::size_t>(y));
+            written += rasterize_msaa_row(triangle, span_wa, span_wb, span_wc, span_count, &m_depth[screen_index], &m_sample_depth[first_sample], &m_sample_colors[first_sample], m_render_width);
+          }
+          else if (id == 0) {
+            written += rasterize_row(triangle, span_wa, span_wb, span_wc, span_count, &m_depth[screen_index], &m_colors[screen_index]);
+          }
+          else {
+            written += m_rasterize_visibility_row(triangle, span_wa, span_wb, span_wc, span_count, &m_depth[screen_index], &m_triangle_ids[screen_index], id);
+          }
+        }
+        wa += triangle.wa_yinc;
+        wb += triangle.wb_yinc;
+        wc += triangle.wc_yinc;
+      }
+      // the run doesn't tell which of its blocks got the pixels, so each one is charged for all of them
+      if (written > 0) {
+        stats.pixels_written += static_cast<std::size_t>(written);
+        if (id == 0) stats.pixels_shaded += static_cast<std::size_t>(written);
+        auto charge = static_cast<std::uint8_t>(std::min(written, block_size * block_size));
+        for (auto block_x = run_begin; block_x <= run_end; ++block_x) {
+          auto& writes = m_block_writes[row_first_block + static_cast<std::size_t>(block_x)];
+          writes = static_cast<std::uint8_t>(std::min(writes + charge, block_size * block_size));
+        }
+      }
+      run_begin = run_end + 1;
     }
-    wa += wa_yinc;
-    wb += wb_yinc;
-    wc += wc_yinc;
   }
-}
\ No newline at end of file
+}
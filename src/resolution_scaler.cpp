@@ -0,0 +1,21 @@
+#include "resolution_scaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+ResolutionScaler::ResolutionScaler(double budget)
+  : m_budget{ budget }
+{
+}
+
+void ResolutionScaler::update(double frame_time)
+{
+  auto cost = frame_time / static_cast<double>(m_scale * m_scale);
+  m_cost = m_cost == 0.0 ? cost : m_cost + smoothing * (cost - m_cost);
+  if (m_cost <= 0.0) return;
+  auto target = static_cast<float>(std::sqrt(m_budget / m_cost));
+  target = std::clamp(target, m_scale * (1.0F - max_decrease), m_scale * (1.0F + max_increase));
+  target = std::clamp(target, min_scale, 1.0F);
+  // the limits are always reached, however close the scale already is
+  if (std::abs(target - m_scale) > dead_zone * m_scale || target == min_scale || target == 1.0F) m_scale = target;
+}
@@ -0,0 +1,234 @@
+#include "texture.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Rounded average of four colors, channel by channel
+auto average_color(std::uint32_t a, std::uint32_t b, std::uint32_t c, std::uint32_t d) -> std::uint32_t
+{
+  auto red_blue = ((a & 0x00FF00FFU) + (b & 0x00FF00FFU) + (c & 0x00FF00FFU) + (d & 0x00FF00FFU) + 0x00020002U) >> 2;
+  auto alpha_green = (((a >> 8) & 0x00FF00FFU) + ((b >> 8) & 0x00FF00FFU) + ((c >> 8) & 0x00FF00FFU) + ((d >> 8) & 0x00FF00FFU) + 0x00020002U) >> 2;
+  return (red_blue & 0x00FF00FFU) | ((alpha_green & 0x00FF00FFU) << 8);
+}
+
+Texture::Texture(std::size_t width, std::size_t height)
+{
+  if (width == 0 || height == 0) {
+    throw std::invalid_argument{ "Texture width and height must be greater than zero" };
+  }
+
+  // Levels halve down to 1x1, each one padded to whole tiles
+  for (auto level_width = width, level_height = height;; level_width = std::max(level_width / 2, 1UZ), level_height = std::max(level_height / 2, 1UZ)) {
+    auto tile_count_x = (level_width + tile_size - 1) / tile_size;
+    auto tile_count_y = (level_height + tile_size - 1) / tile_size;
+    auto scale = 1.0F / static_cast<float>(1UZ << m_levels.size());
+    m_levels.push_back(MipLevel{ level_width, level_height, tile_count_x, m_texel_count, scale });
+    m_texel_count += tile_count_x * tile_count_y * tile_size * tile_size;
+    if (level_width == 1 && level_height == 1) break;
+  }
+}
+
+Texture::Texture(std::span<const std::uint32_t> colors, std::size_t width, std::size_t height)
+  : Texture{ width, height }
+{
+  if (colors.size() != width * height) {
+    throw std::invalid_argument{ "Texture colors length must be equal to width times height" };
+  }
+
+  auto texels = std::vector<std::uint32_t>(m_texel_count);
+  auto texel = [&](std::size_t level, std::size_t x, std::size_t y) -> std::uint32_t& {
+    const auto& mip = m_levels[level];
+    return texels[mip.offset + row_offset(mip, std::min(y, mip.height - 1)) + column_offset(std::min(x, mip.width - 1))];
+  };
+
+  // Level 0 is copied a tile row at a time, the texels of a tile row being contiguous
+  for (auto y = 0UZ; y < height; ++y) {
+    const auto* row = &colors[y * width];
+    for (auto x = 0UZ; x < width; x += tile_size) {
+      std::copy_n(row + x, std::min(tile_size, width - x), &texel(0, x, y));
+    }
+  }
+
+  // Box filter of the previous level, which halves sizes rounding down: an odd size drops its
+  // last row or column, and a size of 1 repeats its only one
+  for (auto level = 1UZ; level < m_levels.size(); ++level) {
+    const auto& mip = m_levels[level];
+    for (auto y = 0UZ; y < mip.height; ++y) {
+      for (auto x = 0UZ; x < mip.width; ++x) {
+        texel(level, x, y) = average_color(
+          texel(level - 1, x * 2, y * 2),
+          texel(level - 1, x * 2 + 1, y * 2),
+          texel(level - 1, x * 2, y * 2 + 1),
+          texel(level - 1, x * 2 + 1, y * 2 + 1));
+      }
+    }
+  }
+  m_colors = Buffer<std::uint32_t>{ std::move(texels) };
+}
+
+auto Texture::from_texels(Buffer<std::uint32_t> texels, std::size_t width, std::size_t height, TextureFormat format) -> Texture
+{
+  auto texture = Texture{ width, height };
+  if (texels.size() != texture.m_texel_count / (tile_size * tile_size) * tile_word_count(format)) {
+    throw std::invalid_argument{ "Texture texels length must match the mip chain of its size" };
+  }
+  texture.m_format = format;
+  texture.m_colors = std::move(texels);
+  return texture;
+}
+
+// Block compression. Colors are compared by their squared distance in RGB
+auto color_distance(std::uint32_t a, std::uint32_t b) -> int
+{
+  auto distance = 0;
+  for (auto shift = 0U; shift < 24; shift += 8) {
+    auto difference = static_cast<int>((a >> shift) & 0xFFU) - static_cast<int>((b >> shift) & 0xFFU);
+    distance += difference * difference;
+  }
+  return distance;
+}
+
+// Nearest RGB565 color of a color given as floating point channels
+auto to_rgb565(const std::array<float, 3>& color) -> std::uint32_t
+{
+  auto quantize = [](float channel, float max) {
+    return static_cast<std::uint32_t>(std::lround(std::clamp(channel, 0.0F, 255.0F) * max / 255.0F));
+  };
+  return (quantize(color[0], 31.0F) << 11) | (quantize(color[1], 63.0F) << 5) | quantize(color[2], 31.0F);
+}
+
+// The two colors of a block are the ends of its colors projected on their principal axis,
+// the direction along which they spread the most
+auto encode_bc1_block(const std::array<std::uint32_t, 16>& colors) -> std::array<std::uint32_t, 2>
+{
+  auto channels = std::array<std::array<float, 3>, 16>{};
+  auto mean = std::array<float, 3>{};
+  for (auto texel = 0UZ; texel < 16; ++texel) {
+    for (auto channel = 0UZ; channel < 3; ++channel) {
+      channels[texel][channel] = static_cast<float>((colors[texel] >> (channel * 8)) & 0xFFU);
+      mean[channel] += channels[texel][channel] / 16.0F;
+    }
+  }
+  auto covariance = std::array<std::array<float, 3>, 3>{};
+  for (const auto& color : channels) {
+    for (auto row = 0UZ; row < 3; ++row) {
+      for (auto column = 0UZ; column < 3; ++column) {
+        covariance[row][column] += (color[row] - mean[row]) * (color[column] - mean[column]);
+      }
+    }
+  }
+  // a few power iterations are enough to settle on the axis
+  auto axis = std::array<float, 3>{ 1.0F, 1.0F, 1.0F };
+  for (auto iteration = 0; iteration < 8; ++iteration) {
+    auto next = std::array<float, 3>{};
+    for (auto row = 0UZ; row < 3; ++row) {
+      next[row] = covariance[row][0] * axis[0] + covariance[row][1] * axis[1] + covariance[row][2] * axis[2];
+    }
+    auto length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+    if (length == 0.0F) break;
+    for (auto channel = 0UZ; channel < 3; ++channel) axis[channel] = next[channel] / length;
+  }
+  auto min_projection = 0.0F;
+  auto max_projection = 0.0F;
+  for (const auto& color : channels) {
+    auto projection = (color[0] - mean[0]) * axis[0] + (color[1] - mean[1]) * axis[1] + (color[2] - mean[2]) * axis[2];
+    min_projection = std::min(min_projection, projection);
+    max_projection = std::max(max_projection, projection);
+  }
+  auto end0 = std::array<float, 3>{};
+  auto end1 = std::array<float, 3>{};
+  for (auto channel = 0UZ; channel < 3; ++channel) {
+    end0[channel] = mean[channel] + axis[channel] * max_projection;
+    end1[channel] = mean[channel] + axis[channel] * min_projection;
+  }
+
+  // The first color is the larger one, which is what marks a four color block
+  auto color0 = to_rgb565(end0);
+  auto color1 = to_rgb565(end1);
+  if (color0 < color1) std::swap(color0, color1);
+  auto block = std::array<std::uint32_t, 2>{ color0 | (color1 << 16), 0 };
+  if (color0 == color1) return block;
+  auto palette = std::array<std::uint32_t, 4>{};
+  for (auto index = 0U; index < 4; ++index) {
+    block[1] = index * 0x55555555U;
+    palette[index] = decode_bc1_texel(block.data(), 0);
+  }
+  block[1] = 0;
+  for (auto texel = 0UZ; texel < 16; ++texel) {
+    auto best = 0U;
+    for (auto index = 1U; index < 4; ++index) {
+      if (color_distance(colors[texel], palette[index]) < color_distance(colors[texel], palette[best])) best = index;
+    }
+    block[1] |= best << (texel * 2);
+  }
+  return block;
+}
+
+// The two alphas of a block are its largest and smallest
+auto encode_bc3_block(const std::array<std::uint32_t, 16>& colors) -> std::array<std::uint32_t, 4>
+{
+  auto alpha0 = 0U;
+  auto alpha1 = 255U;
+  for (auto color : colors) {
+    alpha0 = std::max(alpha0, color >> 24);
+    alpha1 = std::min(alpha1, color >> 24);
+  }
+  auto bits = std::uint64_t{ alpha0 } | (std::uint64_t{ alpha1 } << 8);
+  if (alpha0 != alpha1) {
+    for (auto texel = 0UZ; texel < 16; ++texel) {
+      auto alpha = static_cast<int>(colors[texel] >> 24);
+      auto best = 0U;
+      auto best_distance = 256;
+      for (auto index = 0U; index < 8; ++index) {
+        auto value = index == 0 ? alpha0 : index == 1 ? alpha1 : ((8 - index) * alpha0 + (index - 1) * alpha1) / 7;
+        auto distance = std::abs(static_cast<int>(value) - alpha);
+        if (distance < best_distance) {
+          best = index;
+          best_distance = distance;
+        }
+      }
+      bits |= std::uint64_t{ best } << (16 + texel * 3);
+    }
+  }
+  auto color_block = encode_bc1_block(colors);
+  return { static_cast<std::uint32_t>(bits), static_cast<std::uint32_t>(bits >> 32), color_block[0], color_block[1] };
+}
+
+auto Texture::compress() const -> Texture
+{
+  if (m_format != TextureFormat::rgba8) return *this;
+  auto opaque = true;
+  for (auto y = 0UZ; y < height() && opaque; ++y) {
+    for (auto x = 0UZ; x < width(); ++x) opaque = opaque && (at(x, y) >> 24) == 0xFFU;
+  }
+
+  auto texture = Texture{ width(), height() };
+  texture.m_format = opaque ? TextureFormat::bc1 : TextureFormat::bc3;
+  auto words_per_block = tile_word_count(texture.m_format);
+  auto blocks = std::vector<std::uint32_t>(m_texel_count / (tile_size * tile_size) * words_per_block);
+  for (auto level = 0UZ; level < m_levels.size(); ++level) {
+    const auto& mip = m_levels[level];
+    for (auto tile_y = 0UZ; tile_y * tile_size < mip.height; ++tile_y) {
+      for (auto tile_x = 0UZ; tile_x < mip.tile_count_x; ++tile_x) {
+        // texels past the edges of the level repeat the last row or column
+        auto colors = std::array<std::uint32_t, 16>{};
+        for (auto texel = 0UZ; texel < 16; ++texel) {
+          colors[texel] = at(tile_x * tile_size + texel % tile_size, tile_y * tile_size + texel / tile_size, level);
+        }
+        auto block = (mip.offset + row_offset(mip, tile_y * tile_size) + column_offset(tile_x * tile_size)) / 16;
+        auto* output = &blocks[block * words_per_block];
+        if (opaque) std::ranges::copy(encode_bc1_block(colors), output);
+        else std::ranges::copy(encode_bc3_block(colors), output);
+      }
+    }
+  }
+  texture.m_colors = Buffer<std::uint32_t>{ std::move(blocks) };
+  return texture;
+}
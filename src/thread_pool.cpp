@@ -0,0 +1,79 @@
+#include "thread_pool.hpp"
+#include "allocation_counter.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t thread_count)
+{
+  thread_count = std::max(thread_count, 1UZ);
+  m_workers.reserve(thread_count - 1);
+  for (auto index = 1UZ; index < thread_count; ++index) {
+    m_workers.emplace_back([this] { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    auto lock = std::scoped_lock{ m_mutex };
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run(std::size_t count, Job job, void* context)
+{
+  if (count == 0) return;
+  if (m_workers.empty() || count == 1) {
+    for (auto index = 0UZ; index < count; ++index) {
+      job(context, index);
+    }
+    return;
+  }
+  {
+    auto lock = std::scoped_lock{ m_mutex };
+    m_job = job;
+    m_context = context;
+    m_count = count;
+    m_next.store(0, std::memory_order_relaxed);
+    m_pending_workers = m_workers.size();
+    m_allocation_counter = AllocationCounter::current();
+    ++m_generation;
+  }
+  m_wake.notify_all();
+  execute();
+  auto lock = std::unique_lock{ m_mutex };
+  m_done.wait(lock, [this] { return m_pending_workers == 0; });
+}
+
+void ThreadPool::execute()
+{
+  for (auto index = m_next.fetch_add(1, std::memory_order_relaxed); index < m_count;
+       index = m_next.fetch_add(1, std::memory_order_relaxed)) {
+    m_job(m_context, index);
+  }
+}
+
+void ThreadPool::worker_loop()
+{
+  auto seen_generation = std::uint64_t{};
+  while (true) {
+    {
+      auto lock = std::unique_lock{ m_mutex };
+      m_wake.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+      if (m_stop) return;
+      seen_generation = m_generation;
+      AllocationCounter::set_current(m_allocation_counter);
+    }
+    execute();
+    // the counter belongs to the caller, which may end its scope as soon as run returns
+    AllocationCounter::set_current(nullptr);
+    {
+      auto lock = std::scoped_lock{ m_mutex };
+      if (--m_pending_workers == 0) m_done.notify_one();
+    }
+  }
+}
@@ -0,0 +1,28 @@
+#include "vertex_transform.hpp"
+
+auto get_vertex_transformer(SimdLevel level) -> VertexTransformer
+{
+  switch (level) {
+    case SimdLevel::avx2:
+      return transform_vertices_avx2;
+    case SimdLevel::sse41:
+      return transform_vertices_sse41;
+    default:
+      return transform_vertices_scalar;
+  }
+}
+
+void transform_vertices_scalar(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output)
+{
+  for (auto vertex = 0UZ; vertex < count; ++vertex) {
+    // glm sums the columns in pairs, and the last one is multiplied by w = 1
+    auto clip = (transform[0] * x[vertex] + transform[1] * y[vertex]) + (transform[2] * z[vertex] + transform[3]);
+    output.clip_positions[vertex] = clip;
+    output.screen_positions[vertex] = glm::vec2{
+      ((clip.x / clip.w) * 0.5F + 0.5F) * screen_max.x,
+      ((-clip.y / clip.w) * 0.5F + 0.5F) * screen_max.y
+    };
+    output.outcodes[vertex] = get_outcode(clip);
+    output.guard_band_outcodes[vertex] = get_outcode(clip, guard_band);
+  }
+}
@@ -0,0 +1,204 @@
+#include "vertex_transform.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define _3D_FROM_SCRATCH_X86
+#include <immintrin.h>
+#endif
+
+// Same per-function targets as the row rasterizers (see raster_simd.cpp)
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+#ifdef _3D_FROM_SCRATCH_X86
+
+// Lambdas don't get the target attribute of their enclosing function, so the kernels only call
+// functions declared with it
+
+// Row of the clip space positions of the lanes, summed in the same order as glm
+TARGET_SSE41 static auto get_clip_row_sse41(const glm::mat4& transform, int row, __m128 x, __m128 y, __m128 z) -> __m128
+{
+  return _mm_add_ps(
+    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(transform[0][row]), x), _mm_mul_ps(_mm_set1_ps(transform[1][row]), y)),
+    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(transform[2][row]), z), _mm_set1_ps(transform[3][row])));
+}
+
+TARGET_SSE41 static auto get_plane_bit_sse41(__m128 distance, int plane) -> __m128i
+{
+  return _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(distance, _mm_setzero_ps())), _mm_set1_epi32(1 << plane));
+}
+
+// One bit per plane the lanes are outside of, as get_outcode computes it
+TARGET_SSE41 static auto get_outcodes_sse41(__m128 x, __m128 y, __m128 z, __m128 w, __m128 guard_band_w) -> __m128i
+{
+  auto zero = _mm_setzero_ps();
+  auto outcodes = _mm_or_si128(get_plane_bit_sse41(_mm_add_ps(z, w), near), get_plane_bit_sse41(_mm_add_ps(_mm_sub_ps(zero, z), w), far));
+  outcodes = _mm_or_si128(outcodes, _mm_or_si128(get_plane_bit_sse41(_mm_add_ps(x, guard_band_w), left), get_plane_bit_sse41(_mm_add_ps(y, guard_band_w), bottom)));
+  outcodes = _mm_or_si128(outcodes, _mm_or_si128(get_plane_bit_sse41(_mm_add_ps(_mm_sub_ps(zero, x), guard_band_w), right), get_plane_bit_sse41(_mm_add_ps(_mm_sub_ps(zero, y), guard_band_w), top)));
+  return outcodes;
+}
+
+// Four vertices at a time, written back from lanes to the vertex arrays with 4x4 transposes
+TARGET_SSE41 void transform_vertices_sse41(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output)
+{
+  constexpr auto lanes = 4UZ;
+  auto half = _mm_set1_ps(0.5F);
+  auto max_x = _mm_set1_ps(screen_max.x);
+  auto max_y = _mm_set1_ps(screen_max.y);
+  auto guard_band_v = _mm_set1_ps(guard_band);
+  auto sign = _mm_set1_ps(-0.0F);
+
+  auto vertex = 0UZ;
+  for (; vertex + lanes <= count; vertex += lanes) {
+    auto px = _mm_loadu_ps(x + vertex);
+    auto py = _mm_loadu_ps(y + vertex);
+    auto pz = _mm_loadu_ps(z + vertex);
+    auto cx = get_clip_row_sse41(transform, 0, px, py, pz);
+    auto cy = get_clip_row_sse41(transform, 1, px, py, pz);
+    auto cz = get_clip_row_sse41(transform, 2, px, py, pz);
+    auto cw = get_clip_row_sse41(transform, 3, px, py, pz);
+
+    auto sx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(cx, cw), half), half), max_x);
+    auto sy = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_xor_ps(cy, sign), cw), half), half), max_y);
+    auto outcodes = get_outcodes_sse41(cx, cy, cz, cw, cw);
+    auto guard_band_outcodes = get_outcodes_sse41(cx, cy, cz, cw, _mm_mul_ps(guard_band_v, cw));
+
+    _MM_TRANSPOSE4_PS(cx, cy, cz, cw);
+    auto* clip = reinterpret_cast<float*>(output.clip_positions + vertex);
+    _mm_storeu_ps(clip, cx);
+    _mm_storeu_ps(clip + 4, cy);
+    _mm_storeu_ps(clip + 8, cz);
+    _mm_storeu_ps(clip + 12, cw);
+    auto* screen = reinterpret_cast<float*>(output.screen_positions + vertex);
+    _mm_storeu_ps(screen, _mm_unpacklo_ps(sx, sy));
+    _mm_storeu_ps(screen + 4, _mm_unpackhi_ps(sx, sy));
+    // bytes 0 to 3 hold the four outcodes
+    auto outcode_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(outcodes, outcodes), outcodes));
+    std::memcpy(output.outcodes + vertex, &outcode_bytes, lanes);
+    outcode_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(guard_band_outcodes, guard_band_outcodes), guard_band_outcodes));
+    std::memcpy(output.guard_band_outcodes + vertex, &outcode_bytes, lanes);
+  }
+  if (vertex < count) {
+    auto tail = TransformedVertices{
+      output.clip_positions + vertex,
+      output.screen_positions + vertex,
+      output.outcodes + vertex,
+      output.guard_band_outcodes + vertex
+    };
+    transform_vertices_scalar(transform, x + vertex, y + vertex, z + vertex, count - vertex, screen_max, guard_band, tail);
+  }
+}
+
+// No fused multiply-add, which would round differently from glm
+TARGET_AVX2 static auto get_clip_row_avx2(const glm::mat4& transform, int row, __m256 x, __m256 y, __m256 z) -> __m256
+{
+  return _mm256_add_ps(
+    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(transform[0][row]), x), _mm256_mul_ps(_mm256_set1_ps(transform[1][row]), y)),
+    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(transform[2][row]), z), _mm256_set1_ps(transform[3][row])));
+}
+
+TARGET_AVX2 static auto get_plane_bit_avx2(__m256 distance, int plane) -> __m256i
+{
+  return _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ)), _mm256_set1_epi32(1 << plane));
+}
+
+TARGET_AVX2 static auto get_outcodes_avx2(__m256 x, __m256 y, __m256 z, __m256 w, __m256 guard_band_w) -> __m256i
+{
+  auto zero = _mm256_setzero_ps();
+  auto outcodes = _mm256_or_si256(get_plane_bit_avx2(_mm256_add_ps(z, w), near), get_plane_bit_avx2(_mm256_add_ps(_mm256_sub_ps(zero, z), w), far));
+  outcodes = _mm256_or_si256(outcodes, _mm256_or_si256(get_plane_bit_avx2(_mm256_add_ps(x, guard_band_w), left), get_plane_bit_avx2(_mm256_add_ps(y, guard_band_w), bottom)));
+  outcodes = _mm256_or_si256(outcodes, _mm256_or_si256(get_plane_bit_avx2(_mm256_add_ps(_mm256_sub_ps(zero, x), guard_band_w), right), get_plane_bit_avx2(_mm256_add_ps(_mm256_sub_ps(zero, y), guard_band_w), top)));
+  return outcodes;
+}
+
+// Stores the outcodes of the 8 lanes as 8 bytes
+TARGET_AVX2 static void store_outcodes_avx2(Outcode* destination, __m256i outcodes)
+{
+  // packing works within each 128 bit half, leaving lanes 0 to 3 in the low bytes of the first
+  // half and lanes 4 to 7 in the low bytes of the second
+  auto bytes = _mm256_packus_epi16(_mm256_packs_epi32(outcodes, outcodes), outcodes);
+  auto low = _mm_cvtsi128_si32(_mm256_castsi256_si128(bytes));
+  auto high = _mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1));
+  std::memcpy(destination, &low, 4);
+  std::memcpy(destination + 4, &high, 4);
+}
+
+// Eight vertices at a time. Lanes go back to the vertex arrays with in-lane transposes followed
+// by 128 bit permutes, since AVX2 shuffles don't cross the two halves of a register
+TARGET_AVX2 void transform_vertices_avx2(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output)
+{
+  constexpr auto lanes = 8UZ;
+  auto half = _mm256_set1_ps(0.5F);
+  auto max_x = _mm256_set1_ps(screen_max.x);
+  auto max_y = _mm256_set1_ps(screen_max.y);
+  auto guard_band_v = _mm256_set1_ps(guard_band);
+  auto sign = _mm256_set1_ps(-0.0F);
+
+  auto vertex = 0UZ;
+  for (; vertex + lanes <= count; vertex += lanes) {
+    auto px = _mm256_loadu_ps(x + vertex);
+    auto py = _mm256_loadu_ps(y + vertex);
+    auto pz = _mm256_loadu_ps(z + vertex);
+    auto cx = get_clip_row_avx2(transform, 0, px, py, pz);
+    auto cy = get_clip_row_avx2(transform, 1, px, py, pz);
+    auto cz = get_clip_row_avx2(transform, 2, px, py, pz);
+    auto cw = get_clip_row_avx2(transform, 3, px, py, pz);
+
+    auto sx = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(cx, cw), half), half), max_x);
+    auto sy = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(_mm256_xor_ps(cy, sign), cw), half), half), max_y);
+    store_outcodes_avx2(output.outcodes + vertex, get_outcodes_avx2(cx, cy, cz, cw, cw));
+    store_outcodes_avx2(output.guard_band_outcodes + vertex, get_outcodes_avx2(cx, cy, cz, cw, _mm256_mul_ps(guard_band_v, cw)));
+
+    // vertex n of each half in register n: (0 | 4), (1 | 5), (2 | 6) and (3 | 7)
+    auto xy_low = _mm256_unpacklo_ps(cx, cy);
+    auto xy_high = _mm256_unpackhi_ps(cx, cy);
+    auto zw_low = _mm256_unpacklo_ps(cz, cw);
+    auto zw_high = _mm256_unpackhi_ps(cz, cw);
+    auto vertex_0_4 = _mm256_shuffle_ps(xy_low, zw_low, 0x44);
+    auto vertex_1_5 = _mm256_shuffle_ps(xy_low, zw_low, 0xEE);
+    auto vertex_2_6 = _mm256_shuffle_ps(xy_high, zw_high, 0x44);
+    auto vertex_3_7 = _mm256_shuffle_ps(xy_high, zw_high, 0xEE);
+    auto* clip = reinterpret_cast<float*>(output.clip_positions + vertex);
+    _mm256_storeu_ps(clip, _mm256_permute2f128_ps(vertex_0_4, vertex_1_5, 0x20));
+    _mm256_storeu_ps(clip + 8, _mm256_permute2f128_ps(vertex_2_6, vertex_3_7, 0x20));
+    _mm256_storeu_ps(clip + 16, _mm256_permute2f128_ps(vertex_0_4, vertex_1_5, 0x31));
+    _mm256_storeu_ps(clip + 24, _mm256_permute2f128_ps(vertex_2_6, vertex_3_7, 0x31));
+
+    // (0 1 | 4 5) and (2 3 | 6 7)
+    auto screen_low = _mm256_unpacklo_ps(sx, sy);
+    auto screen_high = _mm256_unpackhi_ps(sx, sy);
+    auto* screen = reinterpret_cast<float*>(output.screen_positions + vertex);
+    _mm256_storeu_ps(screen, _mm256_permute2f128_ps(screen_low, screen_high, 0x20));
+    _mm256_storeu_ps(screen + 8, _mm256_permute2f128_ps(screen_low, screen_high, 0x31));
+  }
+  if (vertex < count) {
+    auto tail = TransformedVertices{
+      output.clip_positions + vertex,
+      output.screen_positions + vertex,
+      output.outcodes + vertex,
+      output.guard_band_outcodes + vertex
+    };
+    transform_vertices_scalar(transform, x + vertex, y + vertex, z + vertex, count - vertex, screen_max, guard_band, tail);
+  }
+}
+
+#else
+
+void transform_vertices_sse41(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output)
+{
+  transform_vertices_scalar(transform, x, y, z, count, screen_max, guard_band, output);
+}
+
+void transform_vertices_avx2(const glm::mat4& transform, const float* x, const float* y, const float* z, std::size_t count, glm::vec2 screen_max, float guard_band, const TransformedVertices& output)
+{
+  transform_vertices_scalar(transform, x, y, z, count, screen_max, guard_band, output);
+}
+
+#endif